@@ -5,6 +5,13 @@
 #include <algorithm>
 #include <random>
 #include <ctime>
+#include <iostream>
+#include <memory>
+#include "LibraryIndex.hpp"
+#include "LibraryScanner.hpp"
+#include "MappedSoundFile.hpp"
+#include "ThreadPool.hpp"
+#include "TrackLoader.hpp"
 
 // Base class
 class AudioPlayer {
@@ -23,56 +30,69 @@ public:
 class MusicPlayer : public AudioPlayer {
 public:
     MusicPlayer(const std::vector<std::string>& musicFiles)
-        : musicFiles(musicFiles), currentIndex(0), isLooping(false), isShuffled(false) {
+        : musicFiles(musicFiles), currentIndex(0), isLooping(false), isShuffled(false), isLoading(false), playWhenLoaded(false) {
         if (!musicFiles.empty()) {
-            music.openFromFile(musicFiles[currentIndex]);
+            load(musicFiles[currentIndex], false);
         }
         std::srand(std::time(nullptr));  // Seed for shuffling
     }
 
     void play() override {
-        if (music.getStatus() != sf::Music::Playing) {
-            music.play();
+        if (isLoading || !music) {
+            playWhenLoaded = true;
+        }
+        else if (music->getStatus() != sf::Music::Playing) {
+            music->play();
         }
     }
 
     void pause() override {
-        if (music.getStatus() == sf::Music::Playing) {
-            music.pause();
+        playWhenLoaded = false;
+        if (music && music->getStatus() == sf::Music::Playing) {
+            music->pause();
         }
     }
 
     void stop() override {
-        music.stop();
+        playWhenLoaded = false;
+        if (music) {
+            music->stop();
+        }
     }
 
     void next() override {
+        if (musicFiles.empty()) {
+            return;
+        }
         if (isShuffled && !shuffleIndices.empty()) {
             currentIndex = (currentIndex + 1) % shuffleIndices.size();
-            music.openFromFile(musicFiles[shuffleIndices[currentIndex]]);
+            load(musicFiles[shuffleIndices[currentIndex]], true);
         }
         else {
             currentIndex = (currentIndex + 1) % musicFiles.size();
-            music.openFromFile(musicFiles[currentIndex]);
+            load(musicFiles[currentIndex], true);
         }
-        play();
     }
 
     void previous() override {
+        if (musicFiles.empty()) {
+            return;
+        }
         if (isShuffled && !shuffleIndices.empty()) {
             currentIndex = (currentIndex == 0) ? shuffleIndices.size() - 1 : currentIndex - 1;
-            music.openFromFile(musicFiles[shuffleIndices[currentIndex]]);
+            load(musicFiles[shuffleIndices[currentIndex]], true);
         }
         else {
             currentIndex = (currentIndex == 0) ? musicFiles.size() - 1 : currentIndex - 1;
-            music.openFromFile(musicFiles[currentIndex]);
+            load(musicFiles[currentIndex], true);
         }
-        play();
     }
 
     void loop(bool loop) override {
         isLooping = loop;
-        music.setLoop(loop);
+        if (music) {
+            music->setLoop(loop);
+        }
     }
 
     void shuffle(bool shuffle) override {
@@ -82,7 +102,7 @@ public:
             for (int i = 0; i < musicFiles.size(); ++i) {
                 shuffleIndices[i] = i;
             }
-            std::random_shuffle(shuffleIndices.begin(), shuffleIndices.end());
+            std::shuffle(shuffleIndices.begin(), shuffleIndices.end(), std::mt19937(std::rand()));
             currentIndex = 0;
         }
         else {
@@ -91,6 +111,28 @@ public:
         }
     }
 
+    // Call once per frame: swaps in the requested track once the loader has opened it.
+    // The previous track keeps playing until then, so a slow open is never heard as silence.
+    void update() {
+        sf::Clock clock;
+        std::unique_ptr<MappedMusic> loaded;
+        if (isLoading && loader.poll(loaded)) {
+            isLoading = false;
+            if (loaded) {
+                loaded->setLoop(isLooping);
+                if (music) {
+                    music->pause();
+                    loader.retire(std::move(music));
+                }
+                music = std::move(loaded);
+                if (playWhenLoaded) {
+                    music->play();
+                }
+            }
+        }
+        recordStall(clock.getElapsedTime());
+    }
+
     // Getters
     bool getIsLooping() const {
         return isLooping;
@@ -101,24 +143,56 @@ public:
     }
 
     sf::Music::Status getStatus() const {
-        return music.getStatus();
+        return music ? music->getStatus() : sf::Music::Stopped;
+    }
+
+    // Longest time a track change has held up the caller (the event loop)
+    sf::Time getMaxStall() const {
+        return maxStall;
     }
 
 private:
-    sf::Music music;
+    void load(const std::string& path, bool autoPlay) {
+        sf::Clock clock;
+        loader.request(path);
+        isLoading = true;
+        playWhenLoaded = autoPlay;
+        recordStall(clock.getElapsedTime());
+    }
+
+    void recordStall(sf::Time elapsed) {
+        if (elapsed > maxStall) {
+            maxStall = elapsed;
+        }
+    }
+
+    TrackLoader<MappedMusic> loader;
+    std::unique_ptr<MappedMusic> music;
     std::vector<std::string> musicFiles;
     std::vector<int> shuffleIndices;
     int currentIndex;
     bool isLooping;
     bool isShuffled;
+    bool isLoading;
+    bool playWhenLoaded;
+    sf::Time maxStall;
 };
 
-int main() {
-    std::vector<std::string> musicFiles = {
-        "Songs/Aparibhasit.wav",
-        "Songs/High Hopes.wav",
-        "Songs/Otherside.wav"
-    };
+// Every track under root, found on all cores
+std::vector<std::string> scanLibrary(const std::string& root) {
+    sf::Clock clock;
+    ThreadPool pool;
+    std::vector<TrackInfo> tracks = LibraryIndex::refresh("Library.idx", root, pool);  // Unchanged files aren't opened again
+    std::cout << "Found " << tracks.size() << " tracks under " << root << " in "
+              << clock.getElapsedTime().asMilliseconds() << " ms" << std::endl;
+    return LibraryScanner::paths(tracks);
+}
+
+int main(int argc, char* argv[]) {
+    // Read uncompressed tracks straight out of memory-mapped files (must precede any file open)
+    sf::SoundFileFactory::registerReader<MappedPcmReader>();
+
+    std::vector<std::string> musicFiles = scanLibrary(argc > 1 ? argv[1] : "Songs");
 
     MusicPlayer player(musicFiles);
     player.play();
@@ -159,10 +233,16 @@ int main() {
             }
         }
 
+        // Swap in any track the loader has finished opening
+        player.update();
+
         window.clear();
         // Drawing code here if needed
         window.display();
     }
 
+    std::cout << "Longest event-loop stall during track changes: "
+              << player.getMaxStall().asMicroseconds() / 1000.0f << " ms" << std::endl;
+
     return 0;
 }
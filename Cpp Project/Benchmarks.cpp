@@ -0,0 +1,216 @@
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Equalizer.hpp"
+#include "FuzzyKernels.hpp"
+#include "Resampler.hpp"
+#include "SampleKernels.hpp"
+
+// Standalone micro-benchmarks for the audio and search kernels. Not part of the player build:
+// compile on its own with optimizations, e.g. cl /O2 /EHsc Benchmarks.cpp or g++ -O2 Benchmarks.cpp
+
+const std::size_t blockSize = 4096;  // Samples per call, about what the streaming path processes at once
+const double minSeconds = 0.2;       // Time spent on each measurement
+
+// Runs body repeatedly for at least minSeconds and returns samples processed per second
+template <typename Body>
+double measure(std::size_t samplesPerCall, Body body) {
+    using Clock = std::chrono::steady_clock;
+    std::size_t calls = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+        for (int i = 0; i < 64; ++i) {
+            body();
+        }
+        calls += 64;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return static_cast<double>(calls * samplesPerCall) / elapsed;
+}
+
+void report(const std::string& kernel, const std::string& variant, double samplesPerSecond, double baseline) {
+    std::cout << std::left << std::setw(16) << kernel << std::setw(8) << variant
+              << std::right << std::setw(10) << std::fixed << std::setprecision(0) << samplesPerSecond / 1e6 << " M samples/s"
+              << std::setw(8) << std::setprecision(2) << samplesPerSecond / baseline << "x" << std::endl;
+}
+
+void benchmarkKernels() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    std::vector<std::int16_t> pcm(blockSize);
+    std::vector<float> a(blockSize), b(blockSize), interleaved(blockSize * 2);
+    std::uint32_t dither[SampleKernels::ditherLanes];
+    SampleKernels::seedDither(dither, 1);
+    for (std::size_t i = 0; i < blockSize; ++i) {
+        pcm[i] = static_cast<std::int16_t>(noise(rng) * 32767.0f);
+        a[i] = noise(rng);
+        b[i] = noise(rng);
+    }
+
+    std::vector<const SampleKernels*> variants = { &SampleKernels::scalar() };
+    if (SampleKernels::hasSse2()) {
+        variants.push_back(&SampleKernels::sse2());
+    }
+    if (SampleKernels::hasAvx2()) {
+        variants.push_back(&SampleKernels::avx2());
+    }
+    std::cout << "Sample kernels (" << blockSize << " samples per call, dispatch picks "
+              << SampleKernels::get().name << ")" << std::endl;
+
+    struct Case {
+        std::string name;
+        std::function<void(const SampleKernels&)> run;
+    };
+    std::vector<Case> cases = {
+        { "int16ToFloat", [&](const SampleKernels& k) { k.int16ToFloat(pcm.data(), a.data(), blockSize); } },
+        { "floatToInt16", [&](const SampleKernels& k) { k.floatToInt16(a.data(), pcm.data(), blockSize); } },
+        { "interleave2", [&](const SampleKernels& k) { k.interleave2(a.data(), b.data(), interleaved.data(), blockSize); } },
+        { "deinterleave2", [&](const SampleKernels& k) { k.deinterleave2(interleaved.data(), a.data(), b.data(), blockSize); } },
+        { "applyGain", [&](const SampleKernels& k) { k.applyGain(a.data(), blockSize, 0.999f); } },
+        { "applyGainRamp", [&](const SampleKernels& k) { k.applyGainRamp(a.data(), blockSize, 1.0f, -1e-7f); } },
+        { "mixAdd", [&](const SampleKernels& k) { k.mixAdd(a.data(), b.data(), blockSize, 0.001f); } },
+        { "crossfade", [&](const SampleKernels& k) { k.crossfade(a.data(), b.data(), blockSize, 0.25f, 1e-5f); } },
+        { "clamp", [&](const SampleKernels& k) { k.clamp(a.data(), blockSize, 1.0f); } },
+        { "ditherToInt16", [&](const SampleKernels& k) { k.ditherToInt16(a.data(), pcm.data(), blockSize, dither); } },
+    };
+
+    for (const Case& c : cases) {
+        double baseline = 0.0;
+        for (const SampleKernels* kernels : variants) {
+            double rate = measure(blockSize, [&] { c.run(*kernels); });
+            if (kernels == variants.front()) {
+                baseline = rate;
+            }
+            report(c.name, kernels->name, rate, baseline);
+        }
+    }
+    std::cout << std::endl;
+}
+
+// Stereo resampling for the common library conversions, reported as multiples of real time on one core
+void benchmarkResampler() {
+    const unsigned int conversions[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 88200, 48000 }, { 96000, 44100 } };
+    const char* qualities[] = { "fast", "standard", "best" };
+    const std::size_t frames = blockSize / 2;
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    std::vector<float> input(frames * 2);
+    for (float& sample : input) {
+        sample = noise(rng);
+    }
+    std::vector<float> output(frames * 2 * 4);
+
+    std::cout << "Resampler (stereo, " << SampleKernels::get().name << " kernels)" << std::endl;
+    for (const auto& rates : conversions) {
+        for (int quality = Resampler::Fast; quality <= Resampler::Best; ++quality) {
+            Resampler resampler(rates[0], rates[1], 2, static_cast<Resampler::Quality>(quality));
+            double inputFrames = measure(frames, [&] {
+                resampler.write(input.data(), frames);
+                while (resampler.read(output.data(), output.size() / 2) > 0) {
+                }
+            });
+            std::cout << std::left << std::setw(6) << rates[0] << "-> " << std::setw(8) << rates[1] << std::setw(10) << qualities[quality]
+                      << std::right << std::setw(4) << resampler.getTapCount() << " taps"
+                      << std::setw(10) << std::fixed << std::setprecision(0) << inputFrames / rates[0] << "x real time" << std::endl;
+        }
+    }
+    std::cout << std::endl;
+}
+
+// Full 10-band stereo EQ at 48 kHz, steady and while a band is being swept, as a share of one core
+void benchmarkEqualizer() {
+    const unsigned int sampleRate = 48000;
+    const std::size_t frames = blockSize / 2;
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> block(frames * 2);
+    for (float& sample : block) {
+        sample = noise(rng);
+    }
+
+    DspArena arena(64 * 1024);
+    EqualizerStage equalizer;
+    equalizer.prepare(sampleRate, 2, arena);
+    for (std::size_t b = 0; b < EqualizerStage::bandCount; ++b) {
+        equalizer.setGain(b, (b % 2 == 0) ? 3.0f : -3.0f);  // No band left flat
+    }
+
+    std::cout << "Equalizer (" << EqualizerStage::bandCount << " bands, stereo, " << sampleRate << " Hz)" << std::endl;
+    double steady = measure(frames, [&] { equalizer.process(block.data(), frames); });
+    float sweep = 0.0f;
+    double sweeping = measure(frames, [&] {
+        sweep = (sweep >= 12.0f) ? -12.0f : sweep + 0.5f;
+        equalizer.setGain(5, sweep);
+        equalizer.process(block.data(), frames);
+    });
+    std::cout << std::left << std::setw(16) << "steady" << std::right << std::setw(10) << std::fixed << std::setprecision(3)
+              << 100.0 * sampleRate / steady << "% of a core" << std::endl;
+    std::cout << std::left << std::setw(16) << "sweeping" << std::right << std::setw(10)
+              << 100.0 * sampleRate / sweeping << "% of a core" << std::endl;
+    std::cout << std::endl;
+}
+
+// Typo-tolerant search scoring every word of a 64k-word vocabulary against patterns of a few lengths
+void benchmarkFuzzy() {
+    const std::size_t wordCount = 64 * 1024;
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<int> wordLength(2, 12);
+    std::vector<std::uint8_t> blocks(wordCount / FuzzyKernels::blockWords * FuzzyKernels::blockBytes);
+    std::vector<std::uint8_t> lengths(wordCount);
+    std::vector<std::uint8_t> distances(wordCount);
+    for (std::size_t i = 0; i < wordCount; ++i) {
+        std::string word(static_cast<std::size_t>(wordLength(rng)), ' ');
+        for (char& c : word) {
+            c = static_cast<char>(letter(rng));
+        }
+        FuzzyKernels::store(blocks.data(), lengths.data(), i, word.data(), word.size());
+    }
+
+    std::vector<const FuzzyKernels*> variants = { &FuzzyKernels::scalar() };
+    if (SampleKernels::hasSse2()) {
+        variants.push_back(&FuzzyKernels::sse2());
+    }
+    if (SampleKernels::hasAvx2()) {
+        variants.push_back(&FuzzyKernels::avx2());
+    }
+    std::cout << "Fuzzy kernels (" << wordCount << " words per call, dispatch picks " << FuzzyKernels::get().name << ")" << std::endl;
+
+    for (const char* pattern : { "hgih", "otehrsied", "supercalifragil" }) {
+        unsigned int length = static_cast<unsigned int>(std::string(pattern).size());
+        double baseline = 0.0;
+        for (const FuzzyKernels* kernels : variants) {
+            double rate = measure(wordCount, [&] {
+                kernels->prefixDistances(reinterpret_cast<const std::uint8_t*>(pattern), length, blocks.data(), lengths.data(),
+                                         wordCount / FuzzyKernels::blockWords, distances.data());
+            });
+            if (kernels == variants.front()) {
+                baseline = rate;
+            }
+            std::cout << std::left << std::setw(16) << pattern << std::setw(8) << kernels->name
+                      << std::right << std::setw(10) << std::fixed << std::setprecision(0) << rate / 1e6 << " M words/s"
+                      << std::setw(8) << std::setprecision(2) << rate / baseline << "x" << std::endl;
+        }
+    }
+    std::cout << std::endl;
+}
+
+int main() {
+#ifdef SAMPLE_KERNELS_X86
+    // Repeated gain passes decay the test data into denormals, which would measure the FPU's slow path
+    _mm_setcsr(_mm_getcsr() | 0x8040);  // Flush-to-zero and denormals-are-zero
+#endif
+    benchmarkKernels();
+    benchmarkResampler();
+    benchmarkEqualizer();
+    benchmarkFuzzy();
+    return 0;
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Compressed set of 32-bit ids, laid out like a Roaring bitmap: ids are grouped by their high
+// 16 bits, and each group keeps its low halves as a sorted array while it has at most 4096 of
+// them, as a 65536-bit set (8 KB) once it has more. A group never takes more than 8 KB, sparse
+// sets stay small, and unions and intersections go a group at a time, 64 ids per instruction
+// where both sides are bit sets.
+class Bitmap {
+public:
+    void add(std::uint32_t id) {
+        Container& container = containerFor(static_cast<std::uint16_t>(id >> 16));
+        std::uint16_t low = static_cast<std::uint16_t>(id);
+        if (!container.bits.empty()) {
+            std::uint64_t& word = container.bits[low / 64];
+            std::uint64_t bit = std::uint64_t(1) << (low % 64);
+            container.count += (word & bit) ? 0 : 1;
+            word |= bit;
+            return;
+        }
+        std::vector<std::uint16_t>& array = container.array;
+        if (array.empty() || array.back() < low) {
+            array.push_back(low);  // Ids usually come in increasing order
+        }
+        else {
+            auto it = std::lower_bound(array.begin(), array.end(), low);
+            if (it != array.end() && *it == low) {
+                return;
+            }
+            array.insert(it, low);
+        }
+        container.count = static_cast<std::uint32_t>(array.size());
+        settle(container);
+    }
+
+    void remove(std::uint32_t id) {
+        auto it = find(static_cast<std::uint16_t>(id >> 16));
+        if (it == containers.end()) {
+            return;
+        }
+        std::uint16_t low = static_cast<std::uint16_t>(id);
+        if (!it->bits.empty()) {
+            std::uint64_t& word = it->bits[low / 64];
+            std::uint64_t bit = std::uint64_t(1) << (low % 64);
+            it->count -= (word & bit) ? 1 : 0;
+            word &= ~bit;
+        }
+        else {
+            auto at = std::lower_bound(it->array.begin(), it->array.end(), low);
+            if (at == it->array.end() || *at != low) {
+                return;
+            }
+            it->array.erase(at);
+            it->count = static_cast<std::uint32_t>(it->array.size());
+        }
+        if (it->count == 0) {
+            containers.erase(it);
+        }
+        else {
+            settle(*it);
+        }
+    }
+
+    bool contains(std::uint32_t id) const {
+        auto it = find(static_cast<std::uint16_t>(id >> 16));
+        if (it == containers.end()) {
+            return false;
+        }
+        std::uint16_t low = static_cast<std::uint16_t>(id);
+        if (!it->bits.empty()) {
+            return (it->bits[low / 64] >> (low % 64)) & 1;
+        }
+        return std::binary_search(it->array.begin(), it->array.end(), low);
+    }
+
+    void clear() {
+        containers.clear();
+    }
+
+    // Adds every id of other
+    void unionWith(const Bitmap& other) {
+        std::vector<Container> result;
+        result.reserve(containers.size() + other.containers.size());
+        auto a = containers.begin();
+        auto b = other.containers.begin();
+        while (a != containers.end() || b != other.containers.end()) {
+            if (b == other.containers.end() || (a != containers.end() && a->key < b->key)) {
+                result.push_back(std::move(*a++));
+            }
+            else if (a == containers.end() || b->key < a->key) {
+                result.push_back(*b++);
+            }
+            else {
+                unite(*a, *b++);
+                result.push_back(std::move(*a++));
+            }
+        }
+        containers.swap(result);
+    }
+
+    // Adds every id of all of others. Unlike one unionWith() after another, each group is gathered
+    // in one bit set and only then compacted, so ORing thousands of small bitmaps stays linear.
+    void unionWith(const std::vector<const Bitmap*>& others) {
+        std::vector<std::uint16_t> keys;
+        for (const Container& container : containers) {
+            keys.push_back(container.key);
+        }
+        for (const Bitmap* other : others) {
+            for (const Container& container : other->containers) {
+                keys.push_back(container.key);
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        std::vector<Container> result(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            result[i].key = keys[i];
+            result[i].bits.assign(bitWords, 0);
+        }
+        auto gather = [&](const Container& container) {
+            Container& into = result[std::lower_bound(keys.begin(), keys.end(), container.key) - keys.begin()];
+            if (container.bits.empty()) {
+                setBits(into.bits, container.array);
+                return;
+            }
+            for (std::size_t w = 0; w < bitWords; ++w) {
+                into.bits[w] |= container.bits[w];
+            }
+        };
+        for (const Container& container : containers) {
+            gather(container);
+        }
+        for (const Bitmap* other : others) {
+            for (const Container& container : other->containers) {
+                gather(container);
+            }
+        }
+        for (Container& container : result) {
+            container.count = countBits(container.bits);
+            settle(container);
+        }
+        containers.swap(result);
+    }
+
+    // Keeps only the ids also in other
+    void intersectWith(const Bitmap& other) {
+        std::size_t kept = 0;
+        auto b = other.containers.begin();
+        for (std::size_t i = 0; i < containers.size() && b != other.containers.end(); ++i) {
+            while (b != other.containers.end() && b->key < containers[i].key) {
+                ++b;
+            }
+            if (b == other.containers.end() || b->key != containers[i].key) {
+                continue;
+            }
+            intersect(containers[i], *b);
+            if (containers[i].count != 0) {
+                if (kept != i) {
+                    containers[kept] = std::move(containers[i]);
+                }
+                ++kept;
+            }
+        }
+        containers.resize(kept);
+    }
+
+    // Calls f with each id, in increasing order
+    template <typename F>
+    void forEach(F f) const {
+        for (const Container& container : containers) {
+            std::uint32_t high = static_cast<std::uint32_t>(container.key) << 16;
+            if (container.bits.empty()) {
+                for (std::uint16_t low : container.array) {
+                    f(high | low);
+                }
+                continue;
+            }
+            for (std::size_t w = 0; w < bitWords; ++w) {
+                for (std::uint64_t word = container.bits[w]; word != 0; word &= word - 1) {
+                    f(high | static_cast<std::uint32_t>(w * 64 + countBits((word & (~word + 1)) - 1)));
+                }
+            }
+        }
+    }
+
+    // Replaces ids with every id, in increasing order
+    void toVector(std::vector<std::uint32_t>& ids) const {
+        ids.clear();
+        ids.reserve(getCount());
+        forEach([&ids](std::uint32_t id) { ids.push_back(id); });
+    }
+
+    // Getters
+    std::size_t getCount() const {
+        std::size_t count = 0;
+        for (const Container& container : containers) {
+            count += container.count;
+        }
+        return count;
+    }
+
+    bool isEmpty() const {
+        return containers.empty();
+    }
+
+    std::size_t getByteCount() const {
+        std::size_t bytes = containers.capacity() * sizeof(Container);
+        for (const Container& container : containers) {
+            bytes += container.array.capacity() * sizeof(std::uint16_t) + container.bits.capacity() * sizeof(std::uint64_t);
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr std::size_t arrayLimit = 4096;  // Past this many ids a bit set is smaller
+    static constexpr std::size_t bitWords = 65536 / 64;
+
+    // One group of ids sharing their high 16 bits; array holds them while count <= arrayLimit, bits after
+    struct Container {
+        std::uint16_t key;
+        std::uint32_t count;
+        std::vector<std::uint16_t> array;  // Sorted low halves
+        std::vector<std::uint64_t> bits;   // bitWords words
+    };
+
+    std::vector<Container>::iterator find(std::uint16_t key) {
+        auto it = std::lower_bound(containers.begin(), containers.end(), key, [](const Container& c, std::uint16_t k) { return c.key < k; });
+        return (it != containers.end() && it->key == key) ? it : containers.end();
+    }
+
+    std::vector<Container>::const_iterator find(std::uint16_t key) const {
+        auto it = std::lower_bound(containers.begin(), containers.end(), key, [](const Container& c, std::uint16_t k) { return c.key < k; });
+        return (it != containers.end() && it->key == key) ? it : containers.end();
+    }
+
+    Container& containerFor(std::uint16_t key) {
+        if (containers.empty() || containers.back().key < key) {
+            containers.push_back(Container{ key, 0, {}, {} });
+            return containers.back();
+        }
+        auto it = std::lower_bound(containers.begin(), containers.end(), key, [](const Container& c, std::uint16_t k) { return c.key < k; });
+        if (it == containers.end() || it->key != key) {
+            it = containers.insert(it, Container{ key, 0, {}, {} });
+        }
+        return *it;
+    }
+
+    // Without a popcount instruction in C++17, the classic SWAR count
+    static std::uint32_t countBits(std::uint64_t word) {
+        word = word - ((word >> 1) & 0x5555555555555555ull);
+        word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+        word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+        return static_cast<std::uint32_t>((word * 0x0101010101010101ull) >> 56);
+    }
+
+    static std::uint32_t countBits(const std::vector<std::uint64_t>& bits) {
+        std::uint32_t count = 0;
+        for (std::uint64_t word : bits) {
+            count += countBits(word);
+        }
+        return count;
+    }
+
+    static void setBits(std::vector<std::uint64_t>& bits, const std::vector<std::uint16_t>& array) {
+        for (std::uint16_t low : array) {
+            bits[low / 64] |= std::uint64_t(1) << (low % 64);
+        }
+    }
+
+    // Switches container to whichever form its count calls for
+    static void settle(Container& container) {
+        if (container.bits.empty() && container.count > arrayLimit) {
+            container.bits.assign(bitWords, 0);
+            setBits(container.bits, container.array);
+            container.array = std::vector<std::uint16_t>();
+        }
+        else if (!container.bits.empty() && container.count <= arrayLimit) {
+            container.array.clear();
+            container.array.reserve(container.count);
+            for (std::size_t w = 0; w < bitWords; ++w) {
+                for (std::uint64_t word = container.bits[w]; word != 0; word &= word - 1) {
+                    container.array.push_back(static_cast<std::uint16_t>(w * 64 + countBits((word & (~word + 1)) - 1)));
+                }
+            }
+            container.bits = std::vector<std::uint64_t>();
+        }
+    }
+
+    static void unite(Container& a, const Container& b) {
+        if (a.bits.empty() && b.bits.empty() && a.count + b.count <= arrayLimit) {
+            std::vector<std::uint16_t> merged;
+            merged.reserve(a.count + b.count);
+            std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(merged));
+            a.array.swap(merged);
+            a.count = static_cast<std::uint32_t>(a.array.size());
+            return;
+        }
+        if (a.bits.empty()) {
+            a.bits.assign(bitWords, 0);
+            setBits(a.bits, a.array);
+            a.array = std::vector<std::uint16_t>();
+        }
+        if (b.bits.empty()) {
+            setBits(a.bits, b.array);
+        }
+        else {
+            for (std::size_t w = 0; w < bitWords; ++w) {
+                a.bits[w] |= b.bits[w];
+            }
+        }
+        a.count = countBits(a.bits);
+        settle(a);
+    }
+
+    static void intersect(Container& a, const Container& b) {
+        if (!a.bits.empty() && !b.bits.empty()) {
+            for (std::size_t w = 0; w < bitWords; ++w) {
+                a.bits[w] &= b.bits[w];
+            }
+            a.count = countBits(a.bits);
+            settle(a);
+            return;
+        }
+        std::vector<std::uint16_t> kept;
+        if (a.bits.empty() && b.bits.empty()) {
+            std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(kept));
+        }
+        else {
+            // The array side's ids that the bit set side has
+            const std::vector<std::uint16_t>& array = a.bits.empty() ? a.array : b.array;
+            const std::vector<std::uint64_t>& bits = a.bits.empty() ? b.bits : a.bits;
+            for (std::uint16_t low : array) {
+                if ((bits[low / 64] >> (low % 64)) & 1) {
+                    kept.push_back(low);
+                }
+            }
+        }
+        a.array.swap(kept);
+        a.bits = std::vector<std::uint64_t>();
+        a.count = static_cast<std::uint32_t>(a.array.size());
+    }
+
+    std::vector<Container> containers;  // By key
+};
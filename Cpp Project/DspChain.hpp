@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "SampleKernels.hpp"
+
+// Fixed block of memory that DSP stages carve their state out of in prepare(),
+// so nothing is allocated once audio is flowing.
+class DspArena {
+public:
+    explicit DspArena(std::size_t bytes) : memory(bytes / sizeof(float) + alignment), used(0) {
+        // Start on a 32-byte boundary so every block handed out suits AVX loads
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory.data());
+        base = memory.data() + (alignment - address / sizeof(float) % alignment) % alignment;
+        capacity = memory.size() - alignment;
+    }
+
+    DspArena(const DspArena&) = delete;
+    DspArena& operator=(const DspArena&) = delete;
+
+    // Zeroed, 32-byte aligned room for count floats; nullptr once the arena is exhausted
+    float* allocate(std::size_t count) {
+        std::size_t rounded = (count + alignment - 1) / alignment * alignment;
+        if (rounded > capacity - used) {
+            return nullptr;
+        }
+        float* block = base + used;
+        std::fill(block, block + rounded, 0.0f);
+        used += rounded;
+        return block;
+    }
+
+    // Hands the whole arena out again, invalidating every earlier block
+    void reset() {
+        used = 0;
+    }
+
+    // Getters
+    std::size_t getCapacity() const {
+        return capacity * sizeof(float);
+    }
+
+    std::size_t getUsedBytes() const {
+        return used * sizeof(float);
+    }
+
+private:
+    static const std::size_t alignment = 8;  // In floats
+
+    std::vector<float> memory;
+    float* base;
+    std::size_t capacity;  // In floats, from base
+    std::size_t used;
+};
+
+// One processing step of a DspChain. Parameters are atomics written by the UI thread and read
+// once per block by the audio thread; everything else a stage keeps is only touched by process(),
+// apart from prepare() which runs while the chain isn't attached to a stream.
+class DspStage {
+public:
+    DspStage() : enabled(true) {}
+    virtual ~DspStage() {}
+
+    // Sets the stage up for a format, taking any buffers it needs from arena. False if they didn't fit.
+    virtual bool prepare(unsigned int sampleRate, unsigned int channelCount, DspArena& arena) = 0;
+
+    // Processes interleaved frames in place. Runs on the audio thread: no allocation, locks or blocking.
+    virtual void process(float* samples, std::size_t frames) = 0;
+
+    void setEnabled(bool on) {
+        enabled.store(on, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> enabled;
+};
+
+// Linear gain, ramped over a block whenever it changes so volume moves don't click
+class GainStage : public DspStage {
+public:
+    explicit GainStage(float gain = 1.0f) : target(gain), current(gain), channels(1) {}
+
+    void setGain(float gain) {
+        target.store(std::max(0.0f, gain), std::memory_order_relaxed);
+    }
+
+    float getGain() const {
+        return target.load(std::memory_order_relaxed);
+    }
+
+    bool prepare(unsigned int, unsigned int channelCount, DspArena&) override {
+        channels = channelCount;
+        return true;
+    }
+
+    void process(float* samples, std::size_t frames) override {
+        const SampleKernels& kernels = SampleKernels::get();
+        float gain = target.load(std::memory_order_relaxed);
+        std::size_t count = frames * channels;
+        if (gain != current && count > 0) {
+            kernels.applyGainRamp(samples, count, current, (gain - current) / static_cast<float>(count));
+            current = gain;
+        }
+        else if (gain != 1.0f) {
+            kernels.applyGain(samples, count, gain);
+        }
+    }
+
+private:
+    std::atomic<float> target;
+    float current;  // Gain the last block ended on
+    unsigned int channels;
+};
+
+// Stereo balance from -1 (left only) through 0 (unchanged) to 1 (right only); other layouts pass through
+class BalanceStage : public DspStage {
+public:
+    BalanceStage() : target(0.0f), current(0.0f), channels(2) {}
+
+    void setBalance(float balance) {
+        target.store(std::max(-1.0f, std::min(1.0f, balance)), std::memory_order_relaxed);
+    }
+
+    float getBalance() const {
+        return target.load(std::memory_order_relaxed);
+    }
+
+    bool prepare(unsigned int, unsigned int channelCount, DspArena&) override {
+        channels = channelCount;
+        return true;
+    }
+
+    void process(float* samples, std::size_t frames) override {
+        float balance = target.load(std::memory_order_relaxed);
+        if (channels != 2 || frames == 0 || (balance == 0.0f && current == 0.0f)) {
+            current = balance;
+            return;
+        }
+        float step = (balance - current) / static_cast<float>(frames);
+        for (std::size_t i = 0; i < frames; ++i) {
+            float b = current + step * static_cast<float>(i);
+            samples[2 * i] *= std::min(1.0f, 1.0f - b);
+            samples[2 * i + 1] *= std::min(1.0f, 1.0f + b);
+        }
+        current = balance;
+    }
+
+private:
+    std::atomic<float> target;
+    float current;
+    unsigned int channels;
+};
+
+// Peak limiter keeping the output under a ceiling: gain drops instantly on a peak that would
+// exceed it and recovers over the release time. Last in the chain, it stops boosted EQ or gain
+// from clipping in the final conversion.
+class LimiterStage : public DspStage {
+public:
+    LimiterStage() : ceiling(0.98f), gain(1.0f), release(0.0f), channels(1) {}
+
+    // Highest output level, as linear amplitude (1 is full scale)
+    void setCeiling(float level) {
+        ceiling.store(std::max(0.01f, std::min(1.0f, level)), std::memory_order_relaxed);
+    }
+
+    float getCeiling() const {
+        return ceiling.load(std::memory_order_relaxed);
+    }
+
+    bool prepare(unsigned int sampleRate, unsigned int channelCount, DspArena&) override {
+        channels = channelCount;
+        release = std::exp(-1.0f / (0.1f * static_cast<float>(sampleRate)));  // 100 ms time constant
+        gain = 1.0f;
+        return true;
+    }
+
+    void process(float* samples, std::size_t frames) override {
+        float limit = ceiling.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < frames; ++i) {
+            float* frame = samples + i * channels;
+            float peak = 0.0f;
+            for (unsigned int c = 0; c < channels; ++c) {
+                peak = std::max(peak, std::fabs(frame[c]));
+            }
+            float wanted = (peak > limit) ? limit / peak : 1.0f;
+            gain = (wanted < gain) ? wanted : wanted + (gain - wanted) * release;
+            for (unsigned int c = 0; c < channels; ++c) {
+                frame[c] *= gain;
+            }
+        }
+    }
+
+private:
+    std::atomic<float> ceiling;
+    float gain;
+    float release;  // Per-frame decay factor of the gain reduction
+    unsigned int channels;
+};
+
+// Ordered list of stages run over each block right before output.
+// Stages are added and the chain prepared by the owner while no stream runs it;
+// after that the owner only changes stage parameters, which is lock-free.
+class DspChain {
+public:
+    explicit DspChain(std::size_t arenaBytes = 1024 * 1024) : arena(arenaBytes), sampleRate(0), channels(0) {}
+
+    DspChain(const DspChain&) = delete;
+    DspChain& operator=(const DspChain&) = delete;
+
+    // Appends stage and returns it for setting its parameters later
+    template <typename Stage>
+    Stage* add(std::unique_ptr<Stage> stage) {
+        Stage* added = stage.get();
+        if (channels != 0) {
+            added->prepare(sampleRate, channels, arena);
+        }
+        stages.push_back(std::move(stage));
+        return added;
+    }
+
+    // Sets every stage up for a stream's format. False if the arena is too small for them.
+    bool prepare(unsigned int streamSampleRate, unsigned int channelCount) {
+        sampleRate = streamSampleRate;
+        channels = channelCount;
+        arena.reset();
+        bool prepared = true;
+        for (const std::unique_ptr<DspStage>& stage : stages) {
+            prepared = stage->prepare(sampleRate, channels, arena) && prepared;
+        }
+        return prepared;
+    }
+
+    // Runs the enabled stages over interleaved frames, in order
+    void process(float* samples, std::size_t frames) {
+        FlushDenormals guard;
+        for (const std::unique_ptr<DspStage>& stage : stages) {
+            if (stage->isEnabled()) {
+                stage->process(samples, frames);
+            }
+        }
+    }
+
+private:
+    // Recursive filters decay into denormals in silence, which the FPU handles very slowly.
+    // Sets flush-to-zero and denormals-are-zero for the calling thread while it's in scope.
+    struct FlushDenormals {
+#ifdef SAMPLE_KERNELS_X86
+        FlushDenormals() : saved(_mm_getcsr()) {
+            _mm_setcsr(saved | 0x8040);
+        }
+        ~FlushDenormals() {
+            _mm_setcsr(saved);
+        }
+        unsigned int saved;
+#endif
+    };
+
+    DspArena arena;
+    std::vector<std::unique_ptr<DspStage>> stages;
+    unsigned int sampleRate;
+    unsigned int channels;
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include "DspChain.hpp"
+#include "SampleKernels.hpp"
+
+// Ten-band equalizer: a cascade of biquad filters (RBJ cookbook), each band a peak or shelf
+// with its own frequency, gain and Q. Defaults to a graphic EQ on the octave centers, flat.
+//
+// Band settings are atomics the UI may change at any time. The audio thread recomputes the
+// target coefficients when it sees a new version and glides the running coefficients towards
+// them every few frames, so a slider being dragged sweeps the response smoothly instead of
+// stepping (and clicking) once per block. While the whole EQ is flat and settled it costs nothing.
+// Stereo runs both channels side by side in SSE lanes, other layouts one channel at a time.
+class EqualizerStage : public DspStage {
+public:
+    enum BandType {
+        Peak,
+        LowShelf,
+        HighShelf
+    };
+
+    static const std::size_t bandCount = 10;
+
+    EqualizerStage()
+        : version(1), appliedVersion(0), sampleRate(44100), channels(2), state(nullptr), smoothing(0.0f), settled(true), flat(true) {
+        static const float centers[bandCount] = { 31.0f, 62.0f, 125.0f, 250.0f, 500.0f, 1000.0f, 2000.0f, 4000.0f, 8000.0f, 16000.0f };
+        for (std::size_t b = 0; b < bandCount; ++b) {
+            settings[b].type.store(Peak);
+            settings[b].frequency.store(centers[b]);
+            settings[b].gain.store(0.0f);
+            settings[b].q.store(1.41f);  // About an octave wide
+            current[b] = target[b] = Coefficients::identity();
+        }
+    }
+
+    // Changes one band; frequency in Hz, gain in dB, q from about 0.3 (broad) to 10 (narrow).
+    // Bands past bandCount are ignored.
+    void setBand(std::size_t band, BandType type, float frequency, float gainDb, float q) {
+        if (band >= bandCount) {
+            return;
+        }
+        settings[band].type.store(type, std::memory_order_relaxed);
+        settings[band].frequency.store(std::max(10.0f, frequency), std::memory_order_relaxed);
+        settings[band].gain.store(std::max(-24.0f, std::min(24.0f, gainDb)), std::memory_order_relaxed);
+        settings[band].q.store(std::max(0.1f, std::min(20.0f, q)), std::memory_order_relaxed);
+        version.fetch_add(1, std::memory_order_release);
+    }
+
+    // Just the gain of a band, as a graphic EQ slider would
+    void setGain(std::size_t band, float gainDb) {
+        if (band >= bandCount) {
+            return;
+        }
+        settings[band].gain.store(std::max(-24.0f, std::min(24.0f, gainDb)), std::memory_order_relaxed);
+        version.fetch_add(1, std::memory_order_release);
+    }
+
+    // 0 for bands past bandCount
+    float getGain(std::size_t band) const {
+        return (band < bandCount) ? settings[band].gain.load(std::memory_order_relaxed) : 0.0f;
+    }
+
+    float getFrequency(std::size_t band) const {
+        return (band < bandCount) ? settings[band].frequency.load(std::memory_order_relaxed) : 0.0f;
+    }
+
+    bool prepare(unsigned int streamSampleRate, unsigned int channelCount, DspArena& arena) override {
+        sampleRate = streamSampleRate;
+        channels = channelCount;
+        state = arena.allocate(bandCount * channels * 2);
+        smoothing = 1.0f - std::exp(-static_cast<float>(smoothingBlock) / (0.01f * static_cast<float>(sampleRate)));  // 10 ms glide
+        appliedVersion = 0;  // Recompute for the new rate, jumping straight there
+        updateTargets();
+        std::copy(target, target + bandCount, current);
+        return state != nullptr;
+    }
+
+    void process(float* samples, std::size_t frames) override {
+        if (!state) {
+            return;
+        }
+        updateTargets();
+        if (settled && flat) {
+            return;
+        }
+        for (std::size_t done = 0; done < frames; done += smoothingBlock) {
+            std::size_t count = std::min<std::size_t>(smoothingBlock, frames - done);
+            if (!settled) {
+                glide();
+            }
+#ifdef SAMPLE_KERNELS_X86
+            if (channels == 2) {
+                processStereo(samples + done * 2, count, current, state);
+                continue;
+            }
+#endif
+            processChannels(samples + done * channels, count);
+        }
+    }
+
+private:
+    // Normalized biquad (a0 = 1), run in transposed direct form II
+    struct Coefficients {
+        float b0, b1, b2, a1, a2;
+
+        static Coefficients identity() {
+            return Coefficients{ 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        }
+    };
+
+    struct Band {
+        std::atomic<int> type;
+        std::atomic<float> frequency;
+        std::atomic<float> gain;
+        std::atomic<float> q;
+    };
+
+    // Frames between coefficient updates while gliding
+    static const std::size_t smoothingBlock = 32;
+
+    static Coefficients design(BandType type, double frequency, double gainDb, double q, double sampleRate) {
+        const double pi = 3.14159265358979323846;
+        double w0 = 2.0 * pi * std::min(frequency, 0.45 * sampleRate) / sampleRate;
+        double cosW = std::cos(w0);
+        double alpha = std::sin(w0) / (2.0 * q);
+        double a = std::pow(10.0, gainDb / 40.0);
+        double b0, b1, b2, a0, a1, a2;
+        if (type == Peak) {
+            b0 = 1.0 + alpha * a;
+            b1 = -2.0 * cosW;
+            b2 = 1.0 - alpha * a;
+            a0 = 1.0 + alpha / a;
+            a1 = -2.0 * cosW;
+            a2 = 1.0 - alpha / a;
+        }
+        else {
+            double root = 2.0 * std::sqrt(a) * alpha;
+            double sign = (type == LowShelf) ? 1.0 : -1.0;  // A high shelf is the low shelf with cos(w0) negated
+            b0 = a * ((a + 1.0) - sign * (a - 1.0) * cosW + root);
+            b1 = sign * 2.0 * a * ((a - 1.0) - sign * (a + 1.0) * cosW);
+            b2 = a * ((a + 1.0) - sign * (a - 1.0) * cosW - root);
+            a0 = (a + 1.0) + sign * (a - 1.0) * cosW + root;
+            a1 = -sign * 2.0 * ((a - 1.0) + sign * (a + 1.0) * cosW);
+            a2 = (a + 1.0) + sign * (a - 1.0) * cosW - root;
+        }
+        return Coefficients{ static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0),
+                             static_cast<float>(a1 / a0), static_cast<float>(a2 / a0) };
+    }
+
+    // Recomputes the target response if the settings changed since the last block
+    void updateTargets() {
+        unsigned int seen = version.load(std::memory_order_acquire);
+        if (seen == appliedVersion) {
+            return;
+        }
+        appliedVersion = seen;
+        flat = true;
+        for (std::size_t b = 0; b < bandCount; ++b) {
+            float gain = settings[b].gain.load(std::memory_order_relaxed);
+            if (gain == 0.0f) {
+                target[b] = Coefficients::identity();  // Every band type is a pass-through at 0 dB
+                continue;
+            }
+            flat = false;
+            target[b] = design(static_cast<BandType>(settings[b].type.load(std::memory_order_relaxed)),
+                               settings[b].frequency.load(std::memory_order_relaxed), gain,
+                               settings[b].q.load(std::memory_order_relaxed), sampleRate);
+        }
+        settled = false;
+    }
+
+    // Moves the running coefficients a step towards the targets
+    void glide() {
+        float largest = 0.0f;
+        auto step = [&](float& from, float to) {
+            float difference = to - from;
+            from += difference * smoothing;
+            largest = std::max(largest, std::fabs(difference));
+        };
+        for (std::size_t b = 0; b < bandCount; ++b) {
+            step(current[b].b0, target[b].b0);
+            step(current[b].b1, target[b].b1);
+            step(current[b].b2, target[b].b2);
+            step(current[b].a1, target[b].a1);
+            step(current[b].a2, target[b].a2);
+        }
+        if (largest < 1e-5f) {
+            std::copy(target, target + bandCount, current);
+            settled = true;
+        }
+    }
+
+    // Any channel count: each channel through the whole cascade in turn
+    void processChannels(float* samples, std::size_t frames) {
+        for (unsigned int c = 0; c < channels; ++c) {
+            for (std::size_t b = 0; b < bandCount; ++b) {
+                const Coefficients& k = current[b];
+                float* s = state + (b * channels + c) * 2;
+                float s1 = s[0];
+                float s2 = s[1];
+                for (std::size_t i = 0; i < frames; ++i) {
+                    float& sample = samples[i * channels + c];
+                    float x = sample;
+                    float y = k.b0 * x + s1;
+                    s1 = k.b1 * x - k.a1 * y + s2;
+                    s2 = k.b2 * x - k.a2 * y;
+                    sample = y;
+                }
+                s[0] = s1;
+                s[1] = s2;
+            }
+        }
+    }
+
+#ifdef SAMPLE_KERNELS_X86
+    // Two floats to or from the low lanes; __m64 may alias anything, unlike the double the _sd forms take
+    KERNEL_TARGET_SSE2 static __m128 loadPair(const float* pair) {
+        return _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(pair));
+    }
+
+    KERNEL_TARGET_SSE2 static void storePair(float* pair, __m128 value) {
+        _mm_storel_pi(reinterpret_cast<__m64*>(pair), value);
+    }
+
+    // Left and right in the low two lanes, so each band is one pass of vector arithmetic over the block
+    KERNEL_TARGET_SSE2 static void processStereo(float* samples, std::size_t frames, const Coefficients* bands, float* state) {
+        for (std::size_t b = 0; b < bandCount; ++b) {
+            const Coefficients& k = bands[b];
+            const __m128 b0 = _mm_set1_ps(k.b0);
+            const __m128 b1 = _mm_set1_ps(k.b1);
+            const __m128 b2 = _mm_set1_ps(k.b2);
+            const __m128 a1 = _mm_set1_ps(k.a1);
+            const __m128 a2 = _mm_set1_ps(k.a2);
+            float* s = state + b * 4;  // s1 left, s1 right, s2 left, s2 right
+            __m128 s1 = loadPair(s);
+            __m128 s2 = loadPair(s + 2);
+            for (std::size_t i = 0; i < frames; ++i) {
+                float* frame = samples + 2 * i;
+                __m128 x = loadPair(frame);
+                __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), s1);
+                s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), s2);
+                s2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+                storePair(frame, y);
+            }
+            storePair(s, s1);
+            storePair(s + 2, s2);
+        }
+    }
+#endif
+
+    Band settings[bandCount];
+    std::atomic<unsigned int> version;  // Bumped by every setter
+    // Everything below belongs to the audio thread (and prepare())
+    unsigned int appliedVersion;
+    unsigned int sampleRate;
+    unsigned int channels;
+    Coefficients current[bandCount];
+    Coefficients target[bandCount];
+    float* state;      // Two filter states per band and channel, from the arena
+    float smoothing;   // Fraction of the remaining distance covered per glide step
+    bool settled;      // current == target
+    bool flat;         // target is a pass-through
+};
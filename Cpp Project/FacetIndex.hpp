@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Bitmap.hpp"
+#include "TrackCatalog.hpp"
+
+// Filters on track attributes (facets): for each facet, every value seen in the library maps to a
+// Bitmap of the ids of the tracks that have it (see TrackCatalog::getId()). A filter is an AND of
+// facets, each an OR of values, so it comes down to bitmap unions and intersections that take
+// microseconds on a 100k-track library. Tracks are added and removed without rebuilding anything.
+//
+// filter() reads facets out of a search query, as key:value words:
+//   artist:radio  album:"ok computer"  genre:rock,jazz  year:1990-1999  rate:44.1  length:3-5
+// Text values match names starting with them, ignoring ASCII case; commas separate alternatives,
+// and a quoted value is taken whole, spaces and commas included, with "" standing for a quote.
+// year, rate (Hz, or kHz below 1000) and length (whole minutes) take a number or a low-high
+// range with either end left open. Words that aren't facets are left for the text search.
+class FacetIndex {
+public:
+    enum Facet {
+        Artist,
+        Album,
+        Genre,
+        Year,
+        SampleRate,
+        Duration  // Whole seconds
+    };
+    static constexpr std::size_t facetCount = 6;
+
+    // Indexes every row of catalog, replacing what was there
+    void rebuild(const TrackCatalog& catalog) {
+        for (Column& column : columns) {
+            column = Column();
+        }
+        valuesById.clear();
+        everything.clear();
+        for (std::size_t row = 0; row < catalog.getCount(); ++row) {
+            add(catalog, row);
+        }
+    }
+
+    // Indexes a row added to the catalog (or whose tags changed, after remove())
+    void add(const TrackCatalog& catalog, std::size_t row) {
+        std::uint32_t id = catalog.getId(row);
+        if (id >= valuesById.size()) {
+            valuesById.resize(id + 1, noValues());
+        }
+        std::array<std::uint32_t, facetCount>& values = valuesById[id];
+        values[Artist] = valueFor(columns[Artist], lowercase(catalog.getArtist(row)));
+        values[Album] = valueFor(columns[Album], lowercase(catalog.getAlbum(row)));
+        values[Genre] = valueFor(columns[Genre], lowercase(catalog.getGenre(row)));
+        values[Year] = valueFor(columns[Year], catalog.getYear(row));
+        values[SampleRate] = valueFor(columns[SampleRate], catalog.getSampleRate(row));
+        values[Duration] = valueFor(columns[Duration], static_cast<std::uint32_t>(catalog.getDuration(row).asMilliseconds() / 1000));
+        for (std::size_t facet = 0; facet < facetCount; ++facet) {
+            columns[facet].tracks[values[facet]].add(id);
+        }
+        everything.add(id);
+    }
+
+    void remove(std::uint32_t id) {
+        if (id >= valuesById.size() || valuesById[id][0] == npos) {
+            return;
+        }
+        for (std::size_t facet = 0; facet < facetCount; ++facet) {
+            columns[facet].tracks[valuesById[id][facet]].remove(id);
+        }
+        valuesById[id] = noValues();
+        everything.remove(id);
+    }
+
+    // Adds to tracks those whose value of a text facet starts with prefix (any case)
+    void matchName(Facet facet, std::string_view prefix, Bitmap& tracks) const {
+        const Column& column = columns[facet];
+        std::string key = lowercase(prefix);
+        std::vector<const Bitmap*> values;
+        for (auto it = column.byName.lower_bound(key); it != column.byName.end() && it->first.compare(0, key.size(), key) == 0; ++it) {
+            values.push_back(&column.tracks[it->second]);
+        }
+        tracks.unionWith(values);
+    }
+
+    // Adds to tracks those whose value of a numeric facet is within [low, high]
+    void matchRange(Facet facet, std::uint32_t low, std::uint32_t high, Bitmap& tracks) const {
+        const Column& column = columns[facet];
+        std::vector<const Bitmap*> values;
+        for (auto it = column.byNumber.lower_bound(low); it != column.byNumber.end() && it->first <= high; ++it) {
+            values.push_back(&column.tracks[it->second]);
+        }
+        tracks.unionWith(values);
+    }
+
+    // Splits the facets out of query, leaving the other words in text, and sets tracks to the
+    // ones passing all of them. Returns false, with tracks untouched, if query has no facets.
+    bool filter(std::string_view query, std::string& text, Bitmap& tracks) const {
+        text.clear();
+        bool filtered = false;
+        std::size_t i = 0;
+        while (i < query.size()) {
+            std::size_t start = query.find_first_not_of(' ', i);
+            if (start == std::string_view::npos) {
+                break;
+            }
+            std::size_t end = query.find(' ', start);
+            end = (end == std::string_view::npos) ? query.size() : end;
+            std::size_t colon = query.find(':', start);
+            int facet = (colon < end) ? facetNamed(query.substr(start, colon - start)) : -1;
+            if (facet < 0) {
+                text.append(query.substr(start, end - start)).append(1, ' ');
+                i = end;
+                continue;
+            }
+
+            // A quoted value runs to the closing quote, or to the end while it's still being typed
+            std::size_t valueStart = colon + 1;
+            if (valueStart < query.size() && query[valueStart] == '"') {
+                std::size_t close = closingQuote(query, valueStart);
+                end = (close == std::string_view::npos) ? query.size() : close + 1;
+            }
+            Bitmap matched;
+            match(static_cast<Facet>(facet), query.substr(valueStart, end - valueStart), matched);
+            if (filtered) {
+                tracks.intersectWith(matched);
+            }
+            else {
+                tracks = std::move(matched);
+                filtered = true;
+            }
+            i = end;
+        }
+        return filtered;
+    }
+
+    // value as a quoted filter value, matched whole whatever it contains
+    static std::string quote(std::string_view value) {
+        std::string quoted = "\"";
+        for (char c : value) {
+            quoted += (c == '"') ? "\"\"" : std::string(1, c);
+        }
+        return quoted + "\"";
+    }
+
+private:
+    static constexpr std::uint32_t npos = 0xFFFFFFFFu;
+
+    // The values seen for one facet, numbered in order of appearance; a value stays when its
+    // last track goes, with an empty bitmap
+    struct Column {
+        std::vector<Bitmap> tracks;                   // By value number
+        std::map<std::string, std::uint32_t> byName;  // Lowercased, for the text facets
+        std::map<std::uint32_t, std::uint32_t> byNumber;
+    };
+
+    static std::array<std::uint32_t, facetCount> noValues() {
+        std::array<std::uint32_t, facetCount> values;
+        values.fill(npos);
+        return values;
+    }
+
+    static std::uint32_t valueFor(Column& column, const std::string& name) {
+        auto it = column.byName.emplace(name, static_cast<std::uint32_t>(column.tracks.size())).first;
+        if (it->second == column.tracks.size()) {
+            column.tracks.emplace_back();
+        }
+        return it->second;
+    }
+
+    static std::uint32_t valueFor(Column& column, std::uint32_t number) {
+        auto it = column.byNumber.emplace(number, static_cast<std::uint32_t>(column.tracks.size())).first;
+        if (it->second == column.tracks.size()) {
+            column.tracks.emplace_back();
+        }
+        return it->second;
+    }
+
+    static std::string lowercase(std::string_view text) {
+        std::string lowered(text);
+        for (char& c : lowered) {
+            c = (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+        return lowered;
+    }
+
+    static int facetNamed(std::string_view name) {
+        static const char* const names[facetCount] = { "artist", "album", "genre", "year", "rate", "length" };
+        std::string lowered = lowercase(name);
+        for (std::size_t facet = 0; facet < facetCount; ++facet) {
+            if (lowered == names[facet]) {
+                return static_cast<int>(facet);
+            }
+        }
+        return -1;
+    }
+
+    // Parses a whole number, or a decimal one when decimals is set; false if text isn't one
+    static bool parseNumber(std::string_view text, bool decimals, double& number) {
+        if (text.empty()) {
+            return false;
+        }
+        number = 0.0;
+        bool point = false;
+        double place = 1.0;
+        for (char c : text) {
+            if (c == '.' && decimals && !point) {
+                point = true;
+            }
+            else if (c >= '0' && c <= '9' && point) {
+                place /= 10.0;
+                number += (c - '0') * place;
+            }
+            else if (c >= '0' && c <= '9') {
+                number = number * 10.0 + (c - '0');
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Position of the quote closing the one at open, passing over doubled quotes, or npos
+    static std::size_t closingQuote(std::string_view query, std::size_t open) {
+        for (std::size_t i = open + 1; i < query.size(); ++i) {
+            if (query[i] != '"') {
+                continue;
+            }
+            if (i + 1 < query.size() && query[i + 1] == '"') {
+                ++i;
+                continue;
+            }
+            return i;
+        }
+        return std::string_view::npos;
+    }
+
+    // Tracks matching one key:value, each comma-separated alternative ORed in; a quoted value is
+    // a single alternative
+    void match(Facet facet, std::string_view value, Bitmap& matched) const {
+        if (!value.empty() && value.front() == '"') {
+            std::size_t close = closingQuote(value, 0);
+            std::string unquoted;
+            for (std::size_t i = 1; i < std::min(close, value.size()); ++i) {
+                unquoted += value[i];
+                i += (value[i] == '"') ? 1 : 0;  // "" stands for one quote
+            }
+            if (unquoted.empty()) {
+                matched.unionWith(everything);
+            }
+            else {
+                matchAlternative(facet, unquoted, matched);
+            }
+            return;
+        }
+        if (value.empty()) {
+            matched.unionWith(everything);  // Just typed the key
+            return;
+        }
+        std::size_t start = 0;
+        while (start <= value.size()) {
+            std::size_t comma = std::min(value.find(',', start), value.size());
+            matchAlternative(facet, value.substr(start, comma - start), matched);
+            start = comma + 1;
+        }
+    }
+
+    void matchAlternative(Facet facet, std::string_view alternative, Bitmap& matched) const {
+        if (facet == Artist || facet == Album || facet == Genre) {
+            matchName(facet, alternative, matched);
+            return;
+        }
+
+        // low-high, low-, -high or a single value
+        std::size_t dash = alternative.find('-');
+        std::string_view lowText = alternative.substr(0, dash);
+        std::string_view highText = (dash == std::string_view::npos) ? alternative : alternative.substr(dash + 1);
+        double low = 0.0;
+        double high = 0.0;
+        bool hasLow = parseNumber(lowText, facet == SampleRate, low);
+        bool hasHigh = parseNumber(highText, facet == SampleRate, high);
+        if ((!hasLow && !lowText.empty()) || (!hasHigh && !highText.empty()) || (!hasLow && !hasHigh)) {
+            return;  // Not a number (yet)
+        }
+        std::uint32_t first = hasLow ? scaled(facet, low, false) : 0;
+        std::uint32_t last = hasHigh ? scaled(facet, high, true) : npos;
+        matchRange(facet, first, last, matched);
+    }
+
+    // A typed number in the facet's stored unit; upper ends of minutes take in the whole minute
+    static std::uint32_t scaled(Facet facet, double number, bool upper) {
+        if (facet == SampleRate && number < 1000.0) {
+            number *= 1000.0;  // kHz
+        }
+        else if (facet == Duration) {
+            number = number * 60.0 + (upper ? 59.0 : 0.0);
+        }
+        return static_cast<std::uint32_t>(std::min(number + 0.5, 4294967295.0));
+    }
+
+    std::array<Column, facetCount> columns;
+    std::vector<std::array<std::uint32_t, facetCount>> valuesById;  // Value numbers, npos for ids not indexed
+    Bitmap everything;  // Every id indexed
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include "SampleKernels.hpp"
+
+// Edit distance kernels for typo-tolerant search, with the same per-instruction-set tables as
+// SampleKernels. Words are compared 16 at a time: callers store them in blocks of 16 words,
+// column by column (byte j of each of the 16 words, then byte j + 1, ...), up to 16 bytes each.
+//
+// prefixDistances() gives, for each word, the fewest insertions, deletions and substitutions that
+// turn the pattern into some prefix of the word, as a search box being typed into needs it: "hig"
+// is 0 away from "higher", "hgih" 2 away from "high". It runs Myers' bit-parallel algorithm with
+// the pattern's positions as the bits of a 16-bit lane, so SSE2 compares 8 words at once and AVX2 16.
+struct FuzzyKernels {
+    static constexpr std::size_t blockWords = 16;  // Words per block, and the longest pattern or word compared
+    static constexpr std::size_t blockBytes = blockWords * blockWords;
+
+    const char* name;
+    // pattern has length bytes (1 to 16); lengths has one entry per word; distances one per word
+    void (*prefixDistances)(const std::uint8_t* pattern, unsigned int length, const std::uint8_t* blocks,
+                            const std::uint8_t* lengths, std::size_t blockCount, std::uint8_t* distances);
+
+    // Writes word into its place among blocks (sized for its block), truncated to 16 bytes
+    static void store(std::uint8_t* blocks, std::uint8_t* lengths, std::size_t index, const char* word, std::size_t length) {
+        length = std::min(length, blockWords);
+        std::uint8_t* block = blocks + index / blockWords * blockBytes;
+        for (std::size_t j = 0; j < blockWords; ++j) {
+            block[j * blockWords + index % blockWords] = (j < length) ? static_cast<std::uint8_t>(word[j]) : 0;
+        }
+        lengths[index] = static_cast<std::uint8_t>(length);
+    }
+
+    static const FuzzyKernels& scalar();
+    static const FuzzyKernels& sse2();
+    static const FuzzyKernels& avx2();
+
+    // Best kernels for this CPU
+    static const FuzzyKernels& get() {
+        static const FuzzyKernels& best = SampleKernels::hasAvx2() ? avx2() : SampleKernels::hasSse2() ? sse2() : scalar();
+        return best;
+    }
+};
+
+struct ScalarFuzzyKernels {
+    static void prefixDistances(const std::uint8_t* pattern, unsigned int length, const std::uint8_t* blocks,
+                                const std::uint8_t* lengths, std::size_t blockCount, std::uint8_t* distances) {
+        const std::size_t lanes = FuzzyKernels::blockWords;
+        std::uint32_t peq[256] = {};
+        for (unsigned int i = 0; i < length; ++i) {
+            peq[pattern[i]] |= 1u << i;
+        }
+        const std::uint32_t high = 1u << (length - 1);
+        for (std::size_t word = 0; word < blockCount * lanes; ++word) {
+            const std::uint8_t* column = blocks + word / lanes * FuzzyKernels::blockBytes + word % lanes;
+            std::uint32_t pv = (high << 1) - 1;
+            std::uint32_t mv = 0;
+            unsigned int score = length;
+            unsigned int best = length;
+            for (unsigned int j = 0; j < lengths[word]; ++j) {
+                std::uint32_t eq = peq[column[j * lanes]];
+                std::uint32_t xv = eq | mv;
+                std::uint32_t xh = (((eq & pv) + pv) ^ pv) | eq;
+                std::uint32_t ph = mv | ~(xh | pv);
+                std::uint32_t mh = pv & xh;
+                score += (ph & high) ? 1 : 0;
+                score -= (mh & high) ? 1 : 0;
+                ph = (ph << 1) | 1;  // The pattern must start where the word does
+                mh <<= 1;
+                pv = mh | ~(xv | ph);
+                mv = ph & xv;
+                best = std::min(best, score);
+            }
+            distances[word] = static_cast<std::uint8_t>(best);
+        }
+    }
+};
+
+#ifdef SAMPLE_KERNELS_X86
+struct Sse2FuzzyKernels {
+    KERNEL_TARGET_SSE2 static void prefixDistances(const std::uint8_t* pattern, unsigned int length, const std::uint8_t* blocks,
+                                                   const std::uint8_t* lengths, std::size_t blockCount, std::uint8_t* distances) {
+        const std::size_t lanes = FuzzyKernels::blockWords;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i high = _mm_set1_epi16(static_cast<short>(1u << (length - 1)));
+        const __m128i ended = _mm_set1_epi16(0x7FFF);
+        __m128i letters[FuzzyKernels::blockWords];
+        __m128i bits[FuzzyKernels::blockWords];
+        for (unsigned int i = 0; i < length; ++i) {
+            letters[i] = _mm_set1_epi16(pattern[i]);
+            bits[i] = _mm_set1_epi16(static_cast<short>(1u << i));
+        }
+        alignas(16) std::int16_t result[8];
+        for (std::size_t block = 0; block < blockCount; ++block) {
+            for (std::size_t half = 0; half < lanes; half += 8) {
+                const std::uint8_t* base = blocks + block * FuzzyKernels::blockBytes + half;
+                const std::uint8_t* wordLengths = lengths + block * lanes + half;
+                unsigned int longest = *std::max_element(wordLengths, wordLengths + 8);
+                __m128i remaining = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(wordLengths)), zero);
+                __m128i pv = _mm_set1_epi16(static_cast<short>((1u << length) - 1));
+                __m128i mv = zero;
+                __m128i score = _mm_set1_epi16(static_cast<short>(length));
+                __m128i best = score;
+                for (unsigned int j = 0; j < longest; ++j) {
+                    __m128i text = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(base + j * lanes)), zero);
+                    __m128i eq = zero;
+                    for (unsigned int i = 0; i < length; ++i) {
+                        eq = _mm_or_si128(eq, _mm_and_si128(_mm_cmpeq_epi16(text, letters[i]), bits[i]));
+                    }
+                    __m128i xv = _mm_or_si128(eq, mv);
+                    __m128i xh = _mm_or_si128(_mm_xor_si128(_mm_add_epi16(_mm_and_si128(eq, pv), pv), pv), eq);
+                    __m128i ph = _mm_or_si128(mv, _mm_andnot_si128(_mm_or_si128(xh, pv), _mm_set1_epi16(-1)));
+                    __m128i mh = _mm_and_si128(pv, xh);
+                    score = _mm_sub_epi16(score, _mm_cmpeq_epi16(_mm_and_si128(ph, high), high));  // Mask is -1 where set
+                    score = _mm_add_epi16(score, _mm_cmpeq_epi16(_mm_and_si128(mh, high), high));
+                    ph = _mm_or_si128(_mm_slli_epi16(ph, 1), one);
+                    mh = _mm_slli_epi16(mh, 1);
+                    pv = _mm_or_si128(mh, _mm_andnot_si128(_mm_or_si128(xv, ph), _mm_set1_epi16(-1)));
+                    mv = _mm_and_si128(ph, xv);
+                    // Lanes past the end of their word keep their best
+                    __m128i active = _mm_cmpgt_epi16(remaining, _mm_set1_epi16(static_cast<short>(j)));
+                    best = _mm_min_epi16(best, _mm_or_si128(_mm_and_si128(active, score), _mm_andnot_si128(active, ended)));
+                }
+                _mm_store_si128(reinterpret_cast<__m128i*>(result), best);
+                for (std::size_t lane = 0; lane < 8; ++lane) {
+                    distances[block * lanes + half + lane] = static_cast<std::uint8_t>(result[lane]);
+                }
+            }
+        }
+    }
+};
+
+struct Avx2FuzzyKernels {
+    KERNEL_TARGET_AVX2 static void prefixDistances(const std::uint8_t* pattern, unsigned int length, const std::uint8_t* blocks,
+                                                   const std::uint8_t* lengths, std::size_t blockCount, std::uint8_t* distances) {
+        const std::size_t lanes = FuzzyKernels::blockWords;
+        const __m256i ones = _mm256_set1_epi16(-1);
+        const __m256i one = _mm256_set1_epi16(1);
+        const __m256i high = _mm256_set1_epi16(static_cast<short>(1u << (length - 1)));
+        const __m256i ended = _mm256_set1_epi16(0x7FFF);
+        __m256i letters[FuzzyKernels::blockWords];
+        __m256i bits[FuzzyKernels::blockWords];
+        for (unsigned int i = 0; i < length; ++i) {
+            letters[i] = _mm256_set1_epi16(pattern[i]);
+            bits[i] = _mm256_set1_epi16(static_cast<short>(1u << i));
+        }
+        alignas(32) std::int16_t result[16];
+        for (std::size_t block = 0; block < blockCount; ++block) {
+            const std::uint8_t* base = blocks + block * FuzzyKernels::blockBytes;
+            const std::uint8_t* wordLengths = lengths + block * lanes;
+            unsigned int longest = *std::max_element(wordLengths, wordLengths + lanes);
+            __m256i remaining = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(wordLengths)));
+            __m256i pv = _mm256_set1_epi16(static_cast<short>((1u << length) - 1));
+            __m256i mv = _mm256_setzero_si256();
+            __m256i score = _mm256_set1_epi16(static_cast<short>(length));
+            __m256i best = score;
+            for (unsigned int j = 0; j < longest; ++j) {
+                __m256i text = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(base + j * lanes)));
+                __m256i eq = _mm256_setzero_si256();
+                for (unsigned int i = 0; i < length; ++i) {
+                    eq = _mm256_or_si256(eq, _mm256_and_si256(_mm256_cmpeq_epi16(text, letters[i]), bits[i]));
+                }
+                __m256i xv = _mm256_or_si256(eq, mv);
+                __m256i xh = _mm256_or_si256(_mm256_xor_si256(_mm256_add_epi16(_mm256_and_si256(eq, pv), pv), pv), eq);
+                __m256i ph = _mm256_or_si256(mv, _mm256_andnot_si256(_mm256_or_si256(xh, pv), ones));
+                __m256i mh = _mm256_and_si256(pv, xh);
+                score = _mm256_sub_epi16(score, _mm256_cmpeq_epi16(_mm256_and_si256(ph, high), high));
+                score = _mm256_add_epi16(score, _mm256_cmpeq_epi16(_mm256_and_si256(mh, high), high));
+                ph = _mm256_or_si256(_mm256_slli_epi16(ph, 1), one);
+                mh = _mm256_slli_epi16(mh, 1);
+                pv = _mm256_or_si256(mh, _mm256_andnot_si256(_mm256_or_si256(xv, ph), ones));
+                mv = _mm256_and_si256(ph, xv);
+                __m256i active = _mm256_cmpgt_epi16(remaining, _mm256_set1_epi16(static_cast<short>(j)));
+                best = _mm256_min_epi16(best, _mm256_blendv_epi8(ended, score, active));
+            }
+            _mm256_store_si256(reinterpret_cast<__m256i*>(result), best);
+            for (std::size_t lane = 0; lane < lanes; ++lane) {
+                distances[block * lanes + lane] = static_cast<std::uint8_t>(result[lane]);
+            }
+        }
+    }
+};
+#endif
+
+inline const FuzzyKernels& FuzzyKernels::scalar() {
+    static const FuzzyKernels kernels = { "scalar", &ScalarFuzzyKernels::prefixDistances };
+    return kernels;
+}
+
+inline const FuzzyKernels& FuzzyKernels::sse2() {
+#ifdef SAMPLE_KERNELS_X86
+    static const FuzzyKernels kernels = { "sse2", &Sse2FuzzyKernels::prefixDistances };
+    return kernels;
+#else
+    return scalar();
+#endif
+}
+
+inline const FuzzyKernels& FuzzyKernels::avx2() {
+#ifdef SAMPLE_KERNELS_X86
+    static const FuzzyKernels kernels = { "avx2", &Avx2FuzzyKernels::prefixDistances };
+    return kernels;
+#else
+    return scalar();
+#endif
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "SearchIndex.hpp"
+
+// Runs SearchIndex::fuzzySearch() on its own thread for the latest query only. Each submit()
+// bumps a generation counter; a search still running for an older generation sees it at its
+// next check and gives up, and results that arrive late for one are dropped, so typing faster
+// than searches finish never queues work up.
+class FuzzySearcher {
+public:
+    explicit FuzzySearcher(const SearchIndex& index) : index(index), generation(0), started(0), finished(0), taken(true), running(true) {
+        worker = std::thread(&FuzzySearcher::run, this);
+    }
+
+    ~FuzzySearcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+            ++generation;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    FuzzySearcher(const FuzzySearcher&) = delete;
+    FuzzySearcher& operator=(const FuzzySearcher&) = delete;
+
+    // Starts searching for query, abandoning whatever is being searched for
+    void submit(std::string_view query) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = std::string(query);
+            ++generation;
+        }
+        wake.notify_one();
+    }
+
+    // Hands over the ids and scores found for the latest query once they are in, one time only
+    bool poll(std::vector<std::uint32_t>& ids, std::vector<std::uint8_t>& scores) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (taken || finished != generation.load()) {
+            return false;
+        }
+        ids.swap(foundIds);
+        scores.swap(foundScores);
+        taken = true;
+        return true;
+    }
+
+private:
+    void run() {
+        std::vector<std::uint32_t> ids;
+        std::vector<std::uint8_t> scores;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return !running || started != generation.load(); });
+            if (!running) {
+                break;
+            }
+            std::uint64_t current = generation.load();
+            std::string query = pending;
+            started = current;
+            lock.unlock();
+            bool found = index.fuzzySearch(query, scratch, ids, scores, [this, current] { return generation.load() != current; });
+            lock.lock();
+            if (found && current == generation.load()) {
+                foundIds.swap(ids);
+                foundScores.swap(scores);
+                finished = current;
+                taken = false;
+            }
+        }
+    }
+
+    const SearchIndex& index;
+    std::mutex mutex;  // Guards pending and the results between the owner and the worker
+    std::condition_variable wake;
+    std::thread worker;
+    std::string pending;                     // Latest query
+    std::atomic<std::uint64_t> generation;   // Bumped by every submit(), read by running searches
+    std::uint64_t started;                   // Generation the worker last picked up
+    std::uint64_t finished;                  // Generation foundIds belong to
+    std::vector<std::uint32_t> foundIds;
+    std::vector<std::uint8_t> foundScores;
+    bool taken;
+    bool running;
+    SearchIndex::FuzzyScratch scratch;       // Only touched by the worker
+};
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "LibraryScanner.hpp"
+#include "Loudness.hpp"
+#include "MappedFile.hpp"
+#include "StringPool.hpp"
+#include "ThreadPool.hpp"
+#include "TrackCatalog.hpp"
+#include "TrackIds.hpp"
+
+// The scanned library on disk, laid out so it is used straight from a memory mapping: a header,
+// then one array per field (ids, durations, ...; text fields as string ids) and finally a string
+// pool holding each distinct path, title, artist, album and genre once. Opening checks the header and sizes and reads nothing else, so startup
+// costs the same for ten tracks or a hundred thousand; pages are faulted in as tracks are looked at.
+//
+// Tracks are sorted by path. Ids stay with a path across rewrites, new paths get ids never used before.
+// Gains are the loudness normalization in dB as last measured, NaN for tracks not measured yet.
+// Fields are in host byte order; an index from a machine of the other endianness fails the magic check.
+class LibraryIndex {
+public:
+    LibraryIndex() : header(nullptr) {}
+
+    LibraryIndex(const LibraryIndex&) = delete;
+    LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+    // Maps file; false if it is missing, from another version or damaged
+    bool open(const std::string& file) {
+        close();
+        if (!mapping.open(file) || mapping.getSize() < sizeof(Header)) {
+            mapping.close();
+            return false;
+        }
+        const Header* candidate = reinterpret_cast<const Header*>(mapping.getData());
+        Layout layout(candidate->trackCount, candidate->stringCount);
+        if (candidate->magic != magic || candidate->version != version || layout.pool + candidate->poolSize != mapping.getSize()) {
+            mapping.close();
+            return false;
+        }
+        header = candidate;
+        columns = layout;
+        return true;
+    }
+
+    void close() {
+        mapping.close();
+        header = nullptr;
+    }
+
+    // Position of path, or -1
+    int find(std::string_view path) const {
+        std::size_t low = 0;
+        std::size_t high = getTrackCount();
+        while (low < high) {
+            std::size_t middle = low + (high - low) / 2;
+            if (getPath(middle) < path) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return (low < getTrackCount() && getPath(low) == path) ? static_cast<int>(low) : -1;
+    }
+
+    // Loads every track into catalog, which must be empty. The catalog takes the string pool over
+    // whole and rows are appended with their string ids as they are, so no track builds strings of
+    // its own; a pool that won't go over as it is gets each string interned once instead.
+    void fill(TrackCatalog& catalog) const {
+        if (!header) {
+            return;
+        }
+        catalog.reserve(getTrackCount());
+        catalog.setNextId(getNextId());
+        std::vector<std::uint32_t> strings;  // Index string id to the catalog's, when they differ
+        if (!catalog.assignStrings(mapping.getData() + columns.pool, static_cast<std::size_t>(header->poolSize),
+                                   reinterpret_cast<const std::uint32_t*>(mapping.getData() + columns.stringOffsets), header->stringCount)) {
+            catalog.reserveStrings(header->stringCount, static_cast<std::size_t>(header->poolSize));
+            strings.resize(header->stringCount);
+            for (std::uint32_t id = 0; id < header->stringCount; ++id) {
+                strings[id] = catalog.intern(text(id));
+            }
+        }
+        auto string = [&](std::size_t offset, std::size_t i) {
+            std::uint32_t id = field<std::uint32_t>(offset, i);
+            if (id >= header->stringCount) {
+                return 0u;  // Damaged, so empty
+            }
+            return strings.empty() ? id : strings[id];
+        };
+        for (std::size_t i = 0; i < getTrackCount(); ++i) {
+            TrackCatalog::Row row{ string(columns.paths, i), string(columns.titles, i), string(columns.artists, i), string(columns.albums, i),
+                                   string(columns.genres, i), getDuration(i), getSampleRate(i), getChannelCount(i), getYear(i), getTrackNumber(i) };
+            catalog.append(getId(i), row);
+        }
+    }
+
+    // Copies of every track, e.g. to rescan against
+    std::vector<TrackInfo> getTracks() const {
+        std::vector<TrackInfo> tracks(getTrackCount());
+        for (std::size_t i = 0; i < tracks.size(); ++i) {
+            tracks[i] = getTrack(i);
+        }
+        return tracks;
+    }
+
+    std::vector<std::string> getPaths() const {
+        std::vector<std::string> paths;
+        paths.reserve(getTrackCount());
+        for (std::size_t i = 0; i < getTrackCount(); ++i) {
+            paths.emplace_back(getPath(i));
+        }
+        return paths;
+    }
+
+    // Writes tracks (sorted by path) to file. Ids and gains carry over from previous, which may be
+    // the index being replaced: it is closed before the new file takes its place, as Windows can't
+    // replace a mapped file. Gains loudness has measured take precedence over stored ones, and
+    // tracks new since previous keep the ids catalog gave them, or else the ones trackIds logged
+    // for their paths; ids handed out here are logged there before the index is written.
+    static bool write(const std::string& file, const std::vector<TrackInfo>& tracks, LibraryIndex& previous,
+                      const LoudnessLibrary* loudness = nullptr, const TrackCatalog* catalog = nullptr,
+                      TrackIds* trackIds = nullptr) {
+        StringPool strings;
+        for (const TrackInfo& track : tracks) {
+            strings.intern(track.path);
+            strings.intern(track.title);
+            strings.intern(track.artist);
+            strings.intern(track.album);
+            strings.intern(track.genre);
+        }
+        Layout layout(tracks.size(), strings.getCount());
+        std::vector<char> data(layout.pool);
+        Header* out = reinterpret_cast<Header*>(data.data());
+        out->magic = magic;
+        out->version = version;
+        out->trackCount = static_cast<std::uint32_t>(tracks.size());
+        out->nextId = std::max({ previous.getNextId(), catalog ? catalog->getNextId() : 0u, trackIds ? trackIds->getNextId() : 0u });
+        out->stringCount = static_cast<std::uint32_t>(strings.getCount());
+
+        for (std::size_t i = 0; i < tracks.size(); ++i) {
+            const TrackInfo& track = tracks[i];
+            int old = previous.find(track.path);
+            float trackGain = (old >= 0) ? previous.getTrackGain(old) : unmeasured();
+            float albumGain = (old >= 0) ? previous.getAlbumGain(old) : unmeasured();
+            if (old >= 0 && previous.getFingerprint(old) != track.fingerprint) {
+                trackGain = albumGain = unmeasured();  // The file changed, so did its loudness
+            }
+            if (loudness && loudness->has(track.path)) {
+                trackGain = decibels(loudness->getGain(track.path, LoudnessLibrary::Track));
+                albumGain = decibels(loudness->getGain(track.path, LoudnessLibrary::Album));
+            }
+
+            std::size_t row = (old < 0 && catalog) ? catalog->find(track.path) : TrackCatalog::npos;
+            if (old >= 0) {
+                column<std::uint32_t>(data, layout.ids)[i] = previous.getId(old);
+            }
+            else {
+                std::uint32_t id = (row != TrackCatalog::npos) ? catalog->getId(row) : trackIds ? trackIds->find(track.path) : TrackIds::npos;
+                if (id == TrackIds::npos) {
+                    id = out->nextId++;
+                    if (trackIds) {
+                        trackIds->add(track.path, id);
+                    }
+                }
+                column<std::uint32_t>(data, layout.ids)[i] = id;
+            }
+            column<std::uint32_t>(data, layout.paths)[i] = strings.find(track.path);
+            column<std::uint32_t>(data, layout.titles)[i] = strings.find(track.title);
+            column<std::uint32_t>(data, layout.artists)[i] = strings.find(track.artist);
+            column<std::uint32_t>(data, layout.albums)[i] = strings.find(track.album);
+            column<std::uint32_t>(data, layout.genres)[i] = strings.find(track.genre);
+            column<std::int64_t>(data, layout.durations)[i] = track.duration.asMicroseconds();
+            column<std::uint32_t>(data, layout.sampleRates)[i] = track.sampleRate;
+            column<std::uint16_t>(data, layout.channelCounts)[i] = static_cast<std::uint16_t>(track.channelCount);
+            column<std::uint16_t>(data, layout.years)[i] = static_cast<std::uint16_t>(std::min(track.year, 65535u));
+            column<std::uint16_t>(data, layout.trackNumbers)[i] = static_cast<std::uint16_t>(std::min(track.trackNumber, 65535u));
+            column<std::uint64_t>(data, layout.sizes)[i] = track.fingerprint.size;
+            column<std::int64_t>(data, layout.modified)[i] = track.fingerprint.modified;
+            column<std::uint64_t>(data, layout.inodes)[i] = track.fingerprint.inode;
+            column<float>(data, layout.trackGains)[i] = trackGain;
+            column<float>(data, layout.albumGains)[i] = albumGain;
+        }
+        std::uint32_t poolSize = 0;
+        for (std::uint32_t id = 0; id < strings.getCount(); ++id) {
+            column<std::uint32_t>(data, layout.stringOffsets)[id] = poolSize;
+            poolSize += static_cast<std::uint32_t>(strings.view(id).size());
+        }
+        column<std::uint32_t>(data, layout.stringOffsets)[strings.getCount()] = poolSize;
+        out->poolSize = poolSize;
+        if (trackIds && !trackIds->flush()) {
+            return false;  // An index naming ids the log doesn't know could hand them out again
+        }
+
+        // Write beside the old index and swap it in, so a crash never leaves half a file
+        std::string temporary = file + ".tmp";
+        {
+            std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+            stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+            for (std::uint32_t id = 0; id < strings.getCount(); ++id) {
+                std::string_view text = strings.view(id);
+                stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+            }
+            if (!stream) {
+                return false;
+            }
+        }
+        previous.close();
+        std::error_code error;
+        std::filesystem::rename(temporary, file, error);
+        return !error;
+    }
+
+    // Brings the index at file up to date with the folder root: tracks whose fingerprint still
+    // matches are taken from the index, only new and changed files are opened. Returns the tracks.
+    static std::vector<TrackInfo> refresh(const std::string& file, const std::string& root, ThreadPool& pool, TrackIds* trackIds = nullptr) {
+        LibraryIndex index;
+        index.open(file);
+        LibraryScanner scanner(pool);
+        std::vector<TrackInfo> tracks = scanner.rescan(root, index.getTracks());
+        if (scanner.getReprobedCount() > 0 || tracks.size() != index.getTrackCount()) {
+            write(file, tracks, index, nullptr, nullptr, trackIds);
+        }
+        return tracks;
+    }
+
+    // Getters
+    std::size_t getTrackCount() const {
+        return header ? header->trackCount : 0;
+    }
+
+    bool isOpen() const {
+        return header != nullptr;
+    }
+
+    // First id not yet given to any track
+    std::uint32_t getNextId() const {
+        return header ? header->nextId : 0;
+    }
+
+    // Stable identifier of the track at position i
+    std::uint32_t getId(std::size_t i) const {
+        return field<std::uint32_t>(columns.ids, i);
+    }
+
+    // Text points into the mapping, valid until the index is closed
+    std::string_view getPath(std::size_t i) const {
+        return text(field<std::uint32_t>(columns.paths, i));
+    }
+
+    std::string_view getTitle(std::size_t i) const {
+        return text(field<std::uint32_t>(columns.titles, i));
+    }
+
+    std::string_view getArtist(std::size_t i) const {
+        return text(field<std::uint32_t>(columns.artists, i));
+    }
+
+    std::string_view getAlbum(std::size_t i) const {
+        return text(field<std::uint32_t>(columns.albums, i));
+    }
+
+    std::string_view getGenre(std::size_t i) const {
+        return text(field<std::uint32_t>(columns.genres, i));
+    }
+
+    unsigned int getYear(std::size_t i) const {
+        return field<std::uint16_t>(columns.years, i);
+    }
+
+    unsigned int getTrackNumber(std::size_t i) const {
+        return field<std::uint16_t>(columns.trackNumbers, i);
+    }
+
+    sf::Time getDuration(std::size_t i) const {
+        return sf::microseconds(field<std::int64_t>(columns.durations, i));
+    }
+
+    unsigned int getSampleRate(std::size_t i) const {
+        return field<std::uint32_t>(columns.sampleRates, i);
+    }
+
+    unsigned int getChannelCount(std::size_t i) const {
+        return field<std::uint16_t>(columns.channelCounts, i);
+    }
+
+    FileFingerprint getFingerprint(std::size_t i) const {
+        return FileFingerprint{ field<std::uint64_t>(columns.sizes, i), field<std::int64_t>(columns.modified, i),
+                                field<std::uint64_t>(columns.inodes, i) };
+    }
+
+    // Normalization in dB, NaN if unknown
+    float getTrackGain(std::size_t i) const {
+        return field<float>(columns.trackGains, i);
+    }
+
+    float getAlbumGain(std::size_t i) const {
+        return field<float>(columns.albumGains, i);
+    }
+
+    TrackInfo getTrack(std::size_t i) const {
+        TrackInfo track;
+        track.path = std::string(getPath(i));
+        track.duration = getDuration(i);
+        track.channelCount = getChannelCount(i);
+        track.sampleRate = getSampleRate(i);
+        track.fingerprint = getFingerprint(i);
+        track.title = std::string(getTitle(i));
+        track.artist = std::string(getArtist(i));
+        track.album = std::string(getAlbum(i));
+        track.genre = std::string(getGenre(i));
+        track.year = getYear(i);
+        track.trackNumber = getTrackNumber(i);
+        return track;
+    }
+
+private:
+    static const std::uint32_t magic = 0x5844494Cu;  // "LIDX" read as a little-endian word
+    static const std::uint32_t version = 2;
+
+    struct Header {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t trackCount;
+        std::uint32_t nextId;       // First id not yet handed out
+        std::uint32_t stringCount;
+        std::uint32_t reserved;
+        std::uint64_t poolSize;     // Bytes of text after the columns
+    };
+
+    // Byte offset of each column for given track and string counts, every one 8-byte aligned
+    struct Layout {
+        std::size_t ids, paths, titles, artists, albums, genres, durations, sampleRates, channelCounts, years, trackNumbers,
+            sizes, modified, inodes, trackGains, albumGains, stringOffsets, pool;
+
+        explicit Layout(std::size_t count = 0, std::size_t stringCount = 0) {
+            std::size_t offset = sizeof(Header);
+            auto place = [&](std::size_t bytes) {
+                std::size_t start = offset;
+                offset = (offset + bytes + 7) & ~static_cast<std::size_t>(7);
+                return start;
+            };
+            ids = place(count * sizeof(std::uint32_t));
+            paths = place(count * sizeof(std::uint32_t));
+            titles = place(count * sizeof(std::uint32_t));
+            artists = place(count * sizeof(std::uint32_t));
+            albums = place(count * sizeof(std::uint32_t));
+            genres = place(count * sizeof(std::uint32_t));
+            durations = place(count * sizeof(std::int64_t));
+            sampleRates = place(count * sizeof(std::uint32_t));
+            channelCounts = place(count * sizeof(std::uint16_t));
+            years = place(count * sizeof(std::uint16_t));
+            trackNumbers = place(count * sizeof(std::uint16_t));
+            sizes = place(count * sizeof(std::uint64_t));
+            modified = place(count * sizeof(std::int64_t));
+            inodes = place(count * sizeof(std::uint64_t));
+            trackGains = place(count * sizeof(float));
+            albumGains = place(count * sizeof(float));
+            stringOffsets = place((stringCount + 1) * sizeof(std::uint32_t));  // One past the last, for the last one's end
+            pool = offset;
+        }
+    };
+
+    static float unmeasured() {
+        return std::numeric_limits<float>::quiet_NaN();
+    }
+
+    static float decibels(float gain) {
+        return 20.0f * std::log10(gain);
+    }
+
+    template <typename T>
+    static T* column(std::vector<char>& data, std::size_t offset) {
+        return reinterpret_cast<T*>(data.data() + offset);
+    }
+
+    // A damaged file yields wrong text, never a read outside the mapping
+    std::string_view text(std::uint32_t id) const {
+        if (id >= header->stringCount) {
+            return std::string_view();
+        }
+        std::uint64_t end = std::min<std::uint64_t>(field<std::uint32_t>(columns.stringOffsets, id + 1), header->poolSize);
+        std::uint64_t begin = std::min<std::uint64_t>(field<std::uint32_t>(columns.stringOffsets, id), end);
+        return std::string_view(mapping.getData() + columns.pool + begin, static_cast<std::size_t>(end - begin));
+    }
+
+    // Mapped views are page aligned and columns 8-byte aligned, so fields are read in place
+    template <typename T>
+    T field(std::size_t offset, std::size_t i) const {
+        return reinterpret_cast<const T*>(mapping.getData() + offset)[i];
+    }
+
+    MappedFile mapping;
+    const Header* header;  // Into the mapping, null when closed
+    Layout columns;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include "MappedSoundFile.hpp"
+#include "TagReader.hpp"
+#include "ThreadPool.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Identifies one version of a file without reading it: if none of these changed, neither did the file.
+// The inode catches a file replaced by another of the same size and time (not available on Windows).
+struct FileFingerprint {
+    std::uint64_t size;
+    std::int64_t modified;  // Last write, in the platform's native units
+    std::uint64_t inode;
+
+    bool operator==(const FileFingerprint& other) const {
+        return size == other.size && modified == other.modified && inode == other.inode;
+    }
+
+    bool operator!=(const FileFingerprint& other) const {
+        return !(*this == other);
+    }
+
+    // One stat call, no open
+    static bool read(const std::string& path, FileFingerprint& fingerprint) {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) {
+            return false;
+        }
+        fingerprint.size = (static_cast<std::uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+        fingerprint.modified = static_cast<std::int64_t>((static_cast<std::uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+                                                         attributes.ftLastWriteTime.dwLowDateTime);
+        fingerprint.inode = 0;
+#else
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0) {
+            return false;
+        }
+        fingerprint.size = static_cast<std::uint64_t>(status.st_size);
+#ifdef __APPLE__
+        fingerprint.modified = static_cast<std::int64_t>(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+        fingerprint.modified = static_cast<std::int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+        fingerprint.inode = static_cast<std::uint64_t>(status.st_ino);
+#endif
+        return true;
+    }
+};
+
+// What the library knows about a track without decoding it
+struct TrackInfo {
+    std::string path;
+    sf::Time duration;
+    unsigned int channelCount;
+    unsigned int sampleRate;
+    FileFingerprint fingerprint;  // Of the file when it was probed
+    // From the file's tags, empty or 0 where it has none
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::string genre;
+    unsigned int year;
+    unsigned int trackNumber;
+};
+
+// Finds every playable file under a music folder. Each directory is listed by its own job on the
+// pool and queues jobs for its subdirectories, so the walk itself runs on all cores; files are
+// probed in batches in the same way. Probing maps the file once for both sf::InputSoundFile and
+// the TagReader, and neither reads more than the headers and tags.
+// Unreadable directories and files SFML can't open are skipped.
+//
+// rescan() takes the tracks of an earlier scan (see LibraryIndex) and only opens files whose
+// fingerprint changed; the rest cost one stat each.
+class LibraryScanner {
+public:
+    explicit LibraryScanner(ThreadPool& pool) : pool(pool), cache(nullptr) {}
+
+    // Tracks under root, sorted by path
+    std::vector<TrackInfo> scan(const std::string& root) {
+        return rescan(root, std::vector<TrackInfo>());
+    }
+
+    // Like scan(), reusing what previous says about files that haven't changed since
+    std::vector<TrackInfo> rescan(const std::string& root, const std::vector<TrackInfo>& previous) {
+        std::unordered_map<std::string, const TrackInfo*> index;
+        index.reserve(previous.size());
+        for (const TrackInfo& track : previous) {
+            index[track.path] = &track;
+        }
+        cache = &index;
+        reprobed = 0;
+        tracks.clear();
+        pool.submit([this, root] { scanDirectory(std::filesystem::u8path(root)); });
+        pool.wait();
+        cache = nullptr;
+
+        std::vector<TrackInfo> found;
+        found.swap(tracks);
+        std::sort(found.begin(), found.end(), [](const TrackInfo& a, const TrackInfo& b) { return a.path < b.path; });
+        return found;
+    }
+
+    // Files the last scan had to open, i.e. new or changed since the previous one
+    std::size_t getReprobedCount() const {
+        return reprobed;
+    }
+
+    // Just the paths, for players that take a list of files
+    static std::vector<std::string> paths(const std::vector<TrackInfo>& tracks) {
+        std::vector<std::string> result;
+        result.reserve(tracks.size());
+        for (const TrackInfo& track : tracks) {
+            result.push_back(track.path);
+        }
+        return result;
+    }
+
+    // True for extensions SFML can decode
+    static bool isAudioFile(const std::filesystem::path& path) {
+        static const char* extensions[] = { ".wav", ".ogg", ".oga", ".flac", ".mp3", ".aif", ".aiff", ".aifc" };
+        std::string extension = path.extension().u8string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        for (const char* known : extensions) {
+            if (extension == known) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Reads one file's header and tags, false if SFML can't open it
+    static bool probe(const std::string& path, TrackInfo& track, TagReader& reader) {
+        MappedInputStream stream;  // Must outlive sound
+        sf::InputSoundFile sound;
+        if (!FileFingerprint::read(path, track.fingerprint) || !stream.open(path) || !sound.openFromStream(stream)) {
+            return false;
+        }
+        track.path = path;
+        track.duration = sound.getDuration();
+        track.channelCount = sound.getChannelCount();
+        track.sampleRate = sound.getSampleRate();
+
+        TrackTags tags;
+        reader.read(stream.getFile().getData(), stream.getFile().getSize(), tags);
+        track.title.assign(tags.title.data(), tags.title.size());
+        track.artist.assign(tags.artist.data(), tags.artist.size());
+        track.album.assign(tags.album.data(), tags.album.size());
+        track.genre.assign(tags.genre.data(), tags.genre.size());
+        track.year = tags.year;
+        track.trackNumber = tags.trackNumber;
+        return true;
+    }
+
+    static bool probe(const std::string& path, TrackInfo& track) {
+        TagReader reader;
+        return probe(path, track, reader);
+    }
+
+private:
+    // Files probed per job, small enough to spread a single huge folder over every core
+    static const std::size_t batchSize = 64;
+
+    void scanDirectory(const std::filesystem::path& directory) {
+        std::error_code error;
+        std::filesystem::directory_iterator it(directory, std::filesystem::directory_options::skip_permission_denied, error);
+        std::shared_ptr<std::vector<std::filesystem::path>> batch = std::make_shared<std::vector<std::filesystem::path>>();
+        for (std::filesystem::directory_iterator end; !error && it != end; it.increment(error)) {
+            const std::filesystem::directory_entry& entry = *it;
+            // Symlinked folders aren't followed, they could loop back on themselves
+            if (entry.is_directory(error) && !entry.is_symlink(error)) {
+                std::filesystem::path subdirectory = entry.path();
+                pool.submit([this, subdirectory] { scanDirectory(subdirectory); });
+            }
+            else if (entry.is_regular_file(error) && isAudioFile(entry.path())) {
+                batch->push_back(entry.path());
+                if (batch->size() == batchSize) {
+                    pool.submit([this, batch] { probeBatch(*batch); });
+                    batch = std::make_shared<std::vector<std::filesystem::path>>();
+                }
+            }
+            error.clear();  // A failed status check skips the entry, not the rest of the folder
+        }
+        probeBatch(*batch);
+    }
+
+    void probeBatch(const std::vector<std::filesystem::path>& files) {
+        std::vector<TrackInfo> probed;
+        probed.reserve(files.size());
+        std::size_t opened = 0;
+        TagReader reader;
+        for (const std::filesystem::path& file : files) {
+            TrackInfo track;
+            track.path = file.u8string();
+            auto previous = cache->find(track.path);
+            if (previous != cache->end() && FileFingerprint::read(track.path, track.fingerprint) &&
+                track.fingerprint == previous->second->fingerprint) {
+                probed.push_back(*previous->second);
+                continue;
+            }
+            ++opened;
+            if (probe(track.path, track, reader)) {
+                probed.push_back(track);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        tracks.insert(tracks.end(), probed.begin(), probed.end());
+        reprobed += opened;
+    }
+
+    ThreadPool& pool;
+    std::mutex mutex;  // Guards tracks and reprobed while jobs add to them
+    std::vector<TrackInfo> tracks;
+    std::size_t reprobed;
+    const std::unordered_map<std::string, const TrackInfo*>* cache;  // Previous scan, read-only during one
+};
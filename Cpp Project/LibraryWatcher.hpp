@@ -0,0 +1,386 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "LibraryIndex.hpp"
+#include "LibraryScanner.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Reports songs added to or removed from a music folder while the player runs, so the list
+// follows the disk without a rescan. A background thread waits on the OS's change notifications
+// (inotify on Linux, ReadDirectoryChangesW on Windows) and probes new files itself; poll() hands
+// the results to the UI thread. Changes show up a fraction of a second after the file is written.
+//
+// Before following changes the watcher checks a library index against the folder and reports
+// what changed while the player wasn't running, so the player can show the index at once instead
+// of waiting for a scan. It keeps the list of tracks on disk up to date for rewriting the index.
+//
+// Other platforms have no watcher, start() returns false and the library only updates on restart.
+class LibraryWatcher {
+public:
+    struct Change {
+        enum Kind {
+            Added,    // New or rewritten file; track is fully probed
+            Removed   // Only track.path is set, and may be a folder: everything under it is gone
+        };
+
+        Kind kind;
+        TrackInfo track;
+    };
+
+    LibraryWatcher() : running(false), verified(false) {
+#if defined(_WIN32)
+        directory = INVALID_HANDLE_VALUE;
+        stopEvent = nullptr;
+#elif defined(__linux__)
+        descriptor = -1;
+#endif
+    }
+
+    LibraryWatcher(const LibraryWatcher&) = delete;
+    LibraryWatcher& operator=(const LibraryWatcher&) = delete;
+
+    ~LibraryWatcher() {
+        stop();
+    }
+
+    // Starts watching root and everything under it, after reporting how it differs from the
+    // index at indexFile; false if it can't be watched here
+    bool start(const std::string& rootPath, const std::string& indexFile) {
+        stop();
+        root = std::filesystem::u8path(rootPath);
+        indexPath = indexFile;
+        verified = false;
+        tracks.clear();
+#if defined(_WIN32)
+        directory = CreateFileW(root.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (directory == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+#elif defined(__linux__)
+        descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (descriptor < 0) {
+            return false;
+        }
+#else
+        return false;
+#endif
+        running.store(true);
+        thread = std::thread(&LibraryWatcher::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+#if defined(_WIN32)
+        SetEvent(stopEvent);
+        thread.join();
+        CloseHandle(stopEvent);
+        CloseHandle(directory);
+        directory = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+        thread.join();
+        close(descriptor);
+        descriptor = -1;
+        watches.clear();
+#endif
+    }
+
+    // Tracks on disk as of the last change seen; false until the startup check has finished
+    bool getTracks(std::vector<TrackInfo>& result) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (verified) {
+            result = tracks;
+        }
+        return verified;
+    }
+
+    // True if path is removed itself, or lies in the removed folder
+    static bool covers(const std::string& removed, const std::string& path) {
+        if (path.size() > removed.size()) {
+            char separator = path[removed.size()];
+            return (separator == '/' || separator == '\\') && path.compare(0, removed.size(), removed) == 0;
+        }
+        return path == removed;
+    }
+
+    // Moves the changes seen since the last call into changes, returns false if there were none
+    bool poll(std::vector<Change>& changes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.empty()) {
+            return false;
+        }
+        changes.insert(changes.end(), pending.begin(), pending.end());
+        pending.clear();
+        return true;
+    }
+
+private:
+    static constexpr unsigned int verifyThreads = 2;  // Mostly waiting on the disk anyway
+
+    // Queues a change for poll() and applies it to tracks, which stays sorted by path
+    void report(Change::Kind kind, const TrackInfo& track) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(Change{ kind, track });
+        auto byPath = [](const TrackInfo& a, const TrackInfo& b) { return a.path < b.path; };
+        if (kind == Change::Added) {
+            auto it = std::lower_bound(tracks.begin(), tracks.end(), track, byPath);
+            if (it != tracks.end() && it->path == track.path) {
+                *it = track;
+            }
+            else {
+                tracks.insert(it, track);
+            }
+        }
+        else {
+            tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [&](const TrackInfo& known) { return covers(track.path, known.path); }),
+                         tracks.end());
+        }
+    }
+
+    // Rescans the folder against the index and reports the difference, new and rewritten files as added
+    void verify() {
+        std::vector<TrackInfo> known;
+        {
+            LibraryIndex index;
+            if (index.open(indexPath)) {
+                known = index.getTracks();
+            }
+        }
+        std::vector<TrackInfo> found;
+        {
+            // Its own few threads: the player's pool is busy analysing on every core by now, and
+            // the scanner waits for its pool to drain, which on that one would mean the analysis too
+            ThreadPool pool(verifyThreads);
+            LibraryScanner scanner(pool);
+            found = scanner.rescan(root.u8string(), known);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t k = 0;
+        for (const TrackInfo& track : found) {
+            for (; k < known.size() && known[k].path < track.path; ++k) {
+                pending.push_back(Change{ Change::Removed, known[k] });
+            }
+            if (k < known.size() && known[k].path == track.path) {
+                if (known[k].fingerprint != track.fingerprint) {
+                    pending.push_back(Change{ Change::Added, track });
+                }
+                ++k;
+            }
+            else {
+                pending.push_back(Change{ Change::Added, track });
+            }
+        }
+        for (; k < known.size(); ++k) {
+            pending.push_back(Change{ Change::Removed, known[k] });
+        }
+        // Events that arrived during the scan are handled after it, on top of found
+        tracks = found;
+        verified = true;
+    }
+
+    void fileAdded(const std::filesystem::path& path) {
+        TrackInfo track;
+        if (LibraryScanner::isAudioFile(path) && LibraryScanner::probe(path.u8string(), track)) {
+            report(Change::Added, track);
+        }
+    }
+
+    void removed(const std::filesystem::path& path) {
+        TrackInfo track;
+        track.path = path.u8string();
+        report(Change::Removed, track);
+    }
+
+    // A folder appeared (created, or moved in): watch it and report what it already holds,
+    // since files can land in it before its watch exists
+    void folderAdded(const std::filesystem::path& folder) {
+        watch(folder);
+        std::error_code error;
+        std::filesystem::recursive_directory_iterator it(folder, std::filesystem::directory_options::skip_permission_denied, error);
+        for (std::filesystem::recursive_directory_iterator end; !error && it != end; it.increment(error)) {
+            if (it->is_directory(error)) {
+                watch(it->path());
+            }
+            else if (it->is_regular_file(error)) {
+                fileAdded(it->path());
+            }
+            error.clear();
+        }
+    }
+
+#if defined(_WIN32)
+    // One recursive watch on the root covers the whole tree
+    void watch(const std::filesystem::path&) {}
+
+    void run() {
+        alignas(DWORD) char buffer[64 * 1024];
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        HANDLE events[2] = { overlapped.hEvent, stopEvent };
+        const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE;
+        while (ReadDirectoryChangesW(directory, buffer, sizeof(buffer), TRUE, filter, nullptr, &overlapped, nullptr)) {
+            // Changes are recorded from the first read on, so none slip by while checking the index
+            if (!verified) {
+                verify();
+            }
+            DWORD bytes = 0;
+            if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                CancelIoEx(directory, &overlapped);
+                GetOverlappedResult(directory, &overlapped, &bytes, TRUE);  // The buffer must outlive the read
+                break;
+            }
+            GetOverlappedResult(directory, &overlapped, &bytes, FALSE);
+            ResetEvent(overlapped.hEvent);
+            // Zero bytes means the buffer overflowed; those changes are picked up by the next startup scan
+            for (DWORD offset = 0; bytes > 0;) {
+                const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(buffer + offset);
+                std::filesystem::path path = root / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                handle(info->Action, path);
+                if (info->NextEntryOffset == 0) {
+                    break;
+                }
+                offset += info->NextEntryOffset;
+            }
+        }
+        CloseHandle(overlapped.hEvent);
+    }
+
+    void handle(DWORD action, const std::filesystem::path& path) {
+        std::error_code error;
+        switch (action) {
+        case FILE_ACTION_ADDED:
+        case FILE_ACTION_MODIFIED:
+        case FILE_ACTION_RENAMED_NEW_NAME:
+            if (std::filesystem::is_directory(path, error)) {
+                if (action != FILE_ACTION_MODIFIED) {
+                    folderAdded(path);
+                }
+            }
+            else {
+                fileAdded(path);
+            }
+            break;
+        case FILE_ACTION_REMOVED:
+        case FILE_ACTION_RENAMED_OLD_NAME:
+            removed(path);  // Gone, so there's no telling a folder from a file
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::filesystem::path root;
+    HANDLE directory;
+    HANDLE stopEvent;
+#elif defined(__linux__)
+    // inotify isn't recursive, every folder gets its own watch. Folders beyond the system's
+    // watch limit (fs.inotify.max_user_watches) go unwatched.
+    void watch(const std::filesystem::path& folder) {
+        const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+        int wd = inotify_add_watch(descriptor, folder.c_str(), mask);
+        if (wd >= 0) {
+            watches[wd] = folder;  // A folder moved within the tree keeps its watch, under the new path
+        }
+    }
+
+    void run() {
+        // Watches first, so nothing changed during verify() goes unseen
+        watch(root);
+        std::error_code error;
+        std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, error);
+        for (std::filesystem::recursive_directory_iterator end; !error && it != end; it.increment(error)) {
+            if (it->is_directory(error)) {
+                watch(it->path());
+            }
+            error.clear();
+        }
+        verify();
+
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (running.load()) {
+            // Wake up regularly to notice stop()
+            pollfd waiting = { descriptor, POLLIN, 0 };
+            if (::poll(&waiting, 1, 250) <= 0) {
+                continue;
+            }
+            ssize_t length;
+            while ((length = read(descriptor, buffer, sizeof(buffer))) > 0) {
+                for (char* next = buffer; next < buffer + length;) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+                    handle(*event);
+                    next += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+    }
+
+    void handle(const inotify_event& event) {
+        if (event.mask & IN_IGNORED) {
+            watches.erase(event.wd);  // The folder was deleted
+            return;
+        }
+        auto folder = watches.find(event.wd);
+        if (folder == watches.end() || event.len == 0) {
+            return;  // IN_Q_OVERFLOW lands here too; the next startup scan catches what was lost
+        }
+        std::filesystem::path path = folder->second / event.name;
+        if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            if ((event.mask & IN_ISDIR) || LibraryScanner::isAudioFile(path)) {
+                removed(path);
+            }
+        }
+        else if (event.mask & IN_ISDIR) {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                folderAdded(path);
+            }
+        }
+        else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            fileAdded(path);  // Not on IN_CREATE, the file is still being written then
+        }
+    }
+
+    std::filesystem::path root;
+    int descriptor;
+    std::unordered_map<int, std::filesystem::path> watches;  // Watch descriptor to folder, watcher thread only
+#else
+    void watch(const std::filesystem::path&) {}
+
+    void run() {}
+
+    std::filesystem::path root;
+#endif
+
+    std::string indexPath;
+    std::atomic<bool> running;
+    std::thread thread;
+    mutable std::mutex mutex;  // Guards pending, tracks and verified
+    std::vector<Change> pending;
+    std::vector<TrackInfo> tracks;
+    bool verified;
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Resampler.hpp"
+#include "ThreadPool.hpp"
+#include "TrackSource.hpp"
+#include "Waveform.hpp"
+
+// EBU R128 / ITU-R BS.1770 loudness of one signal: K-weighting, 400 ms blocks every 100 ms,
+// gated at -70 LUFS and then 10 LU below the ungated mean. The true peak comes from the
+// signal oversampled 4 times (2 times from 96 kHz up) with the library's resampler.
+class LoudnessMeter {
+public:
+    LoudnessMeter(unsigned int sampleRate, unsigned int channelCount)
+        : channels(channelCount),
+          filters(channelCount),
+          step(sampleRate / 10),
+          stepPosition(0),
+          stepEnergy(channelCount, 0.0),
+          oversampler(sampleRate, sampleRate * (sampleRate < 96000 ? 4 : 2), channelCount, Resampler::Best),
+          peak(0.0f) {
+        designKWeighting(sampleRate);
+
+        // Surround channels of a 5.1 layout count extra, the LFE not at all
+        weights.assign(channels, 1.0);
+        if (channels == 6) {
+            weights[3] = 0.0;
+            weights[4] = weights[5] = 1.41;
+        }
+    }
+
+    // Feeds interleaved frames
+    void add(const float* samples, std::size_t frames) {
+        for (std::size_t i = 0; i < frames; ++i) {
+            for (unsigned int c = 0; c < channels; ++c) {
+                double y = filters[c].process(samples[i * channels + c], shelf, highpass);
+                stepEnergy[c] += y * y;
+            }
+            if (++stepPosition == step) {
+                finishStep();
+            }
+        }
+        oversampler.write(samples, frames);
+        measurePeak();
+    }
+
+    // Call after the last add() so the true peak includes the end of the signal
+    void finish() {
+        oversampler.finish();
+        measurePeak();
+    }
+
+    // Gated loudness in LUFS, -70 for silence
+    double getIntegrated() const {
+        return integrate(blocks);
+    }
+
+    // Highest oversampled sample, in dBTP
+    double getTruePeak() const {
+        return 20.0 * std::log10(std::max(peak, 1e-5f));
+    }
+
+    // Mean square of the 400 ms blocks, K-weighted and summed over channels
+    const std::vector<double>& getBlocks() const {
+        return blocks;
+    }
+
+    // BS.1770 gating over blocks from one or several signals (e.g. a whole album)
+    static double integrate(const std::vector<double>& blockEnergies) {
+        const double absoluteGate = std::pow(10.0, (-70.0 + 0.691) / 10.0);
+        double sum = 0.0;
+        std::size_t count = 0;
+        for (double energy : blockEnergies) {
+            if (energy > absoluteGate) {
+                sum += energy;
+                ++count;
+            }
+        }
+        if (count == 0) {
+            return -70.0;
+        }
+        double relativeGate = sum / count * 0.1;  // -10 LU
+        sum = 0.0;
+        count = 0;
+        for (double energy : blockEnergies) {
+            if (energy > absoluteGate && energy > relativeGate) {
+                sum += energy;
+                ++count;
+            }
+        }
+        return -0.691 + 10.0 * std::log10(sum / count);
+    }
+
+private:
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    // Both K-weighting filters for one channel, in direct form I
+    struct ChannelFilter {
+        double x1 = 0.0, x2 = 0.0, y1 = 0.0, y2 = 0.0;  // Shelf
+        double z1 = 0.0, z2 = 0.0;                      // High-pass, fed by the shelf
+
+        double process(double x, const Biquad& s, const Biquad& h) {
+            double y = s.b0 * x + s.b1 * x1 + s.b2 * x2 - s.a1 * y1 - s.a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            double out = h.b0 * y + z1;
+            z1 = h.b1 * y - h.a1 * out + z2;
+            z2 = h.b2 * y - h.a2 * out;
+            return out;
+        }
+    };
+
+    // The BS.1770 pre-filter (high shelf) and RLB high-pass, recomputed for any sample rate
+    void designKWeighting(unsigned int sampleRate) {
+        const double pi = 3.14159265358979323846;
+        double k = std::tan(pi * 1681.974450955533 / sampleRate);
+        double q = 0.7071752369554196;
+        double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        double vb = std::pow(vh, 0.4996667741545416);
+        double a0 = 1.0 + k / q + k * k;
+        shelf = Biquad{ (vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                        2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0 };
+
+        k = std::tan(pi * 38.13547087602444 / sampleRate);
+        q = 0.5003270373238773;
+        a0 = 1.0 + k / q + k * k;
+        highpass = Biquad{ 1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0 };
+    }
+
+    // Closes a 100 ms step; each block is the last four steps
+    void finishStep() {
+        double energy = 0.0;
+        for (unsigned int c = 0; c < channels; ++c) {
+            energy += weights[c] * stepEnergy[c];
+            stepEnergy[c] = 0.0;
+        }
+        steps.push_back(energy);
+        stepPosition = 0;
+        if (steps.size() >= 4) {
+            std::size_t n = steps.size();
+            blocks.push_back((steps[n - 1] + steps[n - 2] + steps[n - 3] + steps[n - 4]) / (4.0 * step));
+        }
+    }
+
+    void measurePeak() {
+        std::size_t frames;
+        while ((frames = oversampler.read(oversampled, sizeof(oversampled) / sizeof(float) / channels)) > 0) {
+            for (std::size_t i = 0; i < frames * channels; ++i) {
+                peak = std::max(peak, std::fabs(oversampled[i]));
+            }
+        }
+    }
+
+    unsigned int channels;
+    Biquad shelf;
+    Biquad highpass;
+    std::vector<ChannelFilter> filters;
+    std::vector<double> weights;
+    std::size_t step;            // Frames per 100 ms
+    std::size_t stepPosition;
+    std::vector<double> stepEnergy;
+    std::vector<double> steps;   // Weighted energy of every finished step
+    std::vector<double> blocks;
+    Resampler oversampler;
+    float oversampled[4096];
+    float peak;
+};
+
+// Loudness of every track in the library, measured in parallel and kept in a text file so
+// each track is only analyzed once. Gains follow ReplayGain 2.0: tracks are brought to
+// -18 LUFS, albums (the tracks of one folder) by one gain for all of them, and no gain
+// pushes the true peak above -1 dBTP.
+class LoudnessLibrary {
+public:
+    enum Mode {
+        Off,
+        Track,
+        Album
+    };
+
+    struct Entry {
+        double integrated;       // LUFS
+        double truePeak;         // dBTP
+        std::size_t blockCount;  // Gated length, to weight the track within its album
+    };
+
+    explicit LoudnessLibrary(const std::string& storePath) : storePath(storePath), cancelled(false) {}
+
+    // Reads stored results, returns false if there were none
+    bool load() {
+        std::ifstream file(storePath);
+        if (!file) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            Entry entry;
+            std::string path;
+            if (fields >> entry.integrated >> entry.truePeak >> entry.blockCount && std::getline(fields >> std::ws, path) &&
+                entries.count(path) == 0) {  // One measured since startup is newer
+                record(path, entry);
+            }
+        }
+        return true;
+    }
+
+    bool save() const {
+        std::ofstream file(storePath);
+        if (!file) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        file << std::fixed << std::setprecision(2);
+        for (const auto& entry : entries) {
+            file << entry.second.integrated << ' ' << entry.second.truePeak << ' ' << entry.second.blockCount << ' ' << entry.first << '\n';
+        }
+        return static_cast<bool>(file);
+    }
+
+    // Analyzes every path without a stored result, one track per job on pool, and waits for them.
+    // With waveforms, the same decoded blocks also summarize each path whose summary is missing or stale
+    void analyze(const std::vector<std::string>& paths, ThreadPool& pool, WaveformLibrary* waveforms = nullptr) {
+        for (const std::string& path : paths) {
+            if (!has(path) || waveforms) {
+                pool.submit([this, path, waveforms] { analyzeTrack(path, waveforms, false); });
+            }
+        }
+        pool.wait();
+    }
+
+    // Measures path again in a job on pool without waiting, for a track added or rewritten since startup
+    void reanalyze(const std::string& path, ThreadPool& pool, WaveformLibrary* waveforms = nullptr) {
+        pool.submit([this, path, waveforms] { analyzeTrack(path, waveforms, true); });
+    }
+
+    // Makes a running analyze() skip the tracks it hasn't started yet
+    void cancel() {
+        cancelled.store(true);
+    }
+
+    bool has(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.count(path) != 0;
+    }
+
+    // Linear gain for path in mode; 1 for unknown and silent tracks, and never more than maxBoost
+    float getGain(const std::string& path, Mode mode) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(path);
+        if (mode == Off || it == entries.end()) {
+            return 1.0f;
+        }
+        double loudness = it->second.integrated;
+        double peak = it->second.truePeak;
+        if (mode == Album) {
+            // Energy-weighted mean of the album's tracks, which matches gating the pooled blocks
+            // closely without keeping them; the album peak is the loudest track peak
+            const AlbumSums& album = albums.at(folderOf(path));
+            if (album.blocks > 0.0) {
+                loudness = 10.0 * std::log10(album.energy / album.blocks);
+            }
+            peak = std::max(peak, album.peak);
+        }
+        if (loudness <= silence) {
+            return 1.0f;  // Gated out entirely, nothing to level against
+        }
+        double gainDb = std::min(std::min(reference - loudness, -1.0 - peak), maxBoost);
+        return static_cast<float>(std::pow(10.0, gainDb / 20.0));
+    }
+
+private:
+    // ReplayGain 2.0 reference level, in LUFS
+    static constexpr double reference = -18.0;
+    static constexpr double silence = -70.0;  // What the meter reports when every block is gated out
+    static constexpr double maxBoost = 20.0;  // dB; quiet tracks would otherwise lift their noise floor to full scale
+
+    static std::string folderOf(const std::string& path) {
+        std::size_t slash = path.find_last_of("/\\");
+        return (slash == std::string::npos) ? std::string() : path.substr(0, slash);
+    }
+
+    // Decodes path once for whatever it still lacks: a loudness result (always, when remeasure) and,
+    // with waveforms, a summary of the file as it is now
+    void analyzeTrack(const std::string& path, WaveformLibrary* waveforms, bool remeasure) {
+        if (cancelled.load()) {
+            return;
+        }
+        bool measure = remeasure || !has(path);
+        FileFingerprint fingerprint;
+        bool summarize = waveforms && FileFingerprint::read(path, fingerprint) && !waveforms->isCurrent(path, fingerprint);
+        if (!measure && !summarize) {
+            return;
+        }
+        TrackSource source;
+        if (!source.openFromFile(path)) {
+            return;
+        }
+        unsigned int channels = source.getChannelCount();
+        std::unique_ptr<LoudnessMeter> meter(measure ? new LoudnessMeter(source.getSampleRate(), channels) : nullptr);
+        std::unique_ptr<WaveformBuilder> builder(summarize ? new WaveformBuilder(source.getRemainingSamples() / channels, channels) : nullptr);
+        std::vector<float> block(source.getSampleRate() / 10 * channels);
+        std::size_t read;
+        while ((read = source.read(block.data(), block.size())) > 0) {
+            if (meter) {
+                meter->add(block.data(), read / channels);
+            }
+            if (builder) {
+                builder->add(block.data(), read / channels);
+            }
+            if (cancelled.load()) {
+                return;
+            }
+        }
+        if (builder) {
+            waveforms->store(path, fingerprint, builder->finish());
+        }
+        if (!meter) {
+            return;
+        }
+        meter->finish();
+
+        Entry entry;
+        entry.integrated = meter->getIntegrated();
+        entry.truePeak = meter->getTruePeak();
+        entry.blockCount = meter->getBlocks().size();
+        std::lock_guard<std::mutex> lock(mutex);
+        record(path, entry);
+    }
+
+    // Sums of one folder's tracks, kept as they're measured so an album gain is one lookup
+    struct AlbumSums {
+        double energy = 0.0;  // Block-weighted linear loudness
+        double blocks = 0.0;
+        double peak = -100.0;
+    };
+
+    static double energyOf(const Entry& entry) {
+        return entry.blockCount * std::pow(10.0, entry.integrated / 10.0);
+    }
+
+    // Stores entry for path and adds it to its album. Expects the lock held.
+    void record(const std::string& path, const Entry& entry) {
+        std::string folder = folderOf(path);
+        AlbumSums& album = albums[folder];
+        auto it = entries.find(path);
+        if (it != entries.end()) {
+            // Measured twice; take the old result back out
+            album.energy -= energyOf(it->second);
+            album.blocks -= static_cast<double>(it->second.blockCount);
+            bool wasPeak = it->second.truePeak >= album.peak;
+            it->second = entry;
+            if (wasPeak) {
+                album.peak = -100.0;  // Rare, so the folder is simply looked over again
+                for (const auto& other : entries) {
+                    if (folderOf(other.first) == folder) {
+                        album.peak = std::max(album.peak, other.second.truePeak);
+                    }
+                }
+            }
+        }
+        else {
+            entries.emplace(path, entry);
+        }
+        album.energy += energyOf(entry);
+        album.blocks += static_cast<double>(entry.blockCount);
+        album.peak = std::max(album.peak, entry.truePeak);
+    }
+
+    std::string storePath;
+    mutable std::mutex mutex;  // Guards entries and albums, analysis jobs add to them from the pool's threads
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<std::string, AlbumSums> albums;  // By folder
+    std::atomic<bool> cancelled;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. Pages are faulted in by the OS as they're
+// touched, so opening is cheap regardless of size and reads never go through stdio.
+class MappedFile {
+public:
+    MappedFile() : data(nullptr), size(0) {
+#ifdef _WIN32
+        mapping = nullptr;
+#endif
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                size = static_cast<std::size_t>(fileSize.QuadPart);
+            }
+        }
+        CloseHandle(file);  // The mapping keeps its own reference
+        if (!data) {
+            close();
+            return false;
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* view = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                data = static_cast<const char*>(view);
+                size = static_cast<std::size_t>(info.st_size);
+            }
+        }
+        ::close(fd);  // The mapping keeps its own reference
+        if (!data) {
+            return false;
+        }
+#endif
+        adviseSequential();
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        mapping = nullptr;
+#else
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    // Ask the OS to start reading [offset, offset + length) in ahead of use
+    void prefetch(std::size_t offset, std::size_t length) const {
+        if (!data || offset >= size) {
+            return;
+        }
+        if (length > size - offset) {
+            length = size - offset;
+        }
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = const_cast<char*>(data + offset);
+        range.NumberOfBytes = length;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+        // madvise wants a page-aligned start
+        std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t aligned = offset - offset % page;
+        madvise(const_cast<char*>(data + aligned), length + (offset - aligned), MADV_WILLNEED);
+#endif
+    }
+
+    // Getters
+    const char* getData() const {
+        return data;
+    }
+
+    std::size_t getSize() const {
+        return size;
+    }
+
+    bool isOpen() const {
+        return data != nullptr;
+    }
+
+private:
+    // Larger kernel readahead for front-to-back access; Windows has no equivalent for views, prefetch() covers it
+    void adviseSequential() {
+#ifndef _WIN32
+        madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    const char* data;
+    std::size_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+};
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <SFML/System.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "MappedFile.hpp"
+#include "SampleKernels.hpp"
+
+// sf::InputStream over a memory-mapped file. Any SFML reader can use it, and
+// MappedPcmReader recognizes it to read samples straight out of the mapping.
+class MappedInputStream : public sf::InputStream {
+public:
+    MappedInputStream() : position(0) {}
+
+    bool open(const std::string& path) {
+        position = 0;
+        return file.open(path);
+    }
+
+    sf::Int64 read(void* data, sf::Int64 size) override {
+        sf::Int64 count = std::min<sf::Int64>(size, getSize() - position);
+        if (count <= 0) {
+            return 0;
+        }
+        std::memcpy(data, file.getData() + position, static_cast<std::size_t>(count));
+        position += count;
+        return count;
+    }
+
+    sf::Int64 seek(sf::Int64 offset) override {
+        position = std::min<sf::Int64>(std::max<sf::Int64>(offset, 0), getSize());
+        return position;
+    }
+
+    sf::Int64 tell() override {
+        return position;
+    }
+
+    sf::Int64 getSize() override {
+        return static_cast<sf::Int64>(file.getSize());
+    }
+
+    const MappedFile& getFile() const {
+        return file;
+    }
+
+private:
+    MappedFile file;
+    sf::Int64 position;
+};
+
+// Where the samples of an uncompressed WAV or AIFF file live and how they're encoded
+struct PcmLayout {
+    std::size_t dataOffset;
+    std::size_t frameCount;
+    unsigned int channelCount;
+    unsigned int sampleRate;
+    unsigned int bitsPerSample;
+    bool isFloat;
+    bool bigEndian;
+
+    static unsigned int readLE16(const unsigned char* p) {
+        return p[0] | (p[1] << 8);
+    }
+
+    static unsigned int readLE32(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+    }
+
+    static unsigned int readBE16(const unsigned char* p) {
+        return (p[0] << 8) | p[1];
+    }
+
+    static unsigned int readBE32(const unsigned char* p) {
+        return (static_cast<unsigned int>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    // AIFF stores its sample rate as an 80-bit IEEE extended float
+    static double readExtended(const unsigned char* p) {
+        int exponent = ((p[0] & 0x7F) << 8) | p[1];
+        unsigned long long mantissa = 0;
+        for (int i = 2; i < 10; ++i) {
+            mantissa = (mantissa << 8) | p[i];
+        }
+        double value = std::ldexp(static_cast<double>(mantissa), exponent - 16383 - 63);
+        return (p[0] & 0x80) ? -value : value;
+    }
+
+    static bool supported(const PcmLayout& layout) {
+        if (layout.channelCount == 0 || layout.sampleRate == 0) {
+            return false;
+        }
+        if (layout.isFloat) {
+            return layout.bitsPerSample == 32;
+        }
+        return layout.bitsPerSample == 8 || layout.bitsPerSample == 16 || layout.bitsPerSample == 24 || layout.bitsPerSample == 32;
+    }
+
+    static bool parseWav(const unsigned char* data, std::size_t size, PcmLayout& layout) {
+        bool haveFormat = false;
+        std::size_t pos = 12;
+        while (pos + 8 <= size) {
+            const unsigned char* chunk = data + pos;
+            std::size_t chunkSize = readLE32(chunk + 4);
+            if (std::memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16 && pos + 8 + 16 <= size) {
+                unsigned int format = readLE16(chunk + 8);
+                if (format == 0xFFFE && chunkSize >= 40 && pos + 8 + 40 <= size) {
+                    format = readLE16(chunk + 32);  // WAVE_FORMAT_EXTENSIBLE: first two bytes of the subformat GUID
+                }
+                if (format != 1 && format != 3) {
+                    return false;  // Compressed, leave it to SFML
+                }
+                layout.channelCount = readLE16(chunk + 10);
+                layout.sampleRate = readLE32(chunk + 12);
+                layout.bitsPerSample = readLE16(chunk + 22);
+                layout.isFloat = format == 3;
+                layout.bigEndian = false;
+                haveFormat = true;
+            }
+            else if (std::memcmp(chunk, "data", 4) == 0 && haveFormat) {
+                if (!supported(layout)) {
+                    return false;
+                }
+                std::size_t bytes = std::min(chunkSize, size - pos - 8);
+                layout.dataOffset = pos + 8;
+                layout.frameCount = bytes / (layout.bitsPerSample / 8 * layout.channelCount);
+                return true;
+            }
+            pos += 8 + chunkSize + (chunkSize & 1);
+        }
+        return false;
+    }
+
+    static bool parseAiff(const unsigned char* data, std::size_t size, PcmLayout& layout) {
+        bool isAifc = std::memcmp(data + 8, "AIFC", 4) == 0;
+        bool haveFormat = false;
+        std::size_t soundOffset = 0;
+        std::size_t soundBytes = 0;
+        std::size_t pos = 12;
+        while (pos + 8 <= size) {
+            const unsigned char* chunk = data + pos;
+            std::size_t chunkSize = readBE32(chunk + 4);
+            if (std::memcmp(chunk, "COMM", 4) == 0 && chunkSize >= 18 && pos + 8 + 18 <= size) {
+                layout.channelCount = readBE16(chunk + 8);
+                layout.bitsPerSample = readBE16(chunk + 14);
+                layout.sampleRate = static_cast<unsigned int>(readExtended(chunk + 16) + 0.5);
+                layout.isFloat = false;
+                layout.bigEndian = true;
+                if (isAifc && chunkSize >= 22 && pos + 8 + 22 <= size) {
+                    const unsigned char* type = chunk + 26;
+                    if (std::memcmp(type, "sowt", 4) == 0) {
+                        layout.bigEndian = false;
+                    }
+                    else if (std::memcmp(type, "fl32", 4) == 0 || std::memcmp(type, "FL32", 4) == 0) {
+                        layout.isFloat = true;
+                    }
+                    else if (std::memcmp(type, "NONE", 4) != 0) {
+                        return false;
+                    }
+                }
+                haveFormat = true;
+            }
+            else if (std::memcmp(chunk, "SSND", 4) == 0 && chunkSize >= 8 && pos + 16 <= size) {
+                std::size_t skip = readBE32(chunk + 8);
+                soundOffset = pos + 16 + skip;
+                soundBytes = (chunkSize > 8 + skip) ? std::min(chunkSize - 8 - skip, size - std::min(size, soundOffset)) : 0;
+            }
+            pos += 8 + chunkSize + (chunkSize & 1);
+        }
+        if (!haveFormat || soundOffset == 0 || !supported(layout)) {
+            return false;
+        }
+        layout.dataOffset = soundOffset;
+        layout.frameCount = soundBytes / (layout.bitsPerSample / 8 * layout.channelCount);
+        return true;
+    }
+
+    // Recognizes uncompressed RIFF/WAVE and AIFF/AIFC files
+    static bool parse(const char* bytes, std::size_t size, PcmLayout& layout) {
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(bytes);
+        if (!data || size < 12) {
+            return false;
+        }
+        if (std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WAVE", 4) == 0) {
+            return parseWav(data, size, layout);
+        }
+        if (std::memcmp(data, "FORM", 4) == 0 && (std::memcmp(data + 8, "AIFF", 4) == 0 || std::memcmp(data + 8, "AIFC", 4) == 0)) {
+            return parseAiff(data, size, layout);
+        }
+        return false;
+    }
+};
+
+// Reads the samples of an uncompressed WAV or AIFF file straight out of its mapping,
+// either as 16-bit for SFML or as float at the file's full resolution.
+// Seeking is just moving an offset, and upcoming pages are prefetched ahead of the read position.
+class MappedPcmDecoder {
+public:
+    MappedPcmDecoder() : file(nullptr), position(0), sampleCount(0), prefetched(0) {}
+
+    bool open(const MappedInputStream& stream) {
+        if (!PcmLayout::parse(stream.getFile().getData(), stream.getFile().getSize(), layout)) {
+            return false;
+        }
+        file = &stream.getFile();
+        sampleCount = static_cast<sf::Uint64>(layout.frameCount) * layout.channelCount;
+        seek(0);
+        return true;
+    }
+
+    void seek(sf::Uint64 sampleOffset) {
+        position = std::min(sampleOffset, sampleCount);
+        prefetched = position;
+        prefetch();
+    }
+
+    // Reads up to maxCount interleaved samples, wider samples keep their top 16 bits
+    std::size_t read(sf::Int16* samples, std::size_t maxCount) {
+        std::size_t count = static_cast<std::size_t>(std::min<sf::Uint64>(maxCount, sampleCount - position));
+        std::size_t width = layout.bitsPerSample / 8;
+        const unsigned char* in = current();
+
+        if (width == 2 && !layout.bigEndian) {
+            std::memcpy(samples, in, count * 2);
+        }
+        else {
+            for (std::size_t i = 0; i < count; ++i, in += width) {
+                samples[i] = toInt16(in);
+            }
+        }
+        advance(count);
+        return count;
+    }
+
+    // Reads up to maxCount interleaved samples in [-1, 1) without losing any bits of 24-bit sources
+    std::size_t read(float* samples, std::size_t maxCount) {
+        std::size_t count = static_cast<std::size_t>(std::min<sf::Uint64>(maxCount, sampleCount - position));
+        std::size_t width = layout.bitsPerSample / 8;
+        const unsigned char* in = current();
+
+        if (width == 2 && !layout.bigEndian && reinterpret_cast<std::uintptr_t>(in) % 2 == 0) {
+            SampleKernels::get().int16ToFloat(reinterpret_cast<const sf::Int16*>(in), samples, count);
+        }
+        else {
+            for (std::size_t i = 0; i < count; ++i, in += width) {
+                samples[i] = toFloat(in);
+            }
+        }
+        advance(count);
+        return count;
+    }
+
+    // Getters
+    const PcmLayout& getLayout() const {
+        return layout;
+    }
+
+    sf::Uint64 getSampleCount() const {
+        return sampleCount;
+    }
+
+    sf::Uint64 getSampleOffset() const {
+        return position;
+    }
+
+private:
+    // Bytes of sample data requested from the OS ahead of the read position
+    static const std::size_t readahead = 4 * 1024 * 1024;
+
+    const unsigned char* current() const {
+        return reinterpret_cast<const unsigned char*>(file->getData()) + layout.dataOffset + position * (layout.bitsPerSample / 8);
+    }
+
+    void advance(std::size_t count) {
+        position += count;
+        if (position + readahead / (layout.bitsPerSample / 8) / 2 > prefetched) {
+            prefetch();
+        }
+    }
+
+    void prefetch() {
+        std::size_t width = layout.bitsPerSample / 8;
+        std::size_t start = layout.dataOffset + static_cast<std::size_t>(prefetched) * width;
+        file->prefetch(start, readahead);
+        prefetched += readahead / width;
+    }
+
+    // One integer sample of any supported width, left-aligned in 32 bits
+    std::int32_t toInt32(const unsigned char* in) const {
+        std::uint32_t bits;
+        switch (layout.bitsPerSample) {
+        case 8:
+            // WAV stores 8-bit samples unsigned, AIFF signed
+            bits = layout.bigEndian ? static_cast<std::uint32_t>(in[0]) << 24 : static_cast<std::uint32_t>(in[0] ^ 0x80) << 24;
+            break;
+        case 16:
+            bits = (layout.bigEndian ? PcmLayout::readBE16(in) : PcmLayout::readLE16(in)) << 16;
+            break;
+        case 24:
+            bits = layout.bigEndian ? (static_cast<std::uint32_t>(in[0]) << 24) | (in[1] << 16) | (in[2] << 8)
+                                    : (static_cast<std::uint32_t>(in[2]) << 24) | (in[1] << 16) | (in[0] << 8);
+            break;
+        default:
+            bits = layout.bigEndian ? PcmLayout::readBE32(in) : PcmLayout::readLE32(in);
+            break;
+        }
+        return static_cast<std::int32_t>(bits);
+    }
+
+    float readFloat(const unsigned char* in) const {
+        std::uint32_t bits = layout.bigEndian ? PcmLayout::readBE32(in) : PcmLayout::readLE32(in);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    sf::Int16 toInt16(const unsigned char* in) const {
+        if (layout.isFloat) {
+            float value = std::max(-1.0f, std::min(1.0f, readFloat(in)));
+            return static_cast<sf::Int16>(value * 32767.0f);
+        }
+        return static_cast<sf::Int16>(toInt32(in) >> 16);
+    }
+
+    float toFloat(const unsigned char* in) const {
+        if (layout.isFloat) {
+            return readFloat(in);
+        }
+        return static_cast<float>(toInt32(in)) * (1.0f / 2147483648.0f);
+    }
+
+    const MappedFile* file;
+    PcmLayout layout;
+    sf::Uint64 position;
+    sf::Uint64 sampleCount;
+    sf::Uint64 prefetched;  // Sample index up to which readahead has been requested
+};
+
+// SFML reader for uncompressed WAV and AIFF files opened through a MappedInputStream.
+// Samples are converted directly out of the mapping (16-bit little endian is a single memcpy).
+// Register it before any file is opened so it is consulted ahead of SFML's own WAV reader:
+//     sf::SoundFileFactory::registerReader<MappedPcmReader>();
+class MappedPcmReader : public sf::SoundFileReader {
+public:
+    static bool check(sf::InputStream& stream) {
+        MappedInputStream* mapped = dynamic_cast<MappedInputStream*>(&stream);
+        PcmLayout layout;
+        return mapped && PcmLayout::parse(mapped->getFile().getData(), mapped->getFile().getSize(), layout);
+    }
+
+    bool open(sf::InputStream& stream, Info& info) override {
+        MappedInputStream* mapped = dynamic_cast<MappedInputStream*>(&stream);
+        if (!mapped || !decoder.open(*mapped)) {
+            return false;
+        }
+        info.sampleCount = decoder.getSampleCount();
+        info.channelCount = decoder.getLayout().channelCount;
+        info.sampleRate = decoder.getLayout().sampleRate;
+        return true;
+    }
+
+    void seek(sf::Uint64 sampleOffset) override {
+        decoder.seek(sampleOffset);
+    }
+
+    sf::Uint64 read(sf::Int16* samples, sf::Uint64 maxCount) override {
+        return decoder.read(samples, static_cast<std::size_t>(std::min<sf::Uint64>(maxCount, decoder.getSampleCount())));
+    }
+
+private:
+    MappedPcmDecoder decoder;
+};
+
+// sf::Music that reads through a memory mapping. Drop-in for sf::Music::openFromFile.
+class MappedMusic : public sf::Music {
+public:
+    ~MappedMusic() override {
+        stop();  // The streaming thread must be done with the mapping before it goes away
+    }
+
+    bool openFromFile(const std::string& filename) {
+        return stream.open(filename) && openFromStream(stream);
+    }
+
+private:
+    MappedInputStream stream;
+};
@@ -3,6 +3,12 @@
 #include <vector>
 #include <string>
 #include <iostream> // For std::cerr
+#include <memory>
+#include "LibraryIndex.hpp"
+#include "LibraryScanner.hpp"
+#include "MappedSoundFile.hpp"
+#include "PcmCache.hpp"
+#include "ThreadPool.hpp"
 
 struct Button {
     sf::RectangleShape shape;
@@ -11,23 +17,24 @@ struct Button {
 
 class MusicPlayer {
 public:
-    MusicPlayer() : currentTrackIndex(-1), isPlaying(false) {}
+    // Decoded audio is capped at cacheBytes, tracks beyond that are decoded again when replayed
+    explicit MusicPlayer(std::size_t cacheBytes = 256 * 1024 * 1024)
+        : cache(cacheBytes), currentTrackIndex(-1), isPlaying(false) {}
 
-    bool loadMusic(const std::vector<std::string>& tracks) {
-        for (const auto& track : tracks) {
-            sf::SoundBuffer buffer;
-            if (!buffer.loadFromFile(track)) {
-                return false;
-            }
-            soundBuffers.push_back(buffer);
-        }
-        return true;
+    // Nothing is decoded here, each track is decoded the first time it's played
+    void loadMusic(const std::vector<std::string>& tracks) {
+        trackFiles = tracks;
     }
 
     void playTrack(int index) {
-        if (index >= 0 && index < soundBuffers.size()) {
+        if (index >= 0 && index < trackFiles.size()) {
+            std::shared_ptr<const sf::SoundBuffer> buffer = cache.load(trackFiles[index]);
+            if (!buffer) {
+                return;
+            }
             currentTrackIndex = index;
-            music.setBuffer(soundBuffers[currentTrackIndex]);
+            music.setBuffer(*buffer);
+            currentBuffer = buffer;  // Keeps it alive even if the cache evicts it mid-playback
             music.play();
             isPlaying = true;
         }
@@ -45,15 +52,15 @@ public:
     }
 
     void nextTrack() {
-        if (!soundBuffers.empty()) {
-            currentTrackIndex = (currentTrackIndex + 1) % soundBuffers.size();
+        if (!trackFiles.empty()) {
+            currentTrackIndex = (currentTrackIndex + 1) % trackFiles.size();
             playTrack(currentTrackIndex);
         }
     }
 
     void previousTrack() {
-        if (!soundBuffers.empty()) {
-            currentTrackIndex = (currentTrackIndex - 1 + soundBuffers.size()) % soundBuffers.size();
+        if (!trackFiles.empty()) {
+            currentTrackIndex = (currentTrackIndex - 1 + trackFiles.size()) % trackFiles.size();
             playTrack(currentTrackIndex);
         }
     }
@@ -68,8 +75,10 @@ public:
     }
 
 private:
-    sf::Sound music;
-    std::vector<sf::SoundBuffer> soundBuffers;
+    PcmCache cache;
+    std::vector<std::string> trackFiles;
+    std::shared_ptr<const sf::SoundBuffer> currentBuffer;
+    sf::Sound music;  // Declared last so it lets go of its buffer first
     int currentTrackIndex;
     bool isPlaying;
 };
@@ -91,7 +100,20 @@ void createButton(Button& button, const std::string& label, sf::Font& font, sf::
     );
 }
 
-int main() {
+// Every track under root, found on all cores
+std::vector<std::string> scanLibrary(const std::string& root) {
+    sf::Clock clock;
+    ThreadPool pool;
+    std::vector<TrackInfo> tracks = LibraryIndex::refresh("Library.idx", root, pool);  // Unchanged files aren't opened again
+    std::cout << "Found " << tracks.size() << " tracks under " << root << " in "
+              << clock.getElapsedTime().asMilliseconds() << " ms" << std::endl;
+    return LibraryScanner::paths(tracks);
+}
+
+int main(int argc, char* argv[]) {
+    // Read uncompressed tracks straight out of memory-mapped files (must precede any file open)
+    sf::SoundFileFactory::registerReader<MappedPcmReader>();
+
     sf::RenderWindow window(sf::VideoMode(800, 600), "Music Player UI");
 
     sf::Font font;
@@ -102,19 +124,15 @@ int main() {
 
     // Music Player
     MusicPlayer musicPlayer;
-    std::vector<std::string> musicFiles = {
-        "path/to/Aparibhasit.wav",
-        "path/to/High Hopes.wav",
-        "path/to/Otherside.wav"
-    };
-
-    if (!musicPlayer.loadMusic(musicFiles)) {
-        std::cerr << "Error loading music files." << std::endl;
-        return -1;
-    }
+    std::vector<std::string> musicFiles = scanLibrary(argc > 1 ? argv[1] : "Songs");
+
+    musicPlayer.loadMusic(musicFiles);
 
     // Create music title buttons
-    std::vector<std::string> musicTitles = { "Aparibhasit", "High Hopes", "Otherside" };
+    std::vector<std::string> musicTitles;
+    for (const std::string& file : musicFiles) {
+        musicTitles.push_back(std::filesystem::u8path(file).stem().u8string());
+    }
     std::vector<Button> musicButtons(musicTitles.size());
 
     float yOffset = 20;
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "MappedSoundFile.hpp"
+
+// Decoded tracks kept in memory up to a byte budget, least recently used evicted first.
+// Tracks are only decoded when first asked for, so startup cost doesn't grow with the library.
+// Buffers are handed out as shared pointers: one that is evicted while still playing
+// stays alive until its sound lets go of it.
+class PcmCache {
+public:
+    explicit PcmCache(std::size_t byteBudget) : budget(byteBudget), used(0) {}
+
+    PcmCache(const PcmCache&) = delete;
+    PcmCache& operator=(const PcmCache&) = delete;
+
+    // Returns the buffer for path, decoding it if it isn't cached; empty on failure
+    std::shared_ptr<const sf::SoundBuffer> load(const std::string& path) {
+        std::shared_ptr<const sf::SoundBuffer> cached = find(path);
+        if (cached) {
+            return cached;
+        }
+        MappedInputStream stream;
+        std::unique_ptr<sf::SoundBuffer> buffer(new sf::SoundBuffer);
+        if (!stream.open(path) || !buffer->loadFromStream(stream)) {
+            std::cerr << "Error loading " << path << std::endl;
+            return nullptr;
+        }
+        return insert(path, std::move(buffer));
+    }
+
+    // Returns the cached buffer and marks it most recently used; empty if absent
+    std::shared_ptr<const sf::SoundBuffer> find(const std::string& path) {
+        auto it = index.find(path);
+        if (it == index.end()) {
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->buffer;
+    }
+
+    // Takes ownership of a decoded buffer, evicting old entries until it fits.
+    // A buffer larger than the whole budget is returned without being cached.
+    std::shared_ptr<const sf::SoundBuffer> insert(const std::string& path, std::unique_ptr<sf::SoundBuffer> buffer) {
+        erase(path);
+        std::size_t bytes = static_cast<std::size_t>(buffer->getSampleCount()) * sizeof(sf::Int16);
+        std::shared_ptr<const sf::SoundBuffer> shared(std::move(buffer));
+        if (bytes > budget) {
+            return shared;
+        }
+        used += bytes;
+        evict();
+        entries.push_front(Entry{ path, shared, bytes });
+        index[path] = entries.begin();
+        return shared;
+    }
+
+    void erase(const std::string& path) {
+        auto it = index.find(path);
+        if (it != index.end()) {
+            used -= it->second->bytes;
+            entries.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    void setBudget(std::size_t byteBudget) {
+        budget = byteBudget;
+        evict();
+    }
+
+    // Getters
+    std::size_t getBudget() const {
+        return budget;
+    }
+
+    std::size_t getUsedBytes() const {
+        return used;
+    }
+
+    std::size_t getEntryCount() const {
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        std::string path;
+        std::shared_ptr<const sf::SoundBuffer> buffer;
+        std::size_t bytes;
+    };
+
+    // Drops least recently used entries until the budget is respected
+    void evict() {
+        while (used > budget && !entries.empty()) {
+            used -= entries.back().bytes;
+            index.erase(entries.back().path);
+            entries.pop_back();
+        }
+    }
+
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::size_t budget;
+    std::size_t used;
+};
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// The order tracks play in, as track ids (see TrackCatalog::getId()), each at most once, and
+// which of them is current. Kept as a treap ordered by position rather than by key: every node
+// knows the size of its subtree, so looking up, inserting, removing or moving the entry at any
+// position takes O(log n), as does finding the position of a track (nodes link to their parent),
+// and editing a 100k-entry queue costs microseconds where a vector would shift it all along.
+//
+// Tracks queued with playNext() or enqueue() go right after the current one, in the order they
+// were queued, and stay "up next" until played or until another track is picked to play.
+class PlayQueue {
+public:
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    PlayQueue() : root(none), current(0), upNext(0), random(std::random_device()()) {}
+
+    // Replaces the queue with ids, in order, the first one current
+    void assign(const std::vector<std::uint32_t>& ids) {
+        nodes.clear();
+        freeNodes.clear();
+        std::fill(nodeById.begin(), nodeById.end(), none);
+        current = 0;
+        upNext = 0;
+        nodes.reserve(ids.size());
+        for (std::uint32_t id : ids) {
+            if (id < nodeById.size() && nodeById[id] != none) {
+                continue;  // Already queued
+            }
+            nodes.push_back(Node{ none, none, none, 1, static_cast<std::uint32_t>(random()), id });
+            track(id, static_cast<std::uint32_t>(nodes.size() - 1));
+        }
+        root = build(0, nodes.size());
+        if (root != none) {
+            nodes[root].parent = none;
+            heapify(root);
+        }
+    }
+
+    // Puts id at position (clamped to the end), moving it there if it's queued already
+    void insert(std::size_t position, std::uint32_t id) {
+        std::size_t from = find(id);
+        if (from != npos) {
+            move(from, position);
+            return;
+        }
+        position = std::min(position, getCount());
+        std::uint32_t node = allocate(id);
+        attach(node, position);
+        current += (position <= current && getCount() > 1) ? 1 : 0;
+        upNext += (position > current && position <= current + upNext) ? 1 : 0;
+    }
+
+    // Queues id to play after the current track, before anything queued earlier
+    void playNext(std::uint32_t id) {
+        if (getCount() == 0 || at(current) == id) {
+            return;
+        }
+        place(id, current + 1);
+        ++upNext;
+    }
+
+    // Queues id to play after the current track and what was queued before it
+    void enqueue(std::uint32_t id) {
+        if (getCount() == 0 || at(current) == id) {
+            return;
+        }
+        place(id, current + 1 + upNext);
+        ++upNext;
+    }
+
+    // Moves the entry at from to position to (both clamped); the current track stays current
+    void move(std::size_t from, std::size_t to) {
+        std::size_t count = getCount();
+        if (count == 0 || from >= count) {
+            return;
+        }
+        to = std::min(to, count - 1);
+        if (from == to) {
+            return;
+        }
+        bool wasCurrent = from == current;
+        bool wasUpNext = from > current && from <= current + upNext;
+        std::uint32_t node = detach(from);
+        shiftOut(from, wasCurrent);
+        upNext -= wasUpNext ? 1 : 0;
+        attach(node, to);
+        if (wasCurrent) {
+            current = to;
+            upNext = 0;
+        }
+        else {
+            current += (to <= current) ? 1 : 0;
+            upNext += (to > current && to <= current + upNext + 1) ? 1 : 0;
+        }
+    }
+
+    // Takes the entry at position out; when it's the current one, the one before becomes current
+    // so that advancing goes on to the one after
+    void removeAt(std::size_t position) {
+        if (position >= getCount()) {
+            return;
+        }
+        bool wasUpNext = position > current && position <= current + upNext;
+        std::uint32_t node = detach(position);
+        nodeById[nodes[node].id] = none;
+        freeNodes.push_back(node);
+        shiftOut(position, position == current);
+        upNext -= wasUpNext ? 1 : 0;
+    }
+
+    void remove(std::uint32_t id) {
+        std::size_t position = find(id);
+        if (position != npos) {
+            removeAt(position);
+        }
+    }
+
+    // Shuffles the queue, the current track first and current
+    void shuffle() {
+        std::vector<std::uint32_t> ids;
+        toVector(ids);
+        if (ids.empty()) {
+            return;
+        }
+        std::swap(ids[0], ids[current]);
+        std::shuffle(ids.begin() + 1, ids.end(), random);
+        assign(ids);
+    }
+
+    // Makes the entry at position current (clamped); anything queued up next stays where it is
+    void setCurrent(std::size_t position) {
+        current = (getCount() == 0) ? 0 : std::min(position, getCount() - 1);
+        upNext = 0;
+    }
+
+    // Moves current on by steps (back when negative), wrapping around at the ends
+    void advance(long steps) {
+        long count = static_cast<long>(getCount());
+        if (count == 0) {
+            return;
+        }
+        current = static_cast<std::size_t>((static_cast<long>(current) + steps % count + count) % count);
+        upNext = (steps > 0 && static_cast<std::size_t>(steps) < upNext) ? upNext - steps : 0;
+    }
+
+    // Track id at position, which must be below getCount()
+    std::uint32_t at(std::size_t position) const {
+        std::uint32_t node = root;
+        while (true) {
+            std::size_t left = sizeOf(nodes[node].left);
+            if (position == left) {
+                return nodes[node].id;
+            }
+            if (position < left) {
+                node = nodes[node].left;
+            }
+            else {
+                position -= left + 1;
+                node = nodes[node].right;
+            }
+        }
+    }
+
+    // Position of id, or npos if it isn't queued
+    std::size_t find(std::uint32_t id) const {
+        if (id >= nodeById.size() || nodeById[id] == none) {
+            return npos;
+        }
+        std::uint32_t node = nodeById[id];
+        std::size_t position = sizeOf(nodes[node].left);
+        for (std::uint32_t parent = nodes[node].parent; parent != none; node = parent, parent = nodes[node].parent) {
+            if (nodes[parent].right == node) {
+                position += sizeOf(nodes[parent].left) + 1;
+            }
+        }
+        return position;
+    }
+
+    bool contains(std::uint32_t id) const {
+        return id < nodeById.size() && nodeById[id] != none;
+    }
+
+    // Replaces ids with the whole queue, in order
+    void toVector(std::vector<std::uint32_t>& ids) const {
+        ids.clear();
+        ids.reserve(getCount());
+        std::vector<std::uint32_t> path;
+        for (std::uint32_t node = root; node != none || !path.empty();) {
+            if (node != none) {
+                path.push_back(node);
+                node = nodes[node].left;
+                continue;
+            }
+            node = path.back();
+            path.pop_back();
+            ids.push_back(nodes[node].id);
+            node = nodes[node].right;
+        }
+    }
+
+    // Getters
+    std::size_t getCount() const {
+        return sizeOf(root);
+    }
+
+    std::size_t getCurrent() const {
+        return current;
+    }
+
+    // How many entries after the current one were queued to play next
+    std::size_t getUpNext() const {
+        return upNext;
+    }
+
+private:
+    static constexpr std::uint32_t none = 0xFFFFFFFFu;
+
+    struct Node {
+        std::uint32_t left;
+        std::uint32_t right;
+        std::uint32_t parent;
+        std::uint32_t size;      // Of the subtree
+        std::uint32_t priority;  // Parents' are higher
+        std::uint32_t id;
+    };
+
+    std::size_t sizeOf(std::uint32_t node) const {
+        return (node == none) ? 0 : nodes[node].size;
+    }
+
+    // Recounts node's size and points its children back at it
+    void update(std::uint32_t node) {
+        Node& n = nodes[node];
+        n.size = static_cast<std::uint32_t>(1 + sizeOf(n.left) + sizeOf(n.right));
+        if (n.left != none) {
+            nodes[n.left].parent = node;
+        }
+        if (n.right != none) {
+            nodes[n.right].parent = node;
+        }
+    }
+
+    // Splits tree into its first count entries and the rest
+    void split(std::uint32_t tree, std::size_t count, std::uint32_t& first, std::uint32_t& rest) {
+        if (tree == none) {
+            first = rest = none;
+            return;
+        }
+        std::size_t left = sizeOf(nodes[tree].left);
+        if (left < count) {
+            split(nodes[tree].right, count - left - 1, nodes[tree].right, rest);
+            first = tree;
+        }
+        else {
+            split(nodes[tree].left, count, first, nodes[tree].left);
+            rest = tree;
+        }
+        update(tree);
+    }
+
+    // Joins two trees, every entry of first before every entry of second
+    std::uint32_t merge(std::uint32_t first, std::uint32_t second) {
+        if (first == none || second == none) {
+            return (first == none) ? second : first;
+        }
+        if (nodes[first].priority > nodes[second].priority) {
+            nodes[first].right = merge(nodes[first].right, second);
+            update(first);
+            return first;
+        }
+        nodes[second].left = merge(first, nodes[second].left);
+        update(second);
+        return second;
+    }
+
+    // Takes the entry at position out of the tree, returns its node
+    std::uint32_t detach(std::size_t position) {
+        std::uint32_t before, node, after;
+        split(root, position, before, after);
+        split(after, 1, node, after);
+        root = merge(before, after);
+        if (root != none) {
+            nodes[root].parent = none;
+        }
+        return node;
+    }
+
+    // Puts a single node into the tree at position
+    void attach(std::uint32_t node, std::size_t position) {
+        nodes[node].left = nodes[node].right = none;
+        nodes[node].size = 1;
+        std::uint32_t before, after;
+        split(root, position, before, after);
+        root = merge(merge(before, node), after);
+        nodes[root].parent = none;
+    }
+
+    // Keeps current on the same track after the entry at position went; if it was the current
+    // one, the one before takes over, wrapping to the last when it was the first, so advancing
+    // still lands on the one that followed it
+    void shiftOut(std::size_t position, bool wasCurrent) {
+        if (wasCurrent) {
+            current = (current > 0) ? current - 1 : (getCount() > 0 ? getCount() - 1 : 0);
+            upNext = 0;
+        }
+        else if (position < current) {
+            --current;
+        }
+    }
+
+    // Puts id at position, somewhere after the current track, taking it out of wherever it was
+    // first; the caller counts it in upNext
+    void place(std::uint32_t id, std::size_t position) {
+        std::size_t from = find(id);
+        if (from != npos) {
+            removeAt(from);
+            position -= (from < position) ? 1 : 0;
+        }
+        attach(allocate(id), position);
+    }
+
+    std::uint32_t allocate(std::uint32_t id) {
+        std::uint32_t node;
+        if (!freeNodes.empty()) {
+            node = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[node] = Node{ none, none, none, 1, static_cast<std::uint32_t>(random()), id };
+        }
+        else {
+            node = static_cast<std::uint32_t>(nodes.size());
+            nodes.push_back(Node{ none, none, none, 1, static_cast<std::uint32_t>(random()), id });
+        }
+        track(id, node);
+        return node;
+    }
+
+    void track(std::uint32_t id, std::uint32_t node) {
+        if (id >= nodeById.size()) {
+            nodeById.resize(id + std::size_t(1), none);
+        }
+        nodeById[id] = node;
+    }
+
+    // Links nodes [first, last), which are in queue order, into a balanced tree
+    std::uint32_t build(std::size_t first, std::size_t last) {
+        if (first == last) {
+            return none;
+        }
+        std::size_t middle = first + (last - first) / 2;
+        std::uint32_t node = static_cast<std::uint32_t>(middle);
+        nodes[node].left = build(first, middle);
+        nodes[node].right = build(middle + 1, last);
+        update(node);
+        return node;
+    }
+
+    // Moves the priorities around (not the entries) until every parent's is higher than its
+    // children's, children first so each subtree is a heap before its root sifts down
+    void heapify(std::uint32_t node) {
+        if (node == none) {
+            return;
+        }
+        heapify(nodes[node].left);
+        heapify(nodes[node].right);
+        while (true) {
+            std::uint32_t highest = node;
+            for (std::uint32_t child : { nodes[node].left, nodes[node].right }) {
+                if (child != none && nodes[child].priority > nodes[highest].priority) {
+                    highest = child;
+                }
+            }
+            if (highest == node) {
+                return;
+            }
+            std::swap(nodes[node].priority, nodes[highest].priority);
+            node = highest;
+        }
+    }
+
+    std::vector<Node> nodes;
+    std::vector<std::uint32_t> freeNodes;
+    std::vector<std::uint32_t> nodeById;  // none for ids not queued
+    std::uint32_t root;
+    std::size_t current;
+    std::size_t upNext;  // Entries after current that were queued to play next
+    std::mt19937 random;
+};
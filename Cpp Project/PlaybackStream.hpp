@@ -0,0 +1,406 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DspChain.hpp"
+#include "RingBuffer.hpp"
+#include "SampleKernels.hpp"
+#include "TrackSource.hpp"
+
+// Streams a track and carries straight on into the queued next one at the exact
+// sample where the first ends, so consecutive tracks play without a gap or click.
+// The output runs at the first track's sample rate, later tracks at another rate are
+// resampled to it. Tracks with a different channel count can't share the output,
+// in that case the stream ends and the owner starts a new one (see hasEnded()).
+//
+// Decoding runs on a dedicated thread that keeps a lock-free ring buffer topped up;
+// onGetData() only pops from it, so disk I/O never happens on SFML's streaming thread.
+// The decoder only takes the owner's lock to pick up queued tracks and record where
+// tracks begin, never while it reads or decodes, so the owner's calls don't wait on it.
+// Latency is roughly three chunks (SFML's queued buffers), the ring sets how long
+// the decoder may stall before playback underruns.
+//
+// Everything up to the output runs in float: tracks are decoded to float, mixed in float,
+// run through the owner's DspChain and only converted to 16 bits (with TPDF dither)
+// as onGetData() hands a chunk to SFML. The chain runs there rather than in the decoder
+// so volume and EQ changes are heard within a chunk instead of after the ring drains.
+//
+// With a crossfade set, the outgoing and incoming tracks are mixed by the decoder into
+// the same output, both when a track runs out and when the owner skips (crossfadeTo()).
+// A skip is heard once the ring has drained, so it lags by up to the ring length.
+class PlaybackStream : public sf::SoundStream {
+public:
+    explicit PlaybackStream(std::unique_ptr<TrackSource> source,
+                            sf::Time chunkLength = sf::milliseconds(50),
+                            sf::Time ringLength = sf::milliseconds(500))
+        : current(std::move(source)),
+          ring(toSamples(std::max(ringLength, chunkLength * 2.0f), current->getSampleRate(), current->getChannelCount())),
+          chunkLength(chunkLength),
+          repeat(false),
+          ended(false),
+          running(true),
+          underruns(0),
+          samplesWritten(0),
+          trackStart(0),
+          crossfadeSamples(0),
+          fadeLength(0),
+          fadePosition(0),
+          quality(Resampler::Standard),
+          dsp(nullptr),
+          dspBusy(false) {
+        initialize(current->getChannelCount(), current->getSampleRate());
+        output.resize(toSamples(chunkLength, getSampleRate(), getChannelCount()));
+        pending.resize(output.size());
+        SampleKernels::seedDither(dither, 0x9E3779B9u);
+        decoder = std::thread(&PlaybackStream::decode, this);  // Starts filling the ring before play()
+    }
+
+    ~PlaybackStream() override {
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_one();
+        decoder.join();
+    }
+
+    // Queue the track to continue into, replacing any previously queued one
+    void setNext(std::unique_ptr<TrackSource> source) {
+        prepare(*source);
+        std::lock_guard<std::mutex> lock(mutex);
+        next = std::move(source);
+    }
+
+    // Hands back the queued track, e.g. to start it right away on a skip
+    std::unique_ptr<TrackSource> takeNext() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(next);
+    }
+
+    // Path of the queued track, empty if there is none
+    std::string getNextPath() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return next ? next->getPath() : std::string();
+    }
+
+    // True if source can be played by this stream without reinitializing it
+    bool accepts(const TrackSource& source) const {
+        return source.getChannelCount() == getChannelCount();
+    }
+
+    // Filter used for tracks queued from now on whose rate differs from the output
+    void setResampleQuality(Resampler::Quality resampleQuality) {
+        quality = resampleQuality;
+    }
+
+    // Mix the end of each track with the start of the next over this long (0 plays them back to back)
+    void setCrossfade(sf::Time duration) {
+        std::lock_guard<std::mutex> lock(mutex);
+        crossfadeSamples = toSamples(duration, getSampleRate(), getChannelCount());
+    }
+
+    // Fade from whatever is playing into source, which must be accepted by this stream
+    void crossfadeTo(std::unique_ptr<TrackSource> source) {
+        prepare(*source);
+        std::lock_guard<std::mutex> lock(mutex);
+        cut = std::move(source);
+        wake.notify_one();
+    }
+
+    // Run chain, prepared for this stream's format, over every chunk before output; nullptr for none.
+    // Returns once the audio thread is done with the previous chain, which may then be prepared again.
+    void setDsp(DspChain* chain) {
+        dsp.store(chain);
+        while (dspBusy.load()) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Repeat the current track instead of moving on
+    void setRepeat(bool enabled) {
+        repeat.store(enabled);
+    }
+
+    // Number of automatic track transitions that have become audible since the last call.
+    // Decoding runs ahead of playback, so this is what tells the owner the next track really started.
+    // Skips requested through crossfadeTo() aren't counted, the owner already knows about them.
+    int takeTransitions() {
+        sf::Uint64 played = toSamples(getPlayingOffset(), getSampleRate(), getChannelCount());
+        std::lock_guard<std::mutex> lock(mutex);
+        int count = 0;
+        while (!boundaries.empty() && boundaries.front().position <= played) {
+            count += boundaries.front().automatic ? 1 : 0;
+            trackStart = boundaries.front().position;
+            boundaries.pop_front();
+        }
+        return count;
+    }
+
+    // How far into the track being heard playback is, as opposed to getPlayingOffset() which
+    // runs on across gapless transitions and repeats
+    sf::Time getTrackOffset() {
+        sf::Uint64 played = toSamples(getPlayingOffset(), getSampleRate(), getChannelCount());
+        std::lock_guard<std::mutex> lock(mutex);
+        sf::Uint64 start = trackStart;
+        for (const Boundary& boundary : boundaries) {
+            if (boundary.position <= played) {
+                start = boundary.position;
+            }
+        }
+        sf::Uint64 frames = (played > start) ? (played - start) / getChannelCount() : 0;  // Stopped streams report 0
+        return sf::microseconds(static_cast<sf::Int64>(frames * 1000000 / getSampleRate()));
+    }
+
+    // Seeks within the track being heard. Refused in the moment (up to the ring length) after the
+    // decoder has moved on to the next track but before it is heard, as onSeek() would seek that one.
+    bool seekTrack(sf::Time offset) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!boundaries.empty()) {
+                return false;
+            }
+        }
+        setPlayingOffset(offset);
+        return true;
+    }
+
+    // True once decoding ran out because nothing compatible was queued after the track
+    bool hasEnded() const {
+        return ended.load();
+    }
+
+    // Chunks that had to be padded with silence because the decoder fell behind
+    unsigned getUnderrunCount() const {
+        return underruns.load();
+    }
+
+protected:
+    bool onGetData(Chunk& data) override {
+        std::size_t count = ring.read(pending.data(), pending.size());
+        bool finished = false;
+
+        // Wait out a short shortfall (e.g. right after play()) before padding with silence
+        sf::Clock waited;
+        while (count < output.size()) {
+            bool drained = ended.load(std::memory_order_acquire);
+            count += ring.read(pending.data() + count, pending.size() - count);
+            if (count == output.size()) {
+                break;
+            }
+            if (drained) {
+                finished = true;
+                break;
+            }
+            if (waited.getElapsedTime() > chunkLength / 2.0f) {
+                std::fill(pending.begin() + count, pending.end(), 0.0f);
+                count = output.size();
+                ++underruns;
+                break;
+            }
+            sf::sleep(sf::milliseconds(1));
+        }
+
+        // setDsp() waits for the busy flag, so a chain it replaces is never still in use
+        dspBusy.store(true);
+        DspChain* chain = dsp.load();
+        if (chain) {
+            chain->process(pending.data(), count / getChannelCount());
+        }
+        dspBusy.store(false);
+
+        SampleKernels::get().ditherToInt16(pending.data(), output.data(), count, dither);
+        data.samples = output.data();
+        data.sampleCount = count;
+        return !finished;
+    }
+
+    // SFML only seeks with its streaming thread stopped, so the ring can be reset here once the
+    // decoder has finished the block it is on
+    void onSeek(sf::Time timeOffset) override {
+        std::lock_guard<std::mutex> sourceLock(sourceMutex);
+        current->seek(timeOffset);
+        outgoing.reset();
+        ring.clear();
+        samplesWritten = toSamples(timeOffset, getSampleRate(), getChannelCount());
+        ended.store(false);
+        std::lock_guard<std::mutex> lock(mutex);
+        boundaries.clear();
+        trackStart = 0;
+        wake.notify_one();
+    }
+
+private:
+    // Whole frames only, so blocks never split a frame between channels
+    static std::size_t toSamples(sf::Time time, unsigned int sampleRate, unsigned int channelCount) {
+        return static_cast<std::size_t>(static_cast<sf::Uint64>(time.asMicroseconds()) * sampleRate / 1000000 * channelCount);
+    }
+
+    // Converts a track about to be handed to the decoder to the output rate
+    void prepare(TrackSource& source) {
+        if (source.getChannelCount() == getChannelCount()) {
+            source.resampleTo(getSampleRate(), quality);
+        }
+    }
+
+    void decode() {
+        std::vector<float> block(output.size());
+        fadeBlock.resize(output.size());
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!running) {
+                    return;
+                }
+                if ((ended.load() && !cut) || ring.space() < block.size()) {
+                    wake.wait_for(lock, std::chrono::microseconds(chunkLength.asMicroseconds() / 2));
+                    continue;
+                }
+            }
+            // The ring is written under the source lock too, so a seek can't clear it between
+            // decoding a block and writing it
+            std::lock_guard<std::mutex> sourceLock(sourceMutex);
+            std::size_t filled = fill(block);
+            ring.write(block.data(), filled);
+            samplesWritten += filled;
+            ended.store(filled < block.size(), std::memory_order_release);
+        }
+    }
+
+    // Decodes one block of the current track, mixing in the tail of the outgoing one while a crossfade runs
+    std::size_t fill(std::vector<float>& block) {
+        std::unique_ptr<TrackSource> incoming;
+        bool automatic = false;
+        sf::Uint64 fadeSamples;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fadeSamples = crossfadeSamples;
+            if (cut) {
+                incoming = std::move(cut);
+            }
+            else if (!outgoing && fadeSamples > 0 && !repeat.load() && next && next->sameFormat(*current) &&
+                     current->getRemainingSamples() <= fadeSamples) {
+                incoming = std::move(next);
+                automatic = true;
+            }
+            if (incoming) {
+                boundaries.push_back(Boundary{ samplesWritten, automatic });
+            }
+        }
+        if (incoming) {
+            startFade(std::move(incoming), fadeSamples);
+        }
+
+        std::size_t filled = fillCurrent(block);
+        if (outgoing) {
+            std::size_t count = std::min<std::size_t>(block.size(), fadeLength - fadePosition);
+            std::size_t read = outgoing->read(fadeBlock.data(), count);
+            std::fill(fadeBlock.begin() + read, fadeBlock.begin() + count, 0.0f);
+            std::fill(block.begin() + filled, block.begin() + std::max(filled, count), 0.0f);  // Incoming track may be shorter than the fade
+            filled = std::max(filled, count);
+
+            // The ramp advances per interleaved sample rather than per frame, the difference
+            // between channels is a fraction of a step and keeps the kernel a flat loop
+            float step = 1.0f / static_cast<float>(fadeLength);
+            SampleKernels::get().crossfade(block.data(), fadeBlock.data(), count, static_cast<float>(fadePosition) * step, step);
+
+            fadePosition += count;
+            if (fadePosition >= fadeLength) {
+                outgoing.reset();
+            }
+        }
+        return filled;
+    }
+
+    // Makes incoming the current track and fades the old one out over fadeSamples (or what's left of it)
+    void startFade(std::unique_ptr<TrackSource> incoming, sf::Uint64 fadeSamples) {
+        outgoing = std::move(current);
+        current = std::move(incoming);
+        fadeLength = static_cast<std::size_t>(std::min<sf::Uint64>(fadeSamples, outgoing->getRemainingSamples()));
+        fadePosition = 0;
+        if (fadeLength == 0) {
+            outgoing.reset();
+        }
+    }
+
+    // Decodes from the current track, moving on to the next one at the exact sample the current one ends
+    std::size_t fillCurrent(std::vector<float>& block) {
+        std::size_t filled = 0;
+        int emptyReads = 0;
+        while (filled < block.size()) {
+            std::size_t read = current->read(block.data() + filled, block.size() - filled);
+            filled += read;
+            if (filled == block.size()) {
+                break;
+            }
+
+            // A short read means the track is over; guard against sources with nothing in them
+            emptyReads = (read == 0) ? emptyReads + 1 : 0;
+            if (emptyReads > 1) {
+                break;
+            }
+
+            if (repeat.load()) {
+                current->rewind();
+                std::lock_guard<std::mutex> lock(mutex);
+                boundaries.push_back(Boundary{ samplesWritten + filled, false });  // Restarts the track offset, not a transition
+                continue;
+            }
+            std::unique_ptr<TrackSource> following;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (next && next->sameFormat(*current)) {
+                    following = std::move(next);
+                    boundaries.push_back(Boundary{ samplesWritten + filled, true });
+                }
+            }
+            if (!following) {
+                break;
+            }
+            current = std::move(following);  // The finished track is closed outside the lock
+        }
+        return filled;
+    }
+
+    struct Boundary {
+        sf::Uint64 position;  // Stream position (in samples) where a new track begins
+        bool automatic;       // False for skips the owner asked for
+    };
+
+    std::mutex mutex;        // Guards next, cut, boundaries, trackStart, crossfadeSamples and running, held briefly
+    std::mutex sourceMutex;  // Guards current, outgoing, the fade and samplesWritten; held by the decoder a block at a time
+    std::condition_variable wake;
+    std::thread decoder;
+    std::unique_ptr<TrackSource> current;
+    std::unique_ptr<TrackSource> next;
+    std::unique_ptr<TrackSource> cut;       // Requested by crossfadeTo(), picked up by the decoder
+    std::unique_ptr<TrackSource> outgoing;  // Fading out under current
+    RingBuffer<float> ring;
+    std::vector<float> pending;       // Chunk popped from the ring, before conversion
+    std::vector<sf::Int16> output;    // The same chunk as handed to SFML
+    std::vector<float> fadeBlock;
+    std::uint32_t dither[SampleKernels::ditherLanes];
+    std::deque<Boundary> boundaries;
+    sf::Time chunkLength;
+    std::atomic<bool> repeat;
+    std::atomic<bool> ended;
+    bool running;
+    std::atomic<unsigned> underruns;
+    sf::Uint64 samplesWritten;
+    sf::Uint64 trackStart;            // Stream position of the last boundary heard
+    sf::Uint64 crossfadeSamples;
+    std::size_t fadeLength;
+    std::size_t fadePosition;
+    Resampler::Quality quality;  // Only touched by the owner
+    std::atomic<DspChain*> dsp;
+    std::atomic<bool> dspBusy;   // Set while onGetData() runs the chain
+};
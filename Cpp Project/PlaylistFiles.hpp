@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "TrackCatalog.hpp"
+
+// Playlists in the formats other players use: M3U/M3U8, one path per line with optional #EXTINF
+// lines, and PLS, an INI file of FileN= entries. A file is read a chunk at a time and never held
+// whole, and its entries are matched to the library by path a batch at a time: each batch is
+// sorted and looked up in a sorted copy of the library's paths, walking forward from the last
+// match, so a 100k-line playlist goes in well under a second. Relative entries are taken from
+// the playlist's folder; paths compare with either slash, and on Windows in any ASCII case.
+class PlaylistFiles {
+public:
+    // What read() found
+    struct Imported {
+        std::string name;                    // The file's name without its extension
+        std::vector<std::uint32_t> tracks;   // Ids (see TrackCatalog::getId()) of the entries in the library, in order
+        std::size_t missing;                 // Entries that aren't
+    };
+
+    // Reads a .pls file, or any other as M3U; false if it can't be opened
+    static bool read(const std::string& file, const TrackCatalog& catalog, Imported& imported) {
+        LineReader lines(file);
+        if (!lines.isOpen()) {
+            return false;
+        }
+        std::filesystem::path path = std::filesystem::u8path(file);
+        imported.name = path.stem().u8string();
+        imported.tracks.clear();
+        imported.missing = 0;
+        bool pls = lowercase(path.extension().u8string()) == ".pls";
+        std::string folder = std::filesystem::absolute(path).parent_path().u8string();
+        std::string current = std::filesystem::current_path().u8string();
+
+        // The library's paths, as keys, in key order
+        Keys library;
+        std::string scratch;
+        for (std::size_t row = 0; row < catalog.getCount(); ++row) {
+            library.add(catalog.getPath(row), current, row, scratch);
+        }
+        library.sort();
+
+        Keys batch;
+        std::string_view line;
+        while (lines.next(line)) {
+            line = trim(line);
+            if (pls) {
+                // FileN=path; the other keys (TitleN, LengthN, NumberOfEntries, Version) aren't needed
+                std::size_t equals = line.find('=');
+                if (equals == std::string_view::npos || equals < 4 || lowercase(line.substr(0, 4)) != "file") {
+                    continue;
+                }
+                line = trim(line.substr(equals + 1));
+            }
+            if (line.empty() || line.front() == '#') {
+                continue;
+            }
+            batch.add(line, folder, imported.tracks.size(), scratch);
+            imported.tracks.push_back(noId);
+            if (batch.entries.size() == batchSize) {
+                resolve(batch, library, catalog, imported.tracks);
+            }
+        }
+        resolve(batch, library, catalog, imported.tracks);
+
+        std::size_t count = imported.tracks.size();
+        imported.tracks.erase(std::remove(imported.tracks.begin(), imported.tracks.end(), noId), imported.tracks.end());
+        imported.missing = count - imported.tracks.size();
+        return true;
+    }
+
+    // Writes tracks (ids, those gone from the library left out) as PLS to a .pls file, or M3U in
+    // UTF-8 to any other; paths under the file's folder are written relative to it
+    static bool write(const std::string& file, const std::vector<std::uint32_t>& tracks, const TrackCatalog& catalog) {
+        std::filesystem::path path = std::filesystem::u8path(file);
+        bool pls = lowercase(path.extension().u8string()) == ".pls";
+        std::string current = std::filesystem::current_path().u8string();
+        std::string folder;
+        std::string folderKey;
+        normalize(std::filesystem::absolute(path).parent_path().u8string(), false, folder);
+        normalize(folder, true, folderKey);
+
+        std::string temporary = file + ".tmp";
+        {
+            std::ofstream stream(std::filesystem::u8path(temporary), std::ios::binary | std::ios::trunc);
+            std::string out = pls ? "[playlist]\n" : "#EXTM3U\n";
+            std::string scratch;
+            std::string absolute;
+            std::string key;
+            std::size_t written = 0;
+            for (std::uint32_t id : tracks) {
+                std::size_t row = catalog.findId(id);
+                if (row == TrackCatalog::npos) {
+                    continue;
+                }
+                std::string_view trackPath = catalog.getPath(row);
+                scratch.clear();
+                if (!isAbsolute(trackPath)) {
+                    scratch.append(current).append(1, '/');
+                }
+                scratch.append(trackPath);
+                absolute.clear();
+                key.clear();
+                normalize(scratch, false, absolute);
+                normalize(scratch, true, key);  // Same length as absolute, folding only changes case
+                std::string_view shown = absolute;
+                if (key.size() > folderKey.size() && key.compare(0, folderKey.size(), folderKey) == 0 && key[folderKey.size()] == '/') {
+                    shown.remove_prefix(folderKey.size() + 1);
+                }
+
+                std::string_view title = catalog.getTitle(row);
+                std::string_view artist = catalog.getArtist(row);
+                std::string seconds = std::to_string(catalog.getDuration(row).asMilliseconds() / 1000);
+                ++written;
+                if (pls) {
+                    std::string number = std::to_string(written);
+                    out.append("File").append(number).append(1, '=');
+                    appendPath(out, shown);
+                    out.append("\nTitle").append(number).append(1, '=').append(title);
+                    out.append("\nLength").append(number).append(1, '=').append(seconds).append(1, '\n');
+                }
+                else {
+                    out.append("#EXTINF:").append(seconds).append(1, ',');
+                    if (!artist.empty()) {
+                        out.append(artist).append(" - ");
+                    }
+                    out.append(title).append(1, '\n');
+                    appendPath(out, shown);
+                    out.append(1, '\n');
+                }
+                if (out.size() >= chunkBytes) {
+                    stream.write(out.data(), static_cast<std::streamsize>(out.size()));
+                    out.clear();
+                }
+            }
+            if (pls) {
+                out.append("NumberOfEntries=").append(std::to_string(written)).append("\nVersion=2\n");
+            }
+            stream.write(out.data(), static_cast<std::streamsize>(out.size()));
+            if (!stream) {
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(std::filesystem::u8path(temporary), path, error);
+        return !error;
+    }
+
+    // A file name for exporting a playlist called name as M3U8, with characters Windows doesn't
+    // allow in names replaced
+    static std::string fileNameFor(std::string_view name) {
+        std::string file(name.empty() ? std::string_view("Playlist") : name);
+        for (char& c : file) {
+            c = (std::strchr("<>:\"/\\|?*", c) || static_cast<unsigned char>(c) < 32) ? '_' : c;
+        }
+        return file + ".m3u8";
+    }
+
+private:
+    static constexpr std::uint32_t noId = 0xFFFFFFFFu;
+    static constexpr std::size_t chunkBytes = 64 * 1024;
+    static constexpr std::size_t batchSize = 4096;  // Entries looked up together
+
+#ifdef _WIN32
+    static constexpr bool foldCase = true;
+    static constexpr char separator = '\\';
+#else
+    static constexpr bool foldCase = false;
+    static constexpr char separator = '/';
+#endif
+
+    // Hands out a file's lines one at a time, through a buffer of a chunk or so; a line is only
+    // valid until the next call. Strips line ends (\n or \r\n) and a UTF-8 byte order mark.
+    class LineReader {
+    public:
+        explicit LineReader(const std::string& file)
+            : stream(std::filesystem::u8path(file), std::ios::binary), buffer(chunkBytes), begin(0), end(0), isDone(false), isFirst(true) {}
+
+        bool isOpen() const {
+            return static_cast<bool>(stream);
+        }
+
+        bool next(std::string_view& line) {
+            while (true) {
+                const char* start = buffer.data() + begin;
+                const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - begin));
+                if (newline || (isDone && begin < end)) {
+                    std::size_t length = newline ? static_cast<std::size_t>(newline - start) : end - begin;
+                    begin += length + (newline ? 1 : 0);
+                    line = std::string_view(start, length);
+                    if (!line.empty() && line.back() == '\r') {
+                        line.remove_suffix(1);
+                    }
+                    if (isFirst && line.substr(0, 3) == "\xEF\xBB\xBF") {
+                        line.remove_prefix(3);
+                    }
+                    isFirst = false;
+                    return true;
+                }
+                if (isDone) {
+                    return false;
+                }
+
+                // Keep the unfinished line and read on after it
+                std::memmove(buffer.data(), start, end - begin);
+                end -= begin;
+                begin = 0;
+                if (end == buffer.size()) {
+                    buffer.resize(buffer.size() * 2);  // A line longer than the buffer
+                }
+                stream.read(buffer.data() + end, static_cast<std::streamsize>(buffer.size() - end));
+                std::size_t count = static_cast<std::size_t>(stream.gcount());
+                end += count;
+                isDone = count == 0;
+            }
+        }
+
+    private:
+        std::ifstream stream;
+        std::vector<char> buffer;
+        std::size_t begin;   // Unread bytes are [begin, end)
+        std::size_t end;
+        bool isDone;
+        bool isFirst;
+    };
+
+    // Paths made comparable (see normalize()), kept back to back in one string, each with a
+    // number: its row in the library, or its position in the playlist
+    struct Keys {
+        struct Key {
+            std::uint32_t offset;
+            std::uint32_t length;
+            std::size_t number;
+        };
+
+        std::string text;
+        std::vector<Key> entries;
+
+        std::string_view view(const Key& key) const {
+            return std::string_view(text).substr(key.offset, key.length);
+        }
+
+        // Adds path, taken from folder when it's relative
+        void add(std::string_view path, std::string_view folder, std::size_t number, std::string& scratch) {
+            scratch.clear();
+            if (path.substr(0, 7) == "file://") {
+                // A file URL: percent-escapes, and on Windows a slash before the drive
+                path.remove_prefix(7);
+                decodeUrl(path, scratch);
+                if (scratch.size() >= 3 && scratch[0] == '/' && scratch[2] == ':') {
+                    scratch.erase(0, 1);
+                }
+            }
+            else if (isUtf8(path)) {
+                scratch.append(path);
+            }
+            else {
+                appendLatin1(path, scratch);  // Old .m3u files are in the system code page
+            }
+            if (!isAbsolute(scratch)) {
+                scratch.insert(0, 1, '/').insert(0, folder.data(), folder.size());
+            }
+            std::size_t offset = text.size();
+            normalize(scratch, foldCase, text);
+            entries.push_back(Key{ static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(text.size() - offset), number });
+        }
+
+        void sort() {
+            std::sort(entries.begin(), entries.end(), [this](const Key& a, const Key& b) { return view(a) < view(b); });
+        }
+
+        void clear() {
+            text.clear();
+            entries.clear();
+        }
+    };
+
+    // Looks up a batch of playlist entries in the library, setting the ids of those found in
+    // tracks, and empties the batch
+    static void resolve(Keys& batch, const Keys& library, const TrackCatalog& catalog, std::vector<std::uint32_t>& tracks) {
+        batch.sort();
+        auto from = library.entries.begin();
+        for (const Keys::Key& entry : batch.entries) {
+            std::string_view key = batch.view(entry);
+            from = std::lower_bound(from, library.entries.end(), key, [&library](const Keys::Key& k, std::string_view v) { return library.view(k) < v; });
+            if (from != library.entries.end() && library.view(*from) == key) {
+                tracks[entry.number] = catalog.getId(from->number);
+            }
+        }
+        batch.clear();
+    }
+
+    static bool isSlash(char c) {
+        return c == '/' || c == '\\';
+    }
+
+    static bool isAbsolute(std::string_view path) {
+        return (!path.empty() && isSlash(path[0])) || (path.size() >= 2 && path[1] == ':');
+    }
+
+    // Appends path with '/' between its parts, "." and ".." parts worked out and empty ones
+    // dropped, and ASCII letters lowercased if fold is set
+    static void normalize(std::string_view path, bool fold, std::string& out) {
+        std::size_t i = 0;
+        while (i < path.size() && isSlash(path[i])) {
+            if (i < 2) {
+                out.append(1, '/');  // Root, or the start of a network share
+            }
+            ++i;
+        }
+        std::size_t root = out.size();
+        while (i < path.size()) {
+            std::size_t next = i;
+            while (next < path.size() && !isSlash(path[next])) {
+                ++next;
+            }
+            std::string_view part = path.substr(i, next - i);
+            i = next + 1;
+            if (part.empty() || part == ".") {
+                continue;
+            }
+            if (part == "..") {
+                std::size_t slash = out.rfind('/');
+                out.resize((slash == std::string::npos || slash < root) ? root : slash);
+                continue;
+            }
+            if (out.size() > root) {
+                out.append(1, '/');
+            }
+            for (char c : part) {
+                out.append(1, (fold && c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c);
+            }
+        }
+    }
+
+    static void decodeUrl(std::string_view url, std::string& out) {
+        auto digit = [](char c) {
+            return (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        };
+        for (std::size_t i = 0; i < url.size(); ++i) {
+            if (url[i] == '%' && i + 2 < url.size() && digit(url[i + 1]) >= 0 && digit(url[i + 2]) >= 0) {
+                out.append(1, static_cast<char>(digit(url[i + 1]) * 16 + digit(url[i + 2])));
+                i += 2;
+            }
+            else {
+                out.append(1, url[i]);
+            }
+        }
+    }
+
+    static bool isUtf8(std::string_view text) {
+        std::size_t i = 0;
+        while (i < text.size()) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            std::size_t length = (c < 0x80) ? 1 : ((c & 0xE0) == 0xC0) ? 2 : ((c & 0xF0) == 0xE0) ? 3 : ((c & 0xF8) == 0xF0) ? 4 : 0;
+            if (length == 0 || i + length > text.size()) {
+                return false;
+            }
+            for (std::size_t k = 1; k < length; ++k) {
+                if ((static_cast<unsigned char>(text[i + k]) & 0xC0) != 0x80) {
+                    return false;
+                }
+            }
+            i += length;
+        }
+        return true;
+    }
+
+    static void appendLatin1(std::string_view text, std::string& out) {
+        for (char c : text) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (byte < 0x80) {
+                out.append(1, c);
+            }
+            else {
+                out.append(1, static_cast<char>(0xC0 | (byte >> 6)));
+                out.append(1, static_cast<char>(0x80 | (byte & 0x3F)));
+            }
+        }
+    }
+
+    // Appends a path with the platform's separator
+    static void appendPath(std::string& out, std::string_view path) {
+        for (char c : path) {
+            out.append(1, (c == '/') ? separator : c);
+        }
+    }
+
+    static std::string_view trim(std::string_view text) {
+        std::size_t first = text.find_first_not_of(" \t");
+        if (first == std::string_view::npos) {
+            return std::string_view();
+        }
+        return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+    }
+
+    static std::string lowercase(std::string_view text) {
+        std::string lowered(text);
+        for (char& c : lowered) {
+            c = (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+        return lowered;
+    }
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// A named list of track ids (see TrackCatalog::getId()), so entries survive the library being
+// rescanned and moved around; ids no longer in the library stay in place and show as missing.
+// A smart playlist has a rule instead (see SmartRule) and no entries of its own.
+struct Playlist {
+    std::uint32_t id;
+    std::string name;
+    std::vector<std::uint32_t> tracks;
+    std::string rule;
+};
+
+// Every playlist, kept in memory as arrays of track ids and on disk as a log of edits: creating,
+// renaming or deleting a playlist, and inserting or erasing a run of entries, each append one
+// small record, so editing a playlist of tens of thousands of tracks never rewrites the file.
+// Opening replays the log (a run of ids is one copy), and once most of it is edits that were
+// undone or overwritten it is rewritten as one create and one insert per playlist.
+//
+// A record is its payload size (uint32), its kind (uint8) and the payload; fields are in host
+// byte order. A record cut short by a crash is dropped and the file trimmed back to the last
+// whole one.
+class PlaylistStore {
+public:
+    explicit PlaylistStore(const std::string& logPath) : logPath(logPath), nextId(0), logBytes(0) {}
+
+    PlaylistStore(const PlaylistStore&) = delete;
+    PlaylistStore& operator=(const PlaylistStore&) = delete;
+
+    // Replays the log, returns false if there was none (the store starts empty either way)
+    bool open() {
+        playlists.clear();
+        nextId = 0;
+        std::ifstream file(logPath, std::ios::binary);
+        std::vector<char> data;
+        if (file) {
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        file.close();
+        bool found = data.size() >= sizeof(magic) && std::memcmp(data.data(), &magic, sizeof(magic)) == 0;
+
+        std::size_t offset = sizeof(magic);
+        while (found && data.size() - offset >= recordHeader) {
+            std::uint32_t size;
+            std::memcpy(&size, data.data() + offset, sizeof(size));
+            if (data.size() - offset - recordHeader < size) {
+                break;  // Cut short
+            }
+            apply(static_cast<Kind>(data[offset + sizeof(size)]), data.data() + offset + recordHeader, size);
+            offset += recordHeader + size;
+        }
+        logBytes = found ? offset : 0;
+
+        if (!found || logBytes != data.size() || logBytes > 2 * liveBytes() + compactSlack) {
+            compact();
+        }
+        return found;
+    }
+
+    // Adds an empty playlist at the end, returns its id
+    std::uint32_t create(std::string_view name) {
+        std::uint32_t id = nextId;
+        std::string payload;
+        put(payload, id);
+        payload.append(name.begin(), name.end());
+        record(Create, payload);
+        return id;
+    }
+
+    void rename(std::uint32_t playlist, std::string_view name) {
+        std::string payload;
+        put(payload, playlist);
+        payload.append(name.begin(), name.end());
+        record(Rename, payload);
+    }
+
+    // Makes playlist smart, following rule (or plain again when it's empty)
+    void setRule(std::uint32_t playlist, std::string_view rule) {
+        std::string payload;
+        put(payload, playlist);
+        payload.append(rule.begin(), rule.end());
+        record(SetRule, payload);
+    }
+
+    void remove(std::uint32_t playlist) {
+        std::string payload;
+        put(payload, playlist);
+        record(Delete, payload);
+    }
+
+    // Inserts count track ids before position (clamped to the end)
+    void insert(std::uint32_t playlist, std::size_t position, const std::uint32_t* tracks, std::size_t count) {
+        if (count == 0) {
+            return;
+        }
+        std::string payload;
+        put(payload, playlist);
+        put(payload, static_cast<std::uint32_t>(position));
+        payload.append(reinterpret_cast<const char*>(tracks), count * sizeof(std::uint32_t));
+        record(Insert, payload);
+    }
+
+    void append(std::uint32_t playlist, const std::uint32_t* tracks, std::size_t count) {
+        const Playlist* list = find(playlist);
+        insert(playlist, list ? list->tracks.size() : 0, tracks, count);
+    }
+
+    // Erases count entries from position on
+    void erase(std::uint32_t playlist, std::size_t position, std::size_t count) {
+        if (count == 0) {
+            return;
+        }
+        std::string payload;
+        put(payload, playlist);
+        put(payload, static_cast<std::uint32_t>(position));
+        put(payload, static_cast<std::uint32_t>(count));
+        record(Erase, payload);
+    }
+
+    // The playlist with id, or nullptr
+    const Playlist* find(std::uint32_t playlist) const {
+        auto it = std::find_if(playlists.begin(), playlists.end(), [playlist](const Playlist& p) { return p.id == playlist; });
+        return (it != playlists.end()) ? &*it : nullptr;
+    }
+
+    // Getters
+    // In order of creation
+    const std::vector<Playlist>& getPlaylists() const {
+        return playlists;
+    }
+
+    // Id the next create() will hand out
+    std::uint32_t getNextId() const {
+        return nextId;
+    }
+
+    std::size_t getLogBytes() const {
+        return logBytes;
+    }
+
+private:
+    enum Kind {
+        Create,  // id, name
+        Rename,  // id, name
+        Delete,  // id
+        Insert,  // id, position, track ids
+        Erase,   // id, position, count
+        SetRule  // id, rule
+    };
+
+    static constexpr std::uint32_t magic = 0x314C5350;  // "PSL1"
+    static constexpr std::size_t recordHeader = sizeof(std::uint32_t) + 1;
+    static constexpr std::size_t compactSlack = 64 * 1024;  // Logs smaller than this are left alone
+
+    template <typename T>
+    static void put(std::string& payload, const T& value) {
+        payload.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static T take(const char* data, std::size_t offset) {
+        T value;
+        std::memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+
+    Playlist* findMutable(std::uint32_t playlist) {
+        return const_cast<Playlist*>(find(playlist));
+    }
+
+    // Applies one record to the playlists in memory; records that make no sense are skipped
+    void apply(Kind kind, const char* payload, std::size_t size) {
+        if (size < sizeof(std::uint32_t)) {
+            return;
+        }
+        std::uint32_t id = take<std::uint32_t>(payload, 0);
+        const char* rest = payload + sizeof(std::uint32_t);
+        std::size_t restSize = size - sizeof(std::uint32_t);
+        Playlist* playlist = findMutable(id);
+        switch (kind) {
+        case Create:
+            if (!playlist) {
+                playlists.push_back(Playlist{ id, std::string(rest, restSize), {}, {} });
+                nextId = std::max(nextId, id + 1);
+            }
+            break;
+        case Rename:
+            if (playlist) {
+                playlist->name.assign(rest, restSize);
+            }
+            break;
+        case SetRule:
+            if (playlist) {
+                playlist->rule.assign(rest, restSize);
+            }
+            break;
+        case Delete:
+            if (playlist) {
+                playlists.erase(playlists.begin() + (playlist - playlists.data()));
+            }
+            break;
+        case Insert:
+            if (playlist && restSize >= 2 * sizeof(std::uint32_t)) {
+                std::size_t position = std::min<std::size_t>(take<std::uint32_t>(rest, 0), playlist->tracks.size());
+                std::size_t count = (restSize - sizeof(std::uint32_t)) / sizeof(std::uint32_t);
+                auto at = playlist->tracks.insert(playlist->tracks.begin() + position, count, 0);
+                std::memcpy(&*at, rest + sizeof(std::uint32_t), count * sizeof(std::uint32_t));
+            }
+            break;
+        case Erase:
+            if (playlist && restSize >= 2 * sizeof(std::uint32_t)) {
+                std::size_t position = std::min<std::size_t>(take<std::uint32_t>(rest, 0), playlist->tracks.size());
+                std::size_t count = std::min<std::size_t>(take<std::uint32_t>(rest, sizeof(std::uint32_t)), playlist->tracks.size() - position);
+                playlist->tracks.erase(playlist->tracks.begin() + position, playlist->tracks.begin() + position + count);
+            }
+            break;
+        }
+    }
+
+    // Applies a record and appends it to the log
+    void record(Kind kind, const std::string& payload) {
+        apply(kind, payload.data(), payload.size());
+        std::ofstream file(logPath, std::ios::binary | std::ios::app);
+        std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file.put(static_cast<char>(kind));
+        file.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        logBytes += recordHeader + payload.size();
+    }
+
+    // Size of a log holding only what's there now
+    std::size_t liveBytes() const {
+        std::size_t bytes = sizeof(magic);
+        for (const Playlist& playlist : playlists) {
+            bytes += 2 * recordHeader + 3 * sizeof(std::uint32_t) + playlist.name.size() + playlist.tracks.size() * sizeof(std::uint32_t);
+            bytes += playlist.rule.empty() ? 0 : recordHeader + sizeof(std::uint32_t) + playlist.rule.size();
+        }
+        return bytes;
+    }
+
+    // Rewrites the log as one create and one insert (and rule) per playlist, beside the old one and then
+    // swapped in, so a crash never loses the playlists
+    bool compact() {
+        std::string temporary = logPath + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+            auto write = [&file](Kind kind, const std::string& payload) {
+                std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+                file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+                file.put(static_cast<char>(kind));
+                file.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+            };
+            for (const Playlist& playlist : playlists) {
+                std::string payload;
+                put(payload, playlist.id);
+                write(Create, payload + playlist.name);
+                if (!playlist.rule.empty()) {
+                    write(SetRule, payload + playlist.rule);
+                }
+                put(payload, static_cast<std::uint32_t>(0));
+                payload.append(reinterpret_cast<const char*>(playlist.tracks.data()), playlist.tracks.size() * sizeof(std::uint32_t));
+                write(Insert, payload);
+            }
+            if (!file) {
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, logPath, error);
+        logBytes = error ? logBytes : liveBytes();
+        return !error;
+    }
+
+    std::string logPath;
+    std::vector<Playlist> playlists;
+    std::uint32_t nextId;   // Not reused within a log, so a record for a deleted playlist can't hit a newer one
+    std::size_t logBytes;
+};
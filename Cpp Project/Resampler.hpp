@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "SampleKernels.hpp"
+
+// Converts interleaved float audio from one sample rate to another with a polyphase windowed-sinc filter.
+// The rate ratio is reduced to up/down (44.1 -> 48 kHz is 160/147) and every output sample is a dot
+// product of one of the up phases of the filter with the input around it, so no work is spent on
+// samples that would be thrown away. Ratios with more than maxPhases phases use the nearest phase.
+//
+// Input is pushed with write(), output pulled with read(); finish() flushes the tail of the input.
+// Output sample n lines up with input time n * inputRate / outputRate, there is no added delay.
+class Resampler {
+public:
+    enum Quality {
+        Fast,      // 16 taps, about 54 dB of stopband attenuation
+        Standard,  // 32 taps, about 72 dB
+        Best       // 64 taps, about 95 dB
+    };
+
+    Resampler(unsigned int inputRate, unsigned int outputRate, unsigned int channelCount, Quality quality = Standard)
+        : inputRate(inputRate), outputRate(outputRate), channels(channelCount), history(channelCount), first(0), fraction(0) {
+        unsigned int divisor = gcd(inputRate, outputRate);
+        up = outputRate / divisor;
+        down = inputRate / divisor;
+        phases = std::min(up, maxPhases);
+        design(quality);
+        reset();
+    }
+
+    // Forgets all input, e.g. after a seek
+    void reset() {
+        for (std::vector<float>& channel : history) {
+            channel.assign(taps / 2 - 1, 0.0f);  // The first output is centered on the first input sample
+        }
+        first = 0;
+        fraction = 0;
+    }
+
+    void write(const float* samples, std::size_t frames) {
+        std::size_t size = history[0].size();
+        for (std::vector<float>& channel : history) {
+            channel.resize(size + frames);
+        }
+        if (channels == 2) {
+            SampleKernels::get().deinterleave2(samples, history[0].data() + size, history[1].data() + size, frames);
+            return;
+        }
+        for (unsigned int c = 0; c < channels; ++c) {
+            float* out = history[c].data() + size;
+            for (std::size_t i = 0; i < frames; ++i) {
+                out[i] = samples[i * channels + c];
+            }
+        }
+    }
+
+    // Marks the end of the input so its last samples can be read out
+    void finish() {
+        for (std::vector<float>& channel : history) {
+            channel.resize(channel.size() + taps / 2, 0.0f);
+        }
+    }
+
+    // Produces up to maxFrames interleaved frames from the input written so far, returns how many
+    std::size_t read(float* samples, std::size_t maxFrames) {
+        const SampleKernels& kernels = SampleKernels::get();
+        std::size_t size = history[0].size();
+        std::size_t frames = 0;
+        while (frames < maxFrames && first + taps <= size) {
+            std::size_t phase = (phases == up) ? fraction : static_cast<std::size_t>(static_cast<std::uint64_t>(fraction) * phases / up);
+            const float* filter = coefficients.data() + phase * taps;
+            for (unsigned int c = 0; c < channels; ++c) {
+                samples[frames * channels + c] = kernels.dot(history[c].data() + first, filter, taps);
+            }
+            ++frames;
+            fraction += down;
+            first += fraction / up;
+            fraction %= up;
+        }
+
+        // Drop consumed input once it outweighs what's left, so the copy stays cheap
+        if (first > size / 2) {
+            for (std::vector<float>& channel : history) {
+                channel.erase(channel.begin(), channel.begin() + std::min(first, size));
+            }
+            first -= std::min(first, size);
+        }
+        return frames;
+    }
+
+    // Frames read() can produce from the input written so far
+    std::size_t getAvailableFrames() const {
+        std::size_t size = history[0].size();
+        if (first + taps > size) {
+            return 0;
+        }
+        std::uint64_t steps = static_cast<std::uint64_t>(size - taps - first + 1) * up - fraction;
+        return static_cast<std::size_t>((steps + down - 1) / down);
+    }
+
+    // Getters
+    unsigned int getInputRate() const {
+        return inputRate;
+    }
+
+    unsigned int getOutputRate() const {
+        return outputRate;
+    }
+
+    unsigned int getTapCount() const {
+        return taps;
+    }
+
+private:
+    static const unsigned int maxPhases = 1024;
+
+    static unsigned int gcd(unsigned int a, unsigned int b) {
+        while (b != 0) {
+            unsigned int r = a % b;
+            a = b;
+            b = r;
+        }
+        return a;
+    }
+
+    // Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+    static double bessel0(double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 32; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Builds the filter for every phase: a Kaiser-windowed sinc cut off below the lower of the two Nyquist rates.
+    // Downsampling stretches the filter by the rate ratio to keep the transition band the same.
+    void design(Quality quality) {
+        static const unsigned int baseTaps[] = { 16, 32, 64 };
+        static const double cutoffs[] = { 0.80, 0.86, 0.91 };
+        static const double betas[] = { 5.0, 7.0, 9.5 };
+        const double pi = 3.14159265358979323846;
+
+        double ratio = std::min(1.0, static_cast<double>(up) / down);
+        taps = static_cast<unsigned int>(std::ceil(baseTaps[quality] / ratio));
+        taps = (taps + 7) / 8 * 8;  // Whole vectors for the dot product
+        double cutoff = cutoffs[quality] * ratio;
+        double half = taps / 2.0;
+
+        coefficients.resize(static_cast<std::size_t>(phases) * taps);
+        for (unsigned int p = 0; p < phases; ++p) {
+            float* filter = coefficients.data() + static_cast<std::size_t>(p) * taps;
+            double offset = static_cast<double>(p) / phases;
+            double sum = 0.0;
+            for (unsigned int k = 0; k < taps; ++k) {
+                double x = k - (half - 1.0) - offset;  // Distance from the output instant, in input samples
+                double sinc = (x == 0.0) ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+                double w = x / half;
+                double window = (std::fabs(w) < 1.0) ? bessel0(betas[quality] * std::sqrt(1.0 - w * w)) / bessel0(betas[quality]) : 0.0;
+                filter[k] = static_cast<float>(sinc * window);
+                sum += filter[k];
+            }
+            for (unsigned int k = 0; k < taps; ++k) {
+                filter[k] = static_cast<float>(filter[k] / sum);  // Unity gain at DC for every phase
+            }
+        }
+    }
+
+    unsigned int inputRate;
+    unsigned int outputRate;
+    unsigned int channels;
+    unsigned int up;
+    unsigned int down;
+    unsigned int phases;
+    unsigned int taps;
+    std::vector<float> coefficients;         // phases rows of taps
+    std::vector<std::vector<float>> history; // Input per channel, from the first tap of the next output on
+    std::size_t first;                       // Index in history of the first tap for the next output
+    unsigned int fraction;                   // Position of the next output between two inputs, in 1/up steps
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Lock-free single-producer/single-consumer FIFO of samples.
+// One thread may call write(), one other thread may call read(); neither ever blocks.
+// Capacity is rounded up to a power of two so positions wrap with a mask.
+template <typename T>
+class RingBuffer {
+public:
+    explicit RingBuffer(std::size_t capacity) : head(0), tail(0) {
+        std::size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        storage.resize(size);
+        mask = size - 1;
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // Producer side: copies in as many of count items as fit, returns how many
+    std::size_t write(const T* data, std::size_t count) {
+        std::size_t writePos = head.load(std::memory_order_relaxed);
+        std::size_t readPos = tail.load(std::memory_order_acquire);
+        count = std::min(count, storage.size() - (writePos - readPos));
+
+        std::size_t offset = writePos & mask;
+        std::size_t first = std::min(count, storage.size() - offset);
+        std::memcpy(&storage[offset], data, first * sizeof(T));
+        std::memcpy(&storage[0], data + first, (count - first) * sizeof(T));
+
+        head.store(writePos + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side: copies out up to count items, returns how many
+    std::size_t read(T* data, std::size_t count) {
+        std::size_t readPos = tail.load(std::memory_order_relaxed);
+        std::size_t writePos = head.load(std::memory_order_acquire);
+        count = std::min(count, writePos - readPos);
+
+        std::size_t offset = readPos & mask;
+        std::size_t first = std::min(count, storage.size() - offset);
+        std::memcpy(data, &storage[offset], first * sizeof(T));
+        std::memcpy(data + first, &storage[0], (count - first) * sizeof(T));
+
+        tail.store(readPos + count, std::memory_order_release);
+        return count;
+    }
+
+    // Items waiting to be read (exact for the consumer, a lower bound for anyone else)
+    std::size_t available() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // Free slots (exact for the producer, a lower bound for anyone else)
+    std::size_t space() const {
+        return storage.size() - available();
+    }
+
+    std::size_t capacity() const {
+        return storage.size();
+    }
+
+    // Drops everything buffered. Only safe while neither side is running.
+    void clear() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::vector<T> storage;
+    std::size_t mask;
+    std::atomic<std::size_t> head;  // Next slot to write, owned by the producer
+    char padding[64];               // Keeps head and tail off the same cache line
+    std::atomic<std::size_t> tail;  // Next slot to read, owned by the consumer
+};
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SAMPLE_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 instructions inside functions marked for it, MSVC always can
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_TARGET_SSE2 __attribute__((target("sse2")))
+#define KERNEL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KERNEL_TARGET_SSE2
+#define KERNEL_TARGET_AVX2
+#endif
+
+// Sample conversion, interleaving and gain kernels used by the streaming path and the DSP stages.
+// Each instruction set gets its own table; get() picks the best one the CPU supports, once.
+// Floats are in [-1, 1); int16 conversion scales by 32768 and clamps on the way back.
+// Pointers don't need any particular alignment.
+struct SampleKernels {
+    const char* name;
+    void (*int16ToFloat)(const std::int16_t* in, float* out, std::size_t count);
+    void (*floatToInt16)(const float* in, std::int16_t* out, std::size_t count);
+    void (*interleave2)(const float* left, const float* right, float* out, std::size_t frames);
+    void (*deinterleave2)(const float* in, float* left, float* right, std::size_t frames);
+    void (*applyGain)(float* samples, std::size_t count, float gain);
+    void (*applyGainRamp)(float* samples, std::size_t count, float start, float step);  // Gain start + step * i
+    void (*mixAdd)(float* out, const float* in, std::size_t count, float gain);         // out += in * gain
+    void (*crossfade)(float* in, const float* out, std::size_t count, float start, float step);  // Equal power, t = start + step * i
+    void (*clamp)(float* samples, std::size_t count, float limit);
+    // floatToInt16 with TPDF dither of +-1 LSB; state holds ditherLanes xorshift generators
+    void (*ditherToInt16)(const float* in, std::int16_t* out, std::size_t count, std::uint32_t* state);
+    float (*dot)(const float* a, const float* b, std::size_t count);  // Sum of a[i] * b[i], for FIR filters
+
+    static const std::size_t ditherLanes = 8;
+
+    // Gives each dither generator a distinct non-zero starting point
+    static void seedDither(std::uint32_t* state, std::uint32_t seed) {
+        for (std::size_t i = 0; i < ditherLanes; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            state[i] = seed | 1u;
+        }
+    }
+
+    static const SampleKernels& scalar();
+    static const SampleKernels& sse2();
+    static const SampleKernels& avx2();
+
+    // Best kernels for this CPU
+    static const SampleKernels& get() {
+        static const SampleKernels& best = detect();
+        return best;
+    }
+
+    static bool hasSse2();
+    static bool hasAvx2();
+
+private:
+    static const SampleKernels& detect() {
+        if (hasAvx2()) {
+            return avx2();
+        }
+        if (hasSse2()) {
+            return sse2();
+        }
+        return scalar();
+    }
+};
+
+struct ScalarKernels {
+    static void int16ToFloat(const std::int16_t* in, float* out, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = static_cast<float>(in[i]) * (1.0f / 32768.0f);
+        }
+    }
+
+    static void floatToInt16(const float* in, std::int16_t* out, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            float value = std::max(-32768.0f, std::min(32767.0f, in[i] * 32768.0f));
+            out[i] = static_cast<std::int16_t>(std::lrint(value));
+        }
+    }
+
+    static void interleave2(const float* left, const float* right, float* out, std::size_t frames) {
+        for (std::size_t i = 0; i < frames; ++i) {
+            out[2 * i] = left[i];
+            out[2 * i + 1] = right[i];
+        }
+    }
+
+    static void deinterleave2(const float* in, float* left, float* right, std::size_t frames) {
+        for (std::size_t i = 0; i < frames; ++i) {
+            left[i] = in[2 * i];
+            right[i] = in[2 * i + 1];
+        }
+    }
+
+    static void applyGain(float* samples, std::size_t count, float gain) {
+        for (std::size_t i = 0; i < count; ++i) {
+            samples[i] *= gain;
+        }
+    }
+
+    static void applyGainRamp(float* samples, std::size_t count, float start, float step) {
+        for (std::size_t i = 0; i < count; ++i) {
+            samples[i] *= start + step * static_cast<float>(i);
+        }
+    }
+
+    static void mixAdd(float* out, const float* in, std::size_t count, float gain) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] += in[i] * gain;
+        }
+    }
+
+    static void crossfade(float* in, const float* out, std::size_t count, float start, float step) {
+        for (std::size_t i = 0; i < count; ++i) {
+            float t = std::max(0.0f, std::min(1.0f, start + step * static_cast<float>(i)));
+            in[i] = in[i] * std::sqrt(t) + out[i] * std::sqrt(1.0f - t);
+        }
+    }
+
+    static void clamp(float* samples, std::size_t count, float limit) {
+        for (std::size_t i = 0; i < count; ++i) {
+            samples[i] = std::max(-limit, std::min(limit, samples[i]));
+        }
+    }
+
+    // The two 16-bit halves of one xorshift draw are the two uniform variables of the triangular noise
+    static void ditherToInt16(const float* in, std::int16_t* out, std::size_t count, std::uint32_t* state) {
+        std::uint32_t s = state[0];
+        for (std::size_t i = 0; i < count; ++i) {
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            float noise = static_cast<float>((s & 0xFFFF) + (s >> 16)) * (1.0f / 65536.0f) - 1.0f;
+            float value = std::max(-32768.0f, std::min(32767.0f, in[i] * 32768.0f + noise));
+            out[i] = static_cast<std::int16_t>(std::lrint(value));
+        }
+        state[0] = s;
+    }
+
+    static float dot(const float* a, const float* b, std::size_t count) {
+        float sum = 0.0f;
+        for (std::size_t i = 0; i < count; ++i) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+};
+
+#ifdef SAMPLE_KERNELS_X86
+struct Sse2Kernels {
+    KERNEL_TARGET_SSE2 static void int16ToFloat(const std::int16_t* in, float* out, std::size_t count) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);  // Sign-extend by duplicating into the high half
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+        ScalarKernels::int16ToFloat(in + i, out + i, count - i);
+    }
+
+    KERNEL_TARGET_SSE2 static void floatToInt16(const float* in, std::int16_t* out, std::size_t count) {
+        const __m128 scale = _mm_set1_ps(32768.0f);
+        const __m128 low = _mm_set1_ps(-32768.0f);
+        const __m128 high = _mm_set1_ps(32767.0f);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), low), high);
+            __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), low), high);
+            __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+        }
+        ScalarKernels::floatToInt16(in + i, out + i, count - i);
+    }
+
+    KERNEL_TARGET_SSE2 static void interleave2(const float* left, const float* right, float* out, std::size_t frames) {
+        std::size_t i = 0;
+        for (; i + 4 <= frames; i += 4) {
+            __m128 l = _mm_loadu_ps(left + i);
+            __m128 r = _mm_loadu_ps(right + i);
+            _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+        ScalarKernels::interleave2(left + i, right + i, out + 2 * i, frames - i);
+    }
+
+    KERNEL_TARGET_SSE2 static void deinterleave2(const float* in, float* left, float* right, std::size_t frames) {
+        std::size_t i = 0;
+        for (; i + 4 <= frames; i += 4) {
+            __m128 a = _mm_loadu_ps(in + 2 * i);
+            __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+            _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        ScalarKernels::deinterleave2(in + 2 * i, left + i, right + i, frames - i);
+    }
+
+    KERNEL_TARGET_SSE2 static void applyGain(float* samples, std::size_t count, float gain) {
+        const __m128 g = _mm_set1_ps(gain);
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+        }
+        ScalarKernels::applyGain(samples + i, count - i, gain);
+    }
+
+    KERNEL_TARGET_SSE2 static void applyGainRamp(float* samples, std::size_t count, float start, float step) {
+        const __m128 offsets = _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step));
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 g = _mm_add_ps(_mm_set1_ps(start + step * static_cast<float>(i)), offsets);
+            _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+        }
+        ScalarKernels::applyGainRamp(samples + i, count - i, start + step * static_cast<float>(i), step);
+    }
+
+    KERNEL_TARGET_SSE2 static void mixAdd(float* out, const float* in, std::size_t count, float gain) {
+        const __m128 g = _mm_set1_ps(gain);
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+        }
+        ScalarKernels::mixAdd(out + i, in + i, count - i, gain);
+    }
+
+    KERNEL_TARGET_SSE2 static void crossfade(float* in, const float* out, std::size_t count, float start, float step) {
+        const __m128 offsets = _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step));
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 t = _mm_add_ps(_mm_set1_ps(start + step * static_cast<float>(i)), offsets);
+            t = _mm_min_ps(_mm_max_ps(t, zero), one);
+            __m128 mixed = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), _mm_sqrt_ps(t)),
+                                      _mm_mul_ps(_mm_loadu_ps(out + i), _mm_sqrt_ps(_mm_sub_ps(one, t))));
+            _mm_storeu_ps(in + i, mixed);
+        }
+        ScalarKernels::crossfade(in + i, out + i, count - i, start + step * static_cast<float>(i), step);
+    }
+
+    KERNEL_TARGET_SSE2 static void clamp(float* samples, std::size_t count, float limit) {
+        const __m128 high = _mm_set1_ps(limit);
+        const __m128 low = _mm_set1_ps(-limit);
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), low), high));
+        }
+        ScalarKernels::clamp(samples + i, count - i, limit);
+    }
+
+    KERNEL_TARGET_SSE2 static __m128i xorshift(__m128i s) {
+        s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+        s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+        return _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+    }
+
+    KERNEL_TARGET_SSE2 static __m128 triangular(__m128i s) {
+        const __m128i mask = _mm_set1_epi32(0xFFFF);
+        __m128i sum = _mm_add_epi32(_mm_and_si128(s, mask), _mm_srli_epi32(s, 16));
+        return _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(1.0f / 65536.0f)), _mm_set1_ps(1.0f));
+    }
+
+    KERNEL_TARGET_SSE2 static void ditherToInt16(const float* in, std::int16_t* out, std::size_t count, std::uint32_t* state) {
+        const __m128 scale = _mm_set1_ps(32768.0f);
+        const __m128 low = _mm_set1_ps(-32768.0f);
+        const __m128 high = _mm_set1_ps(32767.0f);
+        __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+        __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            s0 = xorshift(s0);
+            s1 = xorshift(s1);
+            __m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), triangular(s0));
+            __m128 b = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), triangular(s1));
+            a = _mm_min_ps(_mm_max_ps(a, low), high);
+            b = _mm_min_ps(_mm_max_ps(b, low), high);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), s0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), s1);
+        ScalarKernels::ditherToInt16(in + i, out + i, count - i, state);
+    }
+
+    KERNEL_TARGET_SSE2 static float dot(const float* a, const float* b, std::size_t count) {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();  // Two accumulators hide the latency of the adds
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        }
+        __m128 sum = _mm_add_ps(sum0, sum1);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum) + ScalarKernels::dot(a + i, b + i, count - i);
+    }
+};
+
+struct Avx2Kernels {
+    KERNEL_TARGET_AVX2 static void int16ToFloat(const std::int16_t* in, float* out, std::size_t count) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+            __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+            _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+        }
+        ScalarKernels::int16ToFloat(in + i, out + i, count - i);
+    }
+
+    KERNEL_TARGET_AVX2 static void floatToInt16(const float* in, std::int16_t* out, std::size_t count) {
+        const __m256 scale = _mm256_set1_ps(32768.0f);
+        const __m256 low = _mm256_set1_ps(-32768.0f);
+        const __m256 high = _mm256_set1_ps(32767.0f);
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), low), high);
+            __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), low), high);
+            // packs works within 128-bit lanes, the permute puts the four quarters back in order
+            __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+            packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+        }
+        ScalarKernels::floatToInt16(in + i, out + i, count - i);
+    }
+
+    KERNEL_TARGET_AVX2 static void interleave2(const float* left, const float* right, float* out, std::size_t frames) {
+        std::size_t i = 0;
+        for (; i + 8 <= frames; i += 8) {
+            __m256 l = _mm256_loadu_ps(left + i);
+            __m256 r = _mm256_loadu_ps(right + i);
+            __m256 lo = _mm256_unpacklo_ps(l, r);  // Frames 0,1 | 4,5
+            __m256 hi = _mm256_unpackhi_ps(l, r);  // Frames 2,3 | 6,7
+            _mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+        ScalarKernels::interleave2(left + i, right + i, out + 2 * i, frames - i);
+    }
+
+    KERNEL_TARGET_AVX2 static void deinterleave2(const float* in, float* left, float* right, std::size_t frames) {
+        const __m256i order = _mm256_set_epi32(7, 6, 3, 2, 5, 4, 1, 0);
+        std::size_t i = 0;
+        for (; i + 8 <= frames; i += 8) {
+            __m256 a = _mm256_loadu_ps(in + 2 * i);
+            __m256 b = _mm256_loadu_ps(in + 2 * i + 8);
+            __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));  // Frames 0,1,4,5 | 2,3,6,7
+            __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm256_storeu_ps(left + i, _mm256_permutevar8x32_ps(l, order));
+            _mm256_storeu_ps(right + i, _mm256_permutevar8x32_ps(r, order));
+        }
+        ScalarKernels::deinterleave2(in + 2 * i, left + i, right + i, frames - i);
+    }
+
+    KERNEL_TARGET_AVX2 static void applyGain(float* samples, std::size_t count, float gain) {
+        const __m256 g = _mm256_set1_ps(gain);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g));
+        }
+        ScalarKernels::applyGain(samples + i, count - i, gain);
+    }
+
+    KERNEL_TARGET_AVX2 static void applyGainRamp(float* samples, std::size_t count, float start, float step) {
+        const __m256 offsets = _mm256_mul_ps(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), _mm256_set1_ps(step));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 g = _mm256_add_ps(_mm256_set1_ps(start + step * static_cast<float>(i)), offsets);
+            _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g));
+        }
+        ScalarKernels::applyGainRamp(samples + i, count - i, start + step * static_cast<float>(i), step);
+    }
+
+    KERNEL_TARGET_AVX2 static void mixAdd(float* out, const float* in, std::size_t count, float gain) {
+        const __m256 g = _mm256_set1_ps(gain);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), g)));
+        }
+        ScalarKernels::mixAdd(out + i, in + i, count - i, gain);
+    }
+
+    KERNEL_TARGET_AVX2 static void crossfade(float* in, const float* out, std::size_t count, float start, float step) {
+        const __m256 offsets = _mm256_mul_ps(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), _mm256_set1_ps(step));
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 t = _mm256_add_ps(_mm256_set1_ps(start + step * static_cast<float>(i)), offsets);
+            t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+            __m256 mixed = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_sqrt_ps(t)),
+                                         _mm256_mul_ps(_mm256_loadu_ps(out + i), _mm256_sqrt_ps(_mm256_sub_ps(one, t))));
+            _mm256_storeu_ps(in + i, mixed);
+        }
+        ScalarKernels::crossfade(in + i, out + i, count - i, start + step * static_cast<float>(i), step);
+    }
+
+    KERNEL_TARGET_AVX2 static void clamp(float* samples, std::size_t count, float limit) {
+        const __m256 high = _mm256_set1_ps(limit);
+        const __m256 low = _mm256_set1_ps(-limit);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(samples + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(samples + i), low), high));
+        }
+        ScalarKernels::clamp(samples + i, count - i, limit);
+    }
+
+    KERNEL_TARGET_AVX2 static __m256i xorshift(__m256i s) {
+        s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+        s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+        return _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+    }
+
+    KERNEL_TARGET_AVX2 static __m256 triangular(__m256i s) {
+        const __m256i mask = _mm256_set1_epi32(0xFFFF);
+        __m256i sum = _mm256_add_epi32(_mm256_and_si256(s, mask), _mm256_srli_epi32(s, 16));
+        return _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sum), _mm256_set1_ps(1.0f / 65536.0f)), _mm256_set1_ps(1.0f));
+    }
+
+    KERNEL_TARGET_AVX2 static void ditherToInt16(const float* in, std::int16_t* out, std::size_t count, std::uint32_t* state) {
+        const __m256 scale = _mm256_set1_ps(32768.0f);
+        const __m256 low = _mm256_set1_ps(-32768.0f);
+        const __m256 high = _mm256_set1_ps(32767.0f);
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state));
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m256i first = xorshift(s);
+            s = xorshift(first);
+            __m256 a = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), triangular(first));
+            __m256 b = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), triangular(s));
+            a = _mm256_min_ps(_mm256_max_ps(a, low), high);
+            b = _mm256_min_ps(_mm256_max_ps(b, low), high);
+            __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+            packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state), s);
+        ScalarKernels::ditherToInt16(in + i, out + i, count - i, state);
+    }
+
+    KERNEL_TARGET_AVX2 static float dot(const float* a, const float* b, std::size_t count) {
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        }
+        if (i + 8 <= count) {
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            i += 8;
+        }
+        __m256 sum8 = _mm256_add_ps(sum0, sum1);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum) + ScalarKernels::dot(a + i, b + i, count - i);
+    }
+};
+#endif
+
+inline const SampleKernels& SampleKernels::scalar() {
+    static const SampleKernels kernels = {
+        "scalar",
+        &ScalarKernels::int16ToFloat, &ScalarKernels::floatToInt16,
+        &ScalarKernels::interleave2, &ScalarKernels::deinterleave2,
+        &ScalarKernels::applyGain, &ScalarKernels::applyGainRamp,
+        &ScalarKernels::mixAdd, &ScalarKernels::crossfade, &ScalarKernels::clamp,
+        &ScalarKernels::ditherToInt16, &ScalarKernels::dot
+    };
+    return kernels;
+}
+
+inline const SampleKernels& SampleKernels::sse2() {
+#ifdef SAMPLE_KERNELS_X86
+    static const SampleKernels kernels = {
+        "sse2",
+        &Sse2Kernels::int16ToFloat, &Sse2Kernels::floatToInt16,
+        &Sse2Kernels::interleave2, &Sse2Kernels::deinterleave2,
+        &Sse2Kernels::applyGain, &Sse2Kernels::applyGainRamp,
+        &Sse2Kernels::mixAdd, &Sse2Kernels::crossfade, &Sse2Kernels::clamp,
+        &Sse2Kernels::ditherToInt16, &Sse2Kernels::dot
+    };
+    return kernels;
+#else
+    return scalar();
+#endif
+}
+
+inline const SampleKernels& SampleKernels::avx2() {
+#ifdef SAMPLE_KERNELS_X86
+    static const SampleKernels kernels = {
+        "avx2",
+        &Avx2Kernels::int16ToFloat, &Avx2Kernels::floatToInt16,
+        &Avx2Kernels::interleave2, &Avx2Kernels::deinterleave2,
+        &Avx2Kernels::applyGain, &Avx2Kernels::applyGainRamp,
+        &Avx2Kernels::mixAdd, &Avx2Kernels::crossfade, &Avx2Kernels::clamp,
+        &Avx2Kernels::ditherToInt16, &Avx2Kernels::dot
+    };
+    return kernels;
+#else
+    return scalar();
+#endif
+}
+
+inline bool SampleKernels::hasSse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;  // Part of the x86-64 baseline
+#elif defined(SAMPLE_KERNELS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#elif defined(SAMPLE_KERNELS_X86)
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+inline bool SampleKernels::hasAvx2() {
+#if defined(SAMPLE_KERNELS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    // The OS must also save the YMM registers on context switches
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesAvx && (info[1] & (1 << 5)) != 0;
+#elif defined(SAMPLE_KERNELS_X86)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "FuzzyKernels.hpp"
+#include "StringPool.hpp"
+#include "TrackCatalog.hpp"
+
+// Type-ahead search over the words of each track's title, artist, album and path. A query
+// matches tracks that have, for every word of the query, some word starting with it.
+//
+// Words are lowercased (ASCII only; other UTF-8 bytes are kept and compared as they are) and
+// split at anything that isn't a letter or digit. Each track is listed under:
+// - every distinct 1, 2 and 3 byte word prefix, so the short queries that match the most tracks
+//   are one lookup into a list built ahead of time;
+// - every whole word, kept in text order, so a longer query word is the small run of words
+//   starting with it.
+// Lists hold track ids (see TrackCatalog::getId()) in increasing order, so words of a query
+// are combined by merging, and tracks are added and removed without rebuilding anything.
+//
+// fuzzySearch() also tolerates typos, comparing each query word with every distinct word by
+// edit distance (see FuzzyKernels). It is meant for a FuzzySearcher's thread and may run while
+// the owner searches; adding or removing tracks waits for it.
+class SearchIndex {
+public:
+    // Per-thread working memory of fuzzySearch()
+    struct FuzzyScratch {
+        std::vector<std::uint8_t> distances;  // By word id
+        std::vector<std::uint8_t> termBest;   // By track id, for the current query word; 255 when unmatched
+        std::vector<std::uint8_t> hits;       // By track id, query words matched so far
+        std::vector<std::uint16_t> totals;    // By track id, summed distances
+        std::vector<std::uint32_t> touched;
+        std::vector<std::uint32_t> candidates;
+    };
+
+    SearchIndex() : wordTracks(1), wordBlocks(FuzzyKernels::blockBytes, 0), wordLengths(FuzzyKernels::blockWords, 0) {}  // Word 0 is the pool's empty string, never a real word
+
+    // Indexes every row of catalog, replacing what was there; faster than adding rows one by one
+    void rebuild(const TrackCatalog& catalog) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        words = StringPool();
+        wordTracks.assign(1, std::vector<std::uint32_t>());
+        wordBlocks.assign(FuzzyKernels::blockBytes, 0);
+        wordLengths.assign(FuzzyKernels::blockWords, 0);
+        prefixTracks.clear();
+        keysById.clear();
+        sortedWords.clear();
+        for (std::size_t row = 0; row < catalog.getCount(); ++row) {
+            index(catalog, row, false);
+        }
+        for (std::vector<std::uint32_t>& tracks : wordTracks) {
+            std::sort(tracks.begin(), tracks.end());
+        }
+        for (auto& prefix : prefixTracks) {
+            std::sort(prefix.second.begin(), prefix.second.end());
+        }
+        sortedWords.resize(wordTracks.size());
+        for (std::uint32_t word = 0; word < sortedWords.size(); ++word) {
+            sortedWords[word] = word;
+        }
+        std::sort(sortedWords.begin(), sortedWords.end(), [this](std::uint32_t a, std::uint32_t b) { return words.view(a) < words.view(b); });
+    }
+
+    // Indexes a row added to the catalog (or whose tags changed, after remove())
+    void add(const TrackCatalog& catalog, std::size_t row) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        index(catalog, row, true);
+    }
+
+    void remove(std::uint32_t id) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (id >= keysById.size()) {
+            return;
+        }
+        for (std::uint32_t word : keysById[id].words) {
+            erase(wordTracks[word], id);
+        }
+        for (std::uint32_t prefix : keysById[id].prefixes) {
+            erase(prefixTracks[prefix], id);
+        }
+        keysById[id] = Keys();
+    }
+
+    // Rows of catalog matching query, in catalog order; every row when query has no words.
+    // Only for the thread that owns the catalog.
+    void search(std::string_view query, const TrackCatalog& catalog, std::vector<std::uint32_t>& rows) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        rows.clear();
+        terms.clear();
+        forEachWord(query, [this](std::string_view word) { terms.emplace_back(word); });
+        unions.resize(std::max(unions.size(), terms.size()));
+        std::vector<const std::vector<std::uint32_t>*> lists;
+        for (std::size_t i = 0; i < terms.size(); ++i) {
+            lists.push_back(&tracksStartingWith(terms[i], unions[i]));
+        }
+        if (lists.empty()) {
+            rows.resize(catalog.getCount());
+            for (std::uint32_t row = 0; row < rows.size(); ++row) {
+                rows[row] = row;
+            }
+            return;
+        }
+
+        // Merge the shortest list first, the running result only shrinks
+        std::sort(lists.begin(), lists.end(), [](const std::vector<std::uint32_t>* a, const std::vector<std::uint32_t>* b) { return a->size() < b->size(); });
+        matches.assign(lists[0]->begin(), lists[0]->end());
+        for (std::size_t i = 1; i < lists.size() && !matches.empty(); ++i) {
+            intersect(*lists[i]);
+        }
+        toRows(matches, nullptr, catalog, rows);
+    }
+
+    // Ids and summed edit distances of the tracks with, for every word of query, a word within a
+    // few typos of starting with it (see maxDistance()). Returns false, with nothing found, if
+    // cancelled() turned true before the end or query has no words.
+    template <typename Cancelled>
+    bool fuzzySearch(std::string_view query, FuzzyScratch& scratch, std::vector<std::uint32_t>& ids,
+                     std::vector<std::uint8_t>& scores, Cancelled cancelled) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        ids.clear();
+        scores.clear();
+        std::vector<std::string> queryWords;
+        forEachWord(query, [&](std::string_view word) {
+            if (queryWords.size() < maxQueryWords) {
+                queryWords.emplace_back(word.substr(0, FuzzyKernels::blockWords));
+            }
+        });
+        if (queryWords.empty()) {
+            return false;
+        }
+        scratch.distances.resize(wordLengths.size());
+        scratch.termBest.resize(keysById.size(), 255);
+        scratch.hits.resize(keysById.size(), 0);
+        scratch.totals.resize(keysById.size(), 0);
+        scratch.candidates.clear();
+
+        bool finished = true;
+        for (std::size_t term = 0; term < queryWords.size() && finished; ++term) {
+            finished = scoreTerm(queryWords[term], term, scratch, cancelled);
+        }
+        for (std::uint32_t id : scratch.candidates) {
+            if (finished && scratch.hits[id] == queryWords.size()) {
+                ids.push_back(id);
+                scores.push_back(static_cast<std::uint8_t>(std::min<std::uint16_t>(scratch.totals[id], 254)));
+            }
+            scratch.hits[id] = 0;
+            scratch.totals[id] = 0;
+        }
+        return finished;
+    }
+
+    // Rows of catalog with the given ids, by increasing score (nullptr for all 0) and then in
+    // catalog order. Ids no longer in catalog are skipped. Only for the thread that owns the catalog.
+    void toRows(const std::vector<std::uint32_t>& ids, const std::uint8_t* scores, const TrackCatalog& catalog, std::vector<std::uint32_t>& rows) {
+        rows.clear();
+        if (ids.empty()) {
+            return;
+        }
+        // Mark each id with its score + 1, walk the id column once (without branching on the
+        // marks, which would mispredict on every other row), unmark
+        std::uint32_t largest = *std::max_element(ids.begin(), ids.end());
+        marks.resize(std::max<std::size_t>({ marks.size(), catalog.getNextId(), largest + std::size_t(1) }), 0);
+        std::uint8_t worst = 0;
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            marks[ids[i]] = scores ? scores[i] + 1 : 1;
+            worst = std::max(worst, marks[ids[i]]);
+        }
+        rows.resize(catalog.getCount() + 1);
+        std::size_t count = 0;
+        for (std::uint32_t row = 0; row < catalog.getCount(); ++row) {
+            rows[count] = row;
+            count += (marks[catalog.getId(row)] != 0);
+        }
+        rows.resize(count);
+
+        // Scores are small, so ordering by them is a counting sort that keeps catalog order within each
+        if (worst > 1) {
+            std::vector<std::size_t> starts(worst + 1, 0);
+            for (std::uint32_t row : rows) {
+                ++starts[marks[catalog.getId(row)]];
+            }
+            std::size_t start = 0;
+            for (std::size_t& bucket : starts) {
+                std::size_t size = bucket;
+                bucket = start;
+                start += size;
+            }
+            merged.resize(rows.size());
+            for (std::uint32_t row : rows) {
+                merged[starts[marks[catalog.getId(row)]]++] = row;
+            }
+            rows.assign(merged.begin(), merged.end());
+        }
+        for (std::uint32_t id : ids) {
+            marks[id] = 0;
+        }
+    }
+
+    // Calls f with each lowercased word of text
+    template <typename F>
+    static void forEachWord(std::string_view text, F f) {
+        std::string word;
+        for (std::size_t i = 0; i <= text.size(); ++i) {
+            unsigned char c = (i < text.size()) ? static_cast<unsigned char>(text[i]) : 0;
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c >= 0x80) {
+                word += static_cast<char>(c);
+            }
+            else if (c >= 'A' && c <= 'Z') {
+                word += static_cast<char>(c - 'A' + 'a');
+            }
+            else if (!word.empty()) {
+                f(std::string_view(word));
+                word.clear();
+            }
+        }
+    }
+
+private:
+    static constexpr std::size_t maxQueryWords = 32;  // Beyond that fuzzySearch() ignores the rest
+
+    // Typos allowed in a query word of length bytes: none while it is too short to tell what was meant
+    static unsigned int maxDistance(std::size_t length) {
+        return (length <= 2) ? 0 : (length <= 5) ? 1 : 2;
+    }
+
+    // Folds one query word into scratch: the tracks that matched every earlier word and match this one
+    // go on with their best distance for it added
+    template <typename Cancelled>
+    bool scoreTerm(const std::string& word, std::size_t term, FuzzyScratch& scratch, Cancelled& cancelled) const {
+        const FuzzyKernels& kernels = FuzzyKernels::get();
+        const std::size_t chunk = 64;  // Blocks between checks for a newer query
+        std::size_t blockCount = wordLengths.size() / FuzzyKernels::blockWords;
+        const std::uint8_t* pattern = reinterpret_cast<const std::uint8_t*>(word.data());
+        for (std::size_t block = 0; block < blockCount; block += chunk) {
+            if (cancelled()) {
+                return false;
+            }
+            std::size_t count = std::min(chunk, blockCount - block);
+            kernels.prefixDistances(pattern, static_cast<unsigned int>(word.size()), wordBlocks.data() + block * FuzzyKernels::blockBytes,
+                                    wordLengths.data() + block * FuzzyKernels::blockWords, count,
+                                    scratch.distances.data() + block * FuzzyKernels::blockWords);
+        }
+
+        // Best distance per track over its words
+        unsigned int limit = maxDistance(word.size());
+        scratch.touched.clear();
+        for (std::uint32_t w = 1; w < wordTracks.size(); ++w) {
+            std::uint8_t distance = scratch.distances[w];
+            if (distance > limit) {
+                continue;
+            }
+            for (std::uint32_t id : wordTracks[w]) {
+                if (scratch.termBest[id] == 255) {
+                    scratch.touched.push_back(id);
+                }
+                scratch.termBest[id] = std::min(scratch.termBest[id], distance);
+            }
+        }
+        for (std::uint32_t id : scratch.touched) {
+            if (scratch.hits[id] == term) {
+                if (term == 0) {
+                    scratch.candidates.push_back(id);
+                }
+                ++scratch.hits[id];
+                scratch.totals[id] += scratch.termBest[id];
+            }
+            scratch.termBest[id] = 255;
+        }
+        return !cancelled();
+    }
+
+    // What a track is listed under, to take it off those lists again
+    struct Keys {
+        std::vector<std::uint32_t> words;
+        std::vector<std::uint32_t> prefixes;
+    };
+
+    // Up to 3 bytes and the length in one integer
+    static std::uint32_t prefixKey(std::string_view word, std::size_t length) {
+        std::uint32_t key = static_cast<std::uint32_t>(length) << 24;
+        for (std::size_t i = 0; i < length; ++i) {
+            key |= static_cast<std::uint32_t>(static_cast<unsigned char>(word[i])) << (16 - 8 * i);
+        }
+        return key;
+    }
+
+    // Keeps the matches that are also in tracks; a much longer list is searched rather than walked
+    void intersect(const std::vector<std::uint32_t>& tracks) {
+        merged.clear();
+        if (matches.size() * 16 < tracks.size()) {
+            auto from = tracks.begin();
+            for (std::uint32_t id : matches) {
+                from = std::lower_bound(from, tracks.end(), id);
+                if (from != tracks.end() && *from == id) {
+                    merged.push_back(id);
+                }
+            }
+        }
+        else {
+            std::set_intersection(matches.begin(), matches.end(), tracks.begin(), tracks.end(), std::back_inserter(merged));
+        }
+        matches.swap(merged);
+    }
+
+    static void erase(std::vector<std::uint32_t>& tracks, std::uint32_t id) {
+        auto it = std::lower_bound(tracks.begin(), tracks.end(), id);
+        if (it != tracks.end() && *it == id) {
+            tracks.erase(it);
+        }
+    }
+
+    // Keeps tracks sorted when sorted is set, otherwise appends for rebuild() to sort once
+    static void insert(std::vector<std::uint32_t>& tracks, std::uint32_t id, bool sorted) {
+        if (!sorted || tracks.empty() || tracks.back() < id) {
+            tracks.push_back(id);
+            return;
+        }
+        auto it = std::lower_bound(tracks.begin(), tracks.end(), id);
+        if (it == tracks.end() || *it != id) {
+            tracks.insert(it, id);
+        }
+    }
+
+    void index(const TrackCatalog& catalog, std::size_t row, bool sorted) {
+        std::uint32_t id = catalog.getId(row);
+        if (id >= keysById.size()) {
+            keysById.resize(id + 1);
+        }
+        Keys& keys = keysById[id];
+        auto addWord = [&](std::string_view word) {
+            std::uint32_t wordId = words.intern(word);
+            if (wordId == wordTracks.size()) {
+                wordTracks.emplace_back();
+                if (wordId % FuzzyKernels::blockWords == 0) {
+                    wordBlocks.resize(wordBlocks.size() + FuzzyKernels::blockBytes, 0);
+                    wordLengths.resize(wordLengths.size() + FuzzyKernels::blockWords, 0);
+                }
+                FuzzyKernels::store(wordBlocks.data(), wordLengths.data(), wordId, word.data(), word.size());
+                if (sorted) {
+                    auto at = std::lower_bound(sortedWords.begin(), sortedWords.end(), word,
+                                               [this](std::uint32_t a, std::string_view b) { return words.view(a) < b; });
+                    sortedWords.insert(at, wordId);
+                }
+            }
+            keys.words.push_back(wordId);
+            for (std::size_t length = 1; length <= std::min<std::size_t>(3, word.size()); ++length) {
+                keys.prefixes.push_back(prefixKey(word, length));
+            }
+        };
+        forEachWord(catalog.getTitle(row), addWord);
+        forEachWord(catalog.getArtist(row), addWord);
+        forEachWord(catalog.getAlbum(row), addWord);
+        forEachWord(catalog.getPath(row), addWord);
+
+        // A track is listed once under each key however often the word appears
+        std::sort(keys.words.begin(), keys.words.end());
+        keys.words.erase(std::unique(keys.words.begin(), keys.words.end()), keys.words.end());
+        std::sort(keys.prefixes.begin(), keys.prefixes.end());
+        keys.prefixes.erase(std::unique(keys.prefixes.begin(), keys.prefixes.end()), keys.prefixes.end());
+        for (std::uint32_t word : keys.words) {
+            insert(wordTracks[word], id, sorted);
+        }
+        for (std::uint32_t prefix : keys.prefixes) {
+            insert(prefixTracks[prefix], id, sorted);
+        }
+    }
+
+    // Ids of tracks with a word starting with word; scratch holds the result when it has to be built
+    const std::vector<std::uint32_t>& tracksStartingWith(std::string_view word, std::vector<std::uint32_t>& scratch) const {
+        scratch.clear();
+        if (word.size() <= 3) {
+            auto it = prefixTracks.find(prefixKey(word, word.size()));
+            return (it == prefixTracks.end()) ? scratch : it->second;
+        }
+        auto first = std::lower_bound(sortedWords.begin(), sortedWords.end(), word,
+                                      [this](std::uint32_t a, std::string_view b) { return words.view(a) < b; });
+        auto last = first;
+        while (last != sortedWords.end() && words.view(*last).substr(0, word.size()) == word) {
+            ++last;
+        }
+        if (last - first == 1) {
+            return wordTracks[*first];  // Usually the query word is most of one word
+        }
+        for (auto it = first; it != last; ++it) {
+            scratch.insert(scratch.end(), wordTracks[*it].begin(), wordTracks[*it].end());
+        }
+        std::sort(scratch.begin(), scratch.end());
+        scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+        return scratch;
+    }
+
+    StringPool words;
+    std::vector<std::vector<std::uint32_t>> wordTracks;                      // By word id
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> prefixTracks;  // By prefixKey()
+    std::vector<std::uint32_t> sortedWords;                                  // Word ids in text order
+    std::vector<Keys> keysById;
+    std::vector<std::uint8_t> wordBlocks;   // Every word, laid out for FuzzyKernels
+    std::vector<std::uint8_t> wordLengths;  // By word id, up to 16
+    mutable std::shared_mutex mutex;        // Guards everything above between the owner and fuzzySearch()
+    // Reused by search() and toRows()
+    std::vector<std::string> terms;
+    std::vector<std::vector<std::uint32_t>> unions;
+    std::vector<std::uint32_t> matches;
+    std::vector<std::uint32_t> merged;
+    std::vector<std::uint8_t> marks;
+};
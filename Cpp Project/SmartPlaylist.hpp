@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "Bitmap.hpp"
+#include "TrackCatalog.hpp"
+#include "TrackStats.hpp"
+
+// A rule picking tracks for a smart playlist: conditions joined by "and", each a field, an
+// operator and a value, e.g.
+//   played > 10 times
+//   added last 30 days
+//   genre = rock and duration < 5 min
+// Fields are played (count, or with "last" the last play), added, artist, album, genre (= and !=,
+// ignoring ASCII case), year, duration (minutes unless given in s/sec) and rate (Hz, or kHz below
+// 1000). Numbers compare with = != < <= > >=; "last N days/weeks/hours" matches times within
+// that long of now.
+class SmartRule {
+public:
+    // What a condition reads, so a change only re-evaluates rules that care about it
+    enum Source {
+        Tags = 1,   // Catalog fields, changed by a rescan
+        Plays = 2,  // Play count and last play, changed by playing
+        Clock = 4   // "last" conditions, which stop holding as time passes
+    };
+
+    // Parses text, returns false (leaving the rule unchanged) if it isn't a rule
+    bool parse(std::string_view text) {
+        std::vector<std::string> words = split(text);
+        std::vector<Condition> parsed;
+        std::size_t i = 0;
+        while (i < words.size()) {
+            Condition condition;
+            if (words.size() - i < 3 || !parseCondition(words, i, condition)) {
+                return false;
+            }
+            parsed.push_back(condition);
+            if (i < words.size() && lowercase(words[i]) != "and") {
+                return false;
+            }
+            i += (i < words.size()) ? 1 : 0;
+        }
+        if (parsed.empty()) {
+            return false;
+        }
+        conditions.swap(parsed);
+        sources = 0;
+        for (const Condition& condition : conditions) {
+            sources |= sourceOf(condition.field);
+        }
+        return true;
+    }
+
+    // Whether the track at row passes every condition. When it does and some condition is a
+    // "last", until is set to when the first of those stops holding (0 otherwise).
+    bool matches(const TrackCatalog& catalog, std::size_t row, const TrackStats& stats, std::int64_t now, std::int64_t& until) const {
+        std::uint32_t id = catalog.getId(row);
+        until = 0;
+        for (const Condition& condition : conditions) {
+            std::int64_t value = 0;
+            switch (condition.field) {
+            case PlayCount:
+                value = stats.getPlayCount(id);
+                break;
+            case LastPlayed:
+                value = stats.getLastPlayed(id);
+                break;
+            case Added:
+                value = stats.getAdded(id);
+                break;
+            case Artist:
+            case Album:
+            case Genre:
+                if (!matchesText(condition, textOf(catalog, row, condition.field))) {
+                    return false;
+                }
+                continue;
+            case Year:
+                value = catalog.getYear(row);
+                break;
+            case Duration:
+                value = catalog.getDuration(row).asMilliseconds() / 1000;
+                break;
+            case SampleRate:
+                value = catalog.getSampleRate(row);
+                break;
+            }
+            if (condition.op == Within) {
+                if (value == 0 || value + condition.number <= now) {
+                    return false;
+                }
+                until = (until == 0) ? value + condition.number : std::min(until, value + condition.number);
+            }
+            else if (!compare(condition.op, value, condition.number)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Getters
+    // Sources (bits) the conditions read
+    int getSources() const {
+        return sources;
+    }
+
+private:
+    enum Field { PlayCount, LastPlayed, Added, Artist, Album, Genre, Year, Duration, SampleRate };
+    enum Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Within };
+
+    struct Condition {
+        Field field;
+        Op op;
+        std::int64_t number;  // Seconds for durations and "last" spans
+        std::string text;     // Lowercased, for the text fields
+    };
+
+    static int sourceOf(Field field) {
+        switch (field) {
+        case PlayCount:
+            return Plays;
+        case LastPlayed:
+            return Plays | Clock;
+        case Added:
+            return Clock;
+        default:
+            return Tags;
+        }
+    }
+
+    static std::string lowercase(std::string_view text) {
+        std::string lowered(text);
+        for (char& c : lowered) {
+            c = (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+        return lowered;
+    }
+
+    // Words split at spaces, a quoted run being one word
+    static std::vector<std::string> split(std::string_view text) {
+        std::vector<std::string> words;
+        std::size_t i = 0;
+        while ((i = text.find_first_not_of(' ', i)) != std::string_view::npos) {
+            std::size_t end = (text[i] == '"') ? text.find('"', i + 1) : text.find(' ', i);
+            end = (end == std::string_view::npos) ? text.size() : end;
+            words.emplace_back(text.substr((text[i] == '"') ? i + 1 : i, end - ((text[i] == '"') ? i + 1 : i)));
+            i = end + 1;
+        }
+        return words;
+    }
+
+    static bool parseNumber(const std::string& word, double& number) {
+        char* end = nullptr;
+        number = std::strtod(word.c_str(), &end);
+        return !word.empty() && end == word.c_str() + word.size();
+    }
+
+    // Reads "field op value [unit]" from words at i, moving i past it
+    static bool parseCondition(const std::vector<std::string>& words, std::size_t& i, Condition& condition) {
+        static const std::unordered_map<std::string, Field> fields = {
+            { "played", PlayCount }, { "plays", PlayCount }, { "added", Added }, { "artist", Artist }, { "album", Album },
+            { "genre", Genre }, { "year", Year }, { "duration", Duration }, { "length", Duration }, { "rate", SampleRate },
+        };
+        static const std::unordered_map<std::string, Op> ops = {
+            { "=", Equal }, { "==", Equal }, { "!=", NotEqual }, { "<", Less }, { "<=", LessEqual },
+            { ">", Greater }, { ">=", GreaterEqual }, { "last", Within },
+        };
+        auto field = fields.find(lowercase(words[i]));
+        auto op = ops.find(lowercase(words[i + 1]));
+        if (field == fields.end() || op == ops.end()) {
+            return false;
+        }
+        condition.field = field->second;
+        condition.op = op->second;
+        i += 2;
+
+        if (condition.field == Artist || condition.field == Album || condition.field == Genre) {
+            // Text runs up to the next "and", so "genre = hip hop" needs no quotes
+            if (condition.op != Equal && condition.op != NotEqual) {
+                return false;
+            }
+            std::string text;
+            for (; i < words.size() && lowercase(words[i]) != "and"; ++i) {
+                text += (text.empty() ? "" : " ") + lowercase(words[i]);
+            }
+            condition.text = text;
+            return true;
+        }
+
+        double number = 0.0;
+        if (!parseNumber(words[i++], number)) {
+            return false;
+        }
+        std::string unit = (i < words.size()) ? lowercase(words[i]) : std::string();
+        double scale = 0.0;
+        if (condition.op == Within) {
+            condition.field = (condition.field == PlayCount) ? LastPlayed : condition.field;
+            if (condition.field != LastPlayed && condition.field != Added) {
+                return false;
+            }
+            scale = (unit == "hour" || unit == "hours") ? 3600.0 : (unit == "day" || unit == "days") ? 86400.0
+                  : (unit == "week" || unit == "weeks") ? 7 * 86400.0 : (unit == "month" || unit == "months") ? 30 * 86400.0 : 0.0;
+            if (scale == 0.0) {
+                return false;
+            }
+        }
+        else if (condition.field == Added) {
+            return false;  // Only "added last ..."
+        }
+        else if (condition.field == Duration) {
+            bool seconds = (unit == "s" || unit == "sec" || unit == "secs" || unit == "seconds");
+            bool minutes = (unit == "m" || unit == "min" || unit == "mins" || unit == "minutes");
+            scale = seconds ? 1.0 : 60.0;
+            unit = (seconds || minutes) ? unit : std::string();
+        }
+        else if (condition.field == SampleRate) {
+            scale = (unit == "hz") ? 1.0 : (unit == "khz" || number < 1000.0) ? 1000.0 : 1.0;
+            unit = (unit == "hz" || unit == "khz") ? unit : std::string();
+        }
+        else {
+            scale = 1.0;
+            unit = (unit == "times" || unit == "time") ? unit : std::string();
+        }
+        i += unit.empty() ? 0 : 1;
+        condition.number = static_cast<std::int64_t>(number * scale + 0.5);
+        return true;
+    }
+
+    static std::string_view textOf(const TrackCatalog& catalog, std::size_t row, Field field) {
+        return (field == Artist) ? catalog.getArtist(row) : (field == Album) ? catalog.getAlbum(row) : catalog.getGenre(row);
+    }
+
+    static bool matchesText(const Condition& condition, std::string_view text) {
+        bool equal = text.size() == condition.text.size() &&
+                     std::equal(text.begin(), text.end(), condition.text.begin(), [](char a, char b) {
+                         return ((a >= 'A' && a <= 'Z') ? a - 'A' + 'a' : a) == b;
+                     });
+        return equal == (condition.op == Equal);
+    }
+
+    static bool compare(Op op, std::int64_t value, std::int64_t number) {
+        switch (op) {
+        case Equal:
+            return value == number;
+        case NotEqual:
+            return value != number;
+        case Less:
+            return value < number;
+        case LessEqual:
+            return value <= number;
+        case Greater:
+            return value > number;
+        case GreaterEqual:
+            return value >= number;
+        default:
+            return false;
+        }
+    }
+
+    std::vector<Condition> conditions;
+    int sources = 0;
+};
+
+// Smart playlists kept up to date as things change, without rerunning their rules over the whole
+// library: a track added or retagged is checked against every rule, a track played only against
+// rules reading play counts, and a removed track is dropped. Rules with "last" conditions queue
+// the moment each member stops qualifying, and tick() re-checks just those tracks when it comes.
+// Members are a Bitmap of track ids per playlist.
+class SmartPlaylists {
+public:
+    // Makes playlist follow rule, checking every track once; false if rule doesn't parse
+    bool define(std::uint32_t playlist, std::string_view rule, const TrackCatalog& catalog, const TrackStats& stats, std::int64_t now) {
+        Entry entry;
+        if (!entry.rule.parse(rule)) {
+            return false;
+        }
+        entries[playlist] = std::move(entry);
+        for (std::size_t row = 0; row < catalog.getCount(); ++row) {
+            check(playlist, entries[playlist], catalog, row, stats, now);
+        }
+        return true;
+    }
+
+    void forget(std::uint32_t playlist) {
+        entries.erase(playlist);
+    }
+
+    // A track was added, or its tags changed
+    void trackChanged(const TrackCatalog& catalog, std::size_t row, const TrackStats& stats, std::int64_t now) {
+        for (auto& entry : entries) {
+            check(entry.first, entry.second, catalog, row, stats, now);
+        }
+    }
+
+    void trackRemoved(std::uint32_t id) {
+        for (auto& entry : entries) {
+            entry.second.members.remove(id);
+            entry.second.isStale = true;
+        }
+    }
+
+    void playCounted(const TrackCatalog& catalog, std::size_t row, const TrackStats& stats, std::int64_t now) {
+        for (auto& entry : entries) {
+            if (entry.second.rule.getSources() & SmartRule::Plays) {
+                check(entry.first, entry.second, catalog, row, stats, now);
+            }
+        }
+    }
+
+    // Re-checks the members whose "last" condition has run out by now
+    void tick(const TrackCatalog& catalog, const TrackStats& stats, std::int64_t now) {
+        while (!expiries.empty() && std::get<0>(expiries.top()) <= now) {
+            std::uint32_t playlist = std::get<1>(expiries.top());
+            std::uint32_t id = std::get<2>(expiries.top());
+            expiries.pop();
+            auto entry = entries.find(playlist);
+            std::size_t row = catalog.findId(id);
+            if (entry != entries.end() && row != TrackCatalog::npos) {
+                check(playlist, entry->second, catalog, row, stats, now);
+            }
+        }
+    }
+
+    // Members of playlist in id order, or nullptr if it isn't a smart playlist
+    const std::vector<std::uint32_t>* getTracks(std::uint32_t playlist) {
+        auto it = entries.find(playlist);
+        if (it == entries.end()) {
+            return nullptr;
+        }
+        if (it->second.isStale) {
+            it->second.members.toVector(it->second.tracks);
+            it->second.isStale = false;
+        }
+        return &it->second.tracks;
+    }
+
+private:
+    struct Entry {
+        SmartRule rule;
+        Bitmap members;
+        std::vector<std::uint32_t> tracks;  // members as a list, remade when isStale
+        bool isStale = true;
+    };
+
+    void check(std::uint32_t playlist, Entry& entry, const TrackCatalog& catalog, std::size_t row, const TrackStats& stats, std::int64_t now) {
+        std::uint32_t id = catalog.getId(row);
+        std::int64_t until = 0;
+        bool matches = entry.rule.matches(catalog, row, stats, now, until);
+        if (matches != entry.members.contains(id)) {
+            if (matches) {
+                entry.members.add(id);
+            }
+            else {
+                entry.members.remove(id);
+            }
+            entry.isStale = true;
+        }
+        if (matches && until != 0) {
+            expiries.emplace(until, playlist, id);  // An older entry for the track just re-checks it once more
+        }
+    }
+
+    using Expiry = std::tuple<std::int64_t, std::uint32_t, std::uint32_t>;  // When, playlist, track id
+
+    std::unordered_map<std::uint32_t, Entry> entries;  // By playlist id
+    std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry>> expiries;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Interned strings: each distinct string is stored once, back to back in one buffer, and named
+// by a 32-bit id. Equal strings get equal ids, so comparing or grouping by them never touches text.
+// Id 0 is the empty string. Strings are never removed; a pool lives as long as its catalog.
+class StringPool {
+public:
+    static const std::uint32_t npos = 0xFFFFFFFFu;
+
+    StringPool() : offsets(1, 0), slots(64, 0) {
+        intern(std::string_view());
+    }
+
+    // Id of text, adding it if it's new
+    std::uint32_t intern(std::string_view text) {
+        buildSlots();
+        std::size_t mask = slots.size() - 1;
+        for (std::size_t slot = hash(text) & mask;; slot = (slot + 1) & mask) {
+            if (slots[slot] == 0) {
+                std::uint32_t id = static_cast<std::uint32_t>(offsets.size() - 1);
+                characters.insert(characters.end(), text.begin(), text.end());
+                offsets.push_back(static_cast<std::uint32_t>(characters.size()));
+                slots[slot] = id + 1;
+                if (getCount() * 2 > slots.size()) {
+                    rehash();
+                }
+                return id;
+            }
+            if (view(slots[slot] - 1) == text) {
+                return slots[slot] - 1;
+            }
+        }
+    }
+
+    // Makes room for count strings of bytes characters in all, so interning them never regrows
+    void reserve(std::size_t count, std::size_t bytes) {
+        buildSlots();
+        characters.reserve(bytes);
+        offsets.reserve(count + 1);
+        while (slots.size() < count * 2) {
+            rehash();
+        }
+    }
+
+    // Replaces the pool with count strings laid out as a pool keeps them (text back to back, and
+    // where each starts plus where the last ends), such as one the library index saved; ids stay
+    // as they were there, and the hash table waits for the first intern() or find(). False, leaving
+    // the pool alone, unless string 0 is empty and it all fits.
+    bool assign(const char* text, std::size_t bytes, const std::uint32_t* starts, std::size_t count) {
+        if (count == 0 || starts[0] != 0 || starts[1] != 0 || starts[count] > bytes) {
+            return false;
+        }
+        for (std::size_t id = 0; id < count; ++id) {
+            if (starts[id] > starts[id + 1]) {
+                return false;
+            }
+        }
+        characters.assign(text, text + starts[count]);
+        offsets.assign(starts, starts + count + 1);
+        slots.clear();
+        return true;
+    }
+
+    // Id of text, or npos if it was never interned
+    std::uint32_t find(std::string_view text) const {
+        buildSlots();
+        std::size_t mask = slots.size() - 1;
+        for (std::size_t slot = hash(text) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+            if (view(slots[slot] - 1) == text) {
+                return slots[slot] - 1;
+            }
+        }
+        return npos;
+    }
+
+    // Valid until the next intern()
+    std::string_view view(std::uint32_t id) const {
+        return std::string_view(characters.data() + offsets[id], offsets[id + 1] - offsets[id]);
+    }
+
+    // Getters
+    std::size_t getCount() const {
+        return offsets.size() - 1;
+    }
+
+    std::size_t getByteCount() const {
+        return characters.size() + offsets.size() * sizeof(std::uint32_t) + slots.size() * sizeof(std::uint32_t);
+    }
+
+private:
+    // FNV-1a
+    static std::size_t hash(std::string_view text) {
+        std::uint64_t h = 14695981039346656037ull;
+        for (char c : text) {
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return static_cast<std::size_t>(h ^ (h >> 32));
+    }
+
+    // Doubles the table, keeping it at most half full so probes stay short
+    void rehash() {
+        fillSlots(slots.size() * 2);
+    }
+
+    // Builds the table after assign(), at most half full
+    void buildSlots() const {
+        if (!slots.empty()) {
+            return;
+        }
+        std::size_t size = 64;
+        while (size < getCount() * 2) {
+            size *= 2;
+        }
+        fillSlots(size);
+    }
+
+    // Rebuilds the table at size slots (a power of two) from the strings
+    void fillSlots(std::size_t size) const {
+        std::vector<std::uint32_t> table(size, 0);
+        std::size_t mask = table.size() - 1;
+        for (std::uint32_t id = 0; id < getCount(); ++id) {
+            std::size_t slot = hash(view(id)) & mask;
+            while (table[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            table[slot] = id + 1;
+        }
+        slots.swap(table);
+    }
+
+    std::vector<char> characters;
+    std::vector<std::uint32_t> offsets;  // Start of each string, plus the end of the last
+    mutable std::vector<std::uint32_t> slots;  // Open-addressed hash table of id + 1, 0 when free; empty until built
+};
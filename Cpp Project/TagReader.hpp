@@ -0,0 +1,601 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Text tags of one file. The views point into the file's mapping or the TagReader's buffer.
+struct TrackTags {
+    std::string_view title;
+    std::string_view artist;
+    std::string_view album;
+    std::string_view genre;
+    unsigned int year = 0;
+    unsigned int trackNumber = 0;
+};
+
+// Reads title, artist, album, genre, year and track number from ID3v2 (2.2 to 2.4), ID3v1,
+// FLAC and Ogg Vorbis/Opus comments, RIFF INFO lists and AIFF name chunks, given the whole file
+// as a memory mapping. Only the tag regions are touched (the start of the file, the chunk
+// headers, the last 128 bytes), so the audio data never gets paged in.
+//
+// Nothing is allocated per file or per field: UTF-8 text is returned as views into the file,
+// and only text that needs converting (Latin-1, UTF-16, unsynchronised ID3) or an Ogg packet
+// split across pages is copied, into a buffer the reader allocates once. Reuse a reader for many
+// files; the views of one read() last until the next. When a file has several tags the first
+// found wins, ID3v1 last. Malformed tags are read as far as they make sense.
+class TagReader {
+public:
+    TagReader() : buffer(bufferSize), used(0) {}
+
+    TagReader(const TagReader&) = delete;
+    TagReader& operator=(const TagReader&) = delete;
+
+    // False if no tag was found
+    bool read(const char* data, std::size_t size, TrackTags& tags) {
+        tags = TrackTags();
+        used = 0;
+        const unsigned char* file = reinterpret_cast<const unsigned char*>(data);
+        std::size_t offset = 0;
+        if (size >= 10 && std::memcmp(file, "ID3", 3) == 0) {
+            offset = readId3v2(file, size, tags);  // MP3s, and some FLACs, start with one
+        }
+        const unsigned char* body = file + offset;
+        std::size_t length = size - offset;
+        if (length >= 4 && std::memcmp(body, "fLaC", 4) == 0) {
+            readFlac(body, length, tags);
+        }
+        else if (length >= 4 && std::memcmp(body, "OggS", 4) == 0) {
+            readOgg(body, length, tags);
+        }
+        else if (length >= 12 && std::memcmp(body, "RIFF", 4) == 0 && std::memcmp(body + 8, "WAVE", 4) == 0) {
+            readChunks(body, length, false, tags);
+        }
+        else if (length >= 12 && std::memcmp(body, "FORM", 4) == 0 && (std::memcmp(body + 8, "AIFF", 4) == 0 || std::memcmp(body + 8, "AIFC", 4) == 0)) {
+            readChunks(body, length, true, tags);
+        }
+        if (size >= 128 && std::memcmp(file + size - 128, "TAG", 3) == 0) {
+            readId3v1(file + size - 128, tags);
+        }
+        return !tags.title.empty() || !tags.artist.empty() || !tags.album.empty() || !tags.genre.empty() || tags.year || tags.trackNumber;
+    }
+
+private:
+    // Room for converted text and split packets; anything beyond is cut off
+    static const std::size_t bufferSize = 64 * 1024;
+
+    static std::uint32_t readBE32(const unsigned char* p) {
+        return (static_cast<std::uint32_t>(p[0]) << 24) | (static_cast<std::uint32_t>(p[1]) << 16) | (static_cast<std::uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    static std::uint32_t readLE32(const unsigned char* p) {
+        return (static_cast<std::uint32_t>(p[3]) << 24) | (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[1]) << 8) | p[0];
+    }
+
+    // 7 bits per byte, so the size never looks like an MPEG sync word
+    static std::uint32_t readSyncsafe(const unsigned char* p) {
+        return ((p[0] & 0x7Fu) << 21) | ((p[1] & 0x7Fu) << 14) | ((p[2] & 0x7Fu) << 7) | (p[3] & 0x7Fu);
+    }
+
+    static std::string_view view(const unsigned char* p, std::size_t n) {
+        return std::string_view(reinterpret_cast<const char*>(p), n);
+    }
+
+    // Leading digits, e.g. the 3 of "3/12" or the 1999 of "1999-05-01"
+    static unsigned int number(std::string_view text) {
+        unsigned int value = 0;
+        std::size_t i = 0;
+        while (i < text.size() && text[i] == ' ') {
+            ++i;
+        }
+        for (; i < text.size() && text[i] >= '0' && text[i] <= '9' && value < 100000; ++i) {
+            value = value * 10 + (text[i] - '0');
+        }
+        return value;
+    }
+
+    static bool equalsIgnoringCase(std::string_view a, const char* b) {
+        std::size_t n = std::strlen(b);
+        if (a.size() != n) {
+            return false;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            char c = a[i];
+            if (c >= 'a' && c <= 'z') {
+                c = static_cast<char>(c - 'a' + 'A');
+            }
+            if (c != b[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void fill(std::string_view& field, std::string_view value) {
+        if (field.empty()) {
+            field = value;
+        }
+    }
+
+    static void fill(unsigned int& field, unsigned int value) {
+        if (field == 0) {
+            field = value;
+        }
+    }
+
+    // The ID3v1 genre list, which ID3v2 genres may refer to as "(17)" or "17"
+    static std::string_view genreName(unsigned int index) {
+        static const char* names[] = {
+            "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop", "Jazz", "Metal",
+            "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock", "Techno", "Industrial",
+            "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk",
+            "Fusion", "Trance", "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+            "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic",
+            "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult", "Gangsta",
+            "Top 40", "Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave", "Psychadelic", "Rave", "Showtunes",
+            "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock"
+        };
+        return index < sizeof(names) / sizeof(names[0]) ? std::string_view(names[index]) : std::string_view();
+    }
+
+    // Space in the buffer, null when it's full
+    unsigned char* allocate(std::size_t n) {
+        if (n > buffer.size() - used) {
+            return nullptr;
+        }
+        unsigned char* p = reinterpret_cast<unsigned char*>(buffer.data()) + used;
+        used += n;
+        return p;
+    }
+
+    // Gives back the unused end of the last allocation
+    void shrink(const unsigned char* end) {
+        used = static_cast<std::size_t>(reinterpret_cast<const char*>(end) - buffer.data());
+    }
+
+    static bool isUtf8(const unsigned char* p, std::size_t n) {
+        for (std::size_t i = 0; i < n;) {
+            if (p[i] < 0x80) {
+                ++i;
+                continue;
+            }
+            std::size_t extra = ((p[i] >> 5) == 0x6) ? 1 : ((p[i] >> 4) == 0xE) ? 2 : ((p[i] >> 3) == 0x1E) ? 3 : 0;
+            if (extra == 0 || i + extra >= n) {
+                return false;
+            }
+            for (std::size_t k = 1; k <= extra; ++k) {
+                if ((p[i + k] & 0xC0) != 0x80) {
+                    return false;
+                }
+            }
+            i += extra + 1;
+        }
+        return true;
+    }
+
+    // Text in a legacy 8-bit field (ID3v1, ID3v2 encoding 0, RIFF and AIFF chunks), up to the first
+    // NUL and without trailing spaces. Many taggers write UTF-8 there regardless, which is kept as
+    // it is; anything else is taken as Latin-1 and converted.
+    std::string_view latin1(const unsigned char* p, std::size_t n) {
+        std::size_t length = 0;
+        while (length < n && p[length] != 0) {
+            ++length;
+        }
+        while (length > 0 && p[length - 1] == ' ') {
+            --length;
+        }
+        if (isUtf8(p, length)) {
+            return view(p, length);
+        }
+        unsigned char* out = allocate(length * 2);
+        if (!out) {
+            return std::string_view();
+        }
+        unsigned char* end = out;
+        for (std::size_t i = 0; i < length; ++i) {
+            if (p[i] < 0x80) {
+                *end++ = p[i];
+            }
+            else {
+                *end++ = static_cast<unsigned char>(0xC0 | (p[i] >> 6));
+                *end++ = static_cast<unsigned char>(0x80 | (p[i] & 0x3F));
+            }
+        }
+        shrink(end);
+        return view(out, end - out);
+    }
+
+    // Up to the first NUL; a byte order mark overrides bigEndian
+    std::string_view utf16(const unsigned char* p, std::size_t n, bool bigEndian) {
+        if (n >= 2 && ((p[0] == 0xFF && p[1] == 0xFE) || (p[0] == 0xFE && p[1] == 0xFF))) {
+            bigEndian = p[0] == 0xFE;
+            p += 2;
+            n -= 2;
+        }
+        std::size_t units = n / 2;
+        unsigned char* out = allocate(units * 3);
+        if (!out) {
+            return std::string_view();
+        }
+        unsigned char* end = out;
+        for (std::size_t i = 0; i < units; ++i) {
+            std::uint32_t c = bigEndian ? (p[2 * i] << 8 | p[2 * i + 1]) : (p[2 * i + 1] << 8 | p[2 * i]);
+            if (c == 0) {
+                break;
+            }
+            if (c >= 0xD800 && c < 0xDC00 && i + 1 < units) {
+                std::uint32_t low = bigEndian ? (p[2 * i + 2] << 8 | p[2 * i + 3]) : (p[2 * i + 3] << 8 | p[2 * i + 2]);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+            }
+            if (c < 0x80) {
+                *end++ = static_cast<unsigned char>(c);
+            }
+            else if (c < 0x800) {
+                *end++ = static_cast<unsigned char>(0xC0 | (c >> 6));
+                *end++ = static_cast<unsigned char>(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000) {
+                *end++ = static_cast<unsigned char>(0xE0 | (c >> 12));
+                *end++ = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3F));
+                *end++ = static_cast<unsigned char>(0x80 | (c & 0x3F));
+            }
+            else {
+                // Two UTF-16 units became four bytes, still within the six allocated for them
+                *end++ = static_cast<unsigned char>(0xF0 | (c >> 18));
+                *end++ = static_cast<unsigned char>(0x80 | ((c >> 12) & 0x3F));
+                *end++ = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3F));
+                *end++ = static_cast<unsigned char>(0x80 | (c & 0x3F));
+            }
+        }
+        shrink(end);
+        return view(out, end - out);
+    }
+
+    static std::string_view utf8(const unsigned char* p, std::size_t n) {
+        std::size_t length = 0;
+        while (length < n && p[length] != 0) {
+            ++length;
+        }
+        return view(p, length);
+    }
+
+    // ID3v2 text frame: an encoding byte, then the text (the first of several values in 2.4)
+    std::string_view id3Text(const unsigned char* p, std::size_t n) {
+        if (n < 1) {
+            return std::string_view();
+        }
+        switch (p[0]) {
+        case 0:
+            return latin1(p + 1, n - 1);
+        case 1:
+            return utf16(p + 1, n - 1, false);
+        case 2:
+            return utf16(p + 1, n - 1, true);
+        default:
+            return utf8(p + 1, n - 1);
+        }
+    }
+
+    // Undoes unsynchronisation (a 0 stuffed after every 0xFF) into the buffer
+    const unsigned char* resynchronise(const unsigned char* p, std::size_t& n) {
+        unsigned char* out = allocate(n);
+        if (!out) {
+            n = 0;
+            return p;
+        }
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            out[length++] = p[i];
+            if (p[i] == 0xFF && i + 1 < n && p[i + 1] == 0) {
+                ++i;
+            }
+        }
+        shrink(out + length);
+        n = length;
+        return out;
+    }
+
+    // Returns the tag's total size, i.e. where the file's own data starts
+    std::size_t readId3v2(const unsigned char* file, std::size_t size, TrackTags& tags) {
+        unsigned int major = file[3];
+        unsigned int flags = file[5];
+        std::size_t total = 10 + readSyncsafe(file + 6) + ((major >= 4 && (flags & 0x10)) ? 10 : 0);
+        if (total > size || major < 2 || major > 4) {
+            return 0;
+        }
+        const unsigned char* p = file + 10;
+        std::size_t n = readSyncsafe(file + 6);
+        if ((flags & 0x80) && major < 4) {
+            p = resynchronise(p, n);  // 2.4 marks it per frame instead
+        }
+        if ((flags & 0x40) && major >= 3 && n >= 4) {
+            std::size_t extended = (major == 3) ? readBE32(p) + 4 : readSyncsafe(p);
+            p += std::min(extended, n);
+            n -= std::min(extended, n);
+        }
+
+        std::size_t headerSize = (major == 2) ? 6 : 10;
+        std::size_t idSize = (major == 2) ? 3 : 4;
+        for (std::size_t offset = 0; offset + headerSize <= n && p[offset] != 0;) {
+            const unsigned char* frame = p + offset;
+            std::size_t frameSize = (major == 2) ? (frame[3] << 16 | frame[4] << 8 | frame[5])
+                                    : (major == 3) ? readBE32(frame + 4) : readSyncsafe(frame + 4);
+            if (frameSize > n - offset - headerSize) {
+                break;
+            }
+            const unsigned char* content = frame + headerSize;
+            std::size_t length = frameSize;
+            offset += headerSize + frameSize;
+
+            if (major == 3) {
+                if (frame[9] & 0xC0) {
+                    continue;  // Compressed or encrypted
+                }
+                if ((frame[9] & 0x20) && length > 0) {
+                    ++content;  // Group id
+                    --length;
+                }
+            }
+            else if (major == 4) {
+                if (frame[9] & 0x0C) {
+                    continue;
+                }
+                if ((frame[9] & 0x01) && length >= 4) {
+                    content += 4;  // Data length indicator
+                    length -= 4;
+                }
+                if (frame[9] & 0x02) {
+                    content = resynchronise(content, length);
+                }
+            }
+
+            std::string_view id = view(frame, idSize);
+            if (id == "TIT2" || id == "TT2") {
+                fill(tags.title, id3Text(content, length));
+            }
+            else if (id == "TPE1" || id == "TP1") {
+                fill(tags.artist, id3Text(content, length));
+            }
+            else if (id == "TALB" || id == "TAL") {
+                fill(tags.album, id3Text(content, length));
+            }
+            else if (id == "TCON" || id == "TCO") {
+                fill(tags.genre, id3Genre(id3Text(content, length)));
+            }
+            else if (id == "TYER" || id == "TDRC" || id == "TYE") {
+                fill(tags.year, number(id3Text(content, length)));
+            }
+            else if (id == "TRCK" || id == "TRK") {
+                fill(tags.trackNumber, number(id3Text(content, length)));
+            }
+        }
+        return total;
+    }
+
+    // "(17)", "(17)Rock" and "17" name ID3v1 genres; anything else is the genre itself
+    static std::string_view id3Genre(std::string_view text) {
+        if (!text.empty() && text[0] == '(') {
+            std::size_t close = text.find(')');
+            if (close != std::string_view::npos) {
+                std::string_view rest = text.substr(close + 1);
+                return rest.empty() ? genreName(number(text.substr(1))) : rest;
+            }
+        }
+        if (!text.empty() && text[0] >= '0' && text[0] <= '9' && text.find_first_not_of("0123456789") == std::string_view::npos) {
+            return genreName(number(text));
+        }
+        return text;
+    }
+
+    void readId3v1(const unsigned char* tag, TrackTags& tags) {
+        fill(tags.title, latin1(tag + 3, 30));
+        fill(tags.artist, latin1(tag + 33, 30));
+        fill(tags.album, latin1(tag + 63, 30));
+        fill(tags.year, number(latin1(tag + 93, 4)));
+        if (tag[125] == 0 && tag[126] != 0) {
+            fill(tags.trackNumber, tag[126]);  // ID3v1.1 puts it at the end of the comment
+        }
+        fill(tags.genre, genreName(tag[127]));
+    }
+
+    // Vendor string, then KEY=value pairs, all lengths little-endian
+    static void readVorbisComments(const unsigned char* p, std::size_t n, TrackTags& tags) {
+        if (n < 8) {
+            return;
+        }
+        std::size_t offset = 4 + std::min<std::size_t>(readLE32(p), n - 4);
+        if (offset + 4 > n) {
+            return;
+        }
+        std::uint32_t count = readLE32(p + offset);
+        offset += 4;
+        for (std::uint32_t i = 0; i < count && offset + 4 <= n; ++i) {
+            std::size_t length = readLE32(p + offset);
+            offset += 4;
+            if (length > n - offset) {
+                break;
+            }
+            std::string_view comment = view(p + offset, length);
+            offset += length;
+            std::size_t equals = comment.find('=');
+            if (equals == std::string_view::npos) {
+                continue;
+            }
+            std::string_view key = comment.substr(0, equals);
+            std::string_view value = comment.substr(equals + 1);
+            if (equalsIgnoringCase(key, "TITLE")) {
+                fill(tags.title, value);
+            }
+            else if (equalsIgnoringCase(key, "ARTIST")) {
+                fill(tags.artist, value);
+            }
+            else if (equalsIgnoringCase(key, "ALBUM")) {
+                fill(tags.album, value);
+            }
+            else if (equalsIgnoringCase(key, "GENRE")) {
+                fill(tags.genre, value);
+            }
+            else if (equalsIgnoringCase(key, "DATE") || equalsIgnoringCase(key, "YEAR")) {
+                fill(tags.year, number(value));
+            }
+            else if (equalsIgnoringCase(key, "TRACKNUMBER")) {
+                fill(tags.trackNumber, number(value));
+            }
+        }
+    }
+
+    // Metadata blocks after the marker: a last-block flag and type, then a 24-bit length
+    static void readFlac(const unsigned char* p, std::size_t n, TrackTags& tags) {
+        for (std::size_t offset = 4; offset + 4 <= n;) {
+            unsigned int type = p[offset] & 0x7F;
+            bool last = (p[offset] & 0x80) != 0;
+            std::size_t length = p[offset + 1] << 16 | p[offset + 2] << 8 | p[offset + 3];
+            offset += 4;
+            if (length > n - offset) {
+                return;
+            }
+            if (type == 4) {
+                readVorbisComments(p + offset, length, tags);
+                return;
+            }
+            offset += length;
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    // The comments are the second packet of the first stream. A packet within one page is read in
+    // place; one spanning pages (large cover art, usually after the text) is gathered into the buffer.
+    void readOgg(const unsigned char* p, std::size_t n, TrackTags& tags) {
+        if (n < 27) {
+            return;
+        }
+        std::uint32_t serial = readLE32(p + 14);
+        unsigned int packet = 0;
+        const unsigned char* start = nullptr;
+        std::size_t length = 0;
+        std::size_t capacity = 0;  // Of the copy, once gathering
+        bool gathering = false;
+        for (std::size_t offset = 0; offset + 27 <= n && std::memcmp(p + offset, "OggS", 4) == 0;) {
+            std::size_t segments = p[offset + 26];
+            std::size_t header = 27 + segments;
+            if (offset + header > n) {
+                return;
+            }
+            const unsigned char* lacing = p + offset + 27;
+            const unsigned char* data = p + offset + header;
+            std::size_t position = 0;
+            bool ours = readLE32(p + offset + 14) == serial;
+            for (std::size_t s = 0; s < segments; ++s) {
+                std::size_t lace = lacing[s];
+                if (offset + header + position + lace > n) {
+                    return;
+                }
+                if (ours && packet == 1) {
+                    if (length == 0) {
+                        start = data + position;
+                        length = lace;
+                    }
+                    else if (!gathering && start + length == data + position) {
+                        length += lace;
+                    }
+                    else {
+                        if (!gathering) {
+                            // The packet continues on another page: copy what we have so far
+                            capacity = buffer.size() - used;
+                            if (length > capacity) {
+                                return;
+                            }
+                            unsigned char* copy = allocate(capacity);
+                            std::memcpy(copy, start, length);
+                            start = copy;
+                            gathering = true;
+                        }
+                        std::size_t taken = std::min(lace, capacity - length);
+                        std::memcpy(const_cast<unsigned char*>(start) + length, data + position, taken);
+                        length += taken;
+                    }
+                }
+                position += lace;
+                if (ours && lace < 255) {
+                    if (packet == 1) {
+                        readOggComments(start, length, tags);
+                        return;
+                    }
+                    ++packet;
+                }
+            }
+            offset += header + position;
+        }
+    }
+
+    static void readOggComments(const unsigned char* p, std::size_t n, TrackTags& tags) {
+        if (n >= 7 && std::memcmp(p, "\x03vorbis", 7) == 0) {
+            readVorbisComments(p + 7, n - 7, tags);
+        }
+        else if (n >= 8 && std::memcmp(p, "OpusTags", 8) == 0) {
+            readVorbisComments(p + 8, n - 8, tags);
+        }
+    }
+
+    // RIFF (little-endian sizes) or AIFF (big-endian) chunks, stepping over the audio data unread
+    void readChunks(const unsigned char* p, std::size_t n, bool aiff, TrackTags& tags) {
+        for (std::size_t offset = 12; offset + 8 <= n;) {
+            std::string_view id = view(p + offset, 4);
+            std::size_t length = aiff ? readBE32(p + offset + 4) : readLE32(p + offset + 4);
+            const unsigned char* content = p + offset + 8;
+            length = std::min(length, n - offset - 8);
+            if (id == "LIST" && length >= 4 && std::memcmp(content, "INFO", 4) == 0) {
+                readInfo(content + 4, length - 4, tags);
+            }
+            else if ((id == "id3 " || id == "ID3 ") && length >= 10 && std::memcmp(content, "ID3", 3) == 0) {
+                readId3v2(content, length, tags);
+            }
+            else if (aiff && id == "NAME") {
+                fill(tags.title, latin1(content, length));
+            }
+            else if (aiff && id == "AUTH") {
+                fill(tags.artist, latin1(content, length));
+            }
+            offset += 8 + length + (length & 1);  // Chunks are padded to an even size
+        }
+    }
+
+    // RIFF INFO: NUL-terminated strings in subchunks
+    void readInfo(const unsigned char* p, std::size_t n, TrackTags& tags) {
+        for (std::size_t offset = 0; offset + 8 <= n;) {
+            std::string_view id = view(p + offset, 4);
+            std::size_t length = std::min<std::size_t>(readLE32(p + offset + 4), n - offset - 8);
+            const unsigned char* content = p + offset + 8;
+            if (id == "INAM") {
+                fill(tags.title, latin1(content, length));
+            }
+            else if (id == "IART") {
+                fill(tags.artist, latin1(content, length));
+            }
+            else if (id == "IPRD") {
+                fill(tags.album, latin1(content, length));
+            }
+            else if (id == "IGNR") {
+                fill(tags.genre, latin1(content, length));
+            }
+            else if (id == "ICRD") {
+                fill(tags.year, number(latin1(content, length)));
+            }
+            else if (id == "ITRK" || id == "IPRT") {
+                fill(tags.trackNumber, number(latin1(content, length)));
+            }
+            offset += 8 + length + (length & 1);
+        }
+    }
+
+    std::vector<char> buffer;
+    std::size_t used;  // Bytes of buffer handed out during the current read()
+};
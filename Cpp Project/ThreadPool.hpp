@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued jobs, for batch work across all cores
+// (library scans, loudness analysis). Jobs must not throw.
+class ThreadPool {
+public:
+    // threadCount 0 means one worker per hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0) : running(true), active(0) {
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned int i = 0; i < threadCount; ++i) {
+            workers.emplace_back(&ThreadPool::run, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Jobs still queued are dropped, running ones are waited for
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+            jobs.clear();
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted job has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return jobs.empty() && active == 0; });
+    }
+
+    unsigned int getThreadCount() const {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return !running || !jobs.empty(); });
+            if (!running) {
+                return;
+            }
+            std::function<void()> job = std::move(jobs.front());
+            jobs.pop_front();
+            ++active;
+            lock.unlock();
+            job();
+            lock.lock();
+            --active;
+            if (jobs.empty() && active == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;  // Workers wait for jobs
+    std::condition_variable idle;  // wait() waits for the queue to drain
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool running;
+    unsigned int active;  // Jobs currently executing
+};
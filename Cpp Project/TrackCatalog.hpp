@@ -0,0 +1,326 @@
+#pragma once
+
+#include <SFML/System.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "LibraryScanner.hpp"
+#include "StringPool.hpp"
+
+// Every track the player knows, one row per track kept as parallel arrays rather than an array
+// of structs: sorting, filtering or drawing one field walks one contiguous column. Text fields
+// are ids into a shared StringPool, so a row costs 42 bytes (with its entry in the id-to-row
+// column) and repeated artists and albums are stored once. Rows are kept in path order; a row
+// number changes as tracks come and go, the id in getId() doesn't, and findId() maps it back.
+class TrackCatalog {
+public:
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    // A track's fields with its text as ids from intern(), for append()
+    struct Row {
+        std::uint32_t path, title, artist, album, genre;
+        sf::Time duration;
+        unsigned int sampleRate, channelCount, year, trackNumber;
+    };
+
+    TrackCatalog() : nextId(0) {}
+
+    void reserve(std::size_t count) {
+        ids.reserve(count);
+        rowsById.reserve(count);
+        paths.reserve(count);
+        titles.reserve(count);
+        artists.reserve(count);
+        albums.reserve(count);
+        genres.reserve(count);
+        durations.reserve(count);
+        sampleRates.reserve(count);
+        channelCounts.reserve(count);
+        years.reserve(count);
+        trackNumbers.reserve(count);
+    }
+
+    // Adds a track with an id handed out earlier (e.g. from the library index) at its place in
+    // path order; appending tracks in order, as when loading, costs nothing extra
+    std::size_t insert(const TrackInfo& track, std::uint32_t id) {
+        std::size_t row = lowerBound(track.path);
+        if (row < getCount() && getPath(row) == track.path) {
+            setFormat(row, track);
+            setTags(row, track);
+            return row;
+        }
+        nextId = std::max(nextId, id + 1);
+        ids.insert(ids.begin() + row, id);
+        rowsById.resize(std::max<std::size_t>(rowsById.size(), id + std::size_t(1)), noRow);
+        placeRows(row);
+        paths.insert(paths.begin() + row, strings.intern(track.path));
+        titles.insert(titles.begin() + row, 0);
+        artists.insert(artists.begin() + row, 0);
+        albums.insert(albums.begin() + row, 0);
+        genres.insert(genres.begin() + row, 0);
+        durations.insert(durations.begin() + row, 0);
+        sampleRates.insert(sampleRates.begin() + row, 0);
+        channelCounts.insert(channelCounts.begin() + row, 0);
+        years.insert(years.begin() + row, 0);
+        trackNumbers.insert(trackNumbers.begin() + row, 0);
+        setFormat(row, track);
+        setTags(row, track);
+        return row;
+    }
+
+    // Room for count distinct strings of bytes characters in all, e.g. before loading an index
+    void reserveStrings(std::size_t count, std::size_t bytes) {
+        strings.reserve(count, bytes);
+    }
+
+    std::uint32_t intern(std::string_view text) {
+        return strings.intern(text);
+    }
+
+    // Takes over a saved string pool (see StringPool::assign()) while the catalog is empty, so
+    // append() can be given its ids as they are
+    bool assignStrings(const char* text, std::size_t bytes, const std::uint32_t* starts, std::size_t count) {
+        return ids.empty() && strings.assign(text, bytes, starts, count);
+    }
+
+    // Adds a track with an id handed out earlier after the last row, for loading a whole index
+    // without a TrackInfo (and its strings) per track. A path out of order goes through insert().
+    void append(std::uint32_t id, const Row& row) {
+        if (!ids.empty() && !(getPath(ids.size() - 1) < strings.view(row.path))) {
+            TrackInfo track;
+            track.path = std::string(strings.view(row.path));
+            track.duration = row.duration;
+            track.channelCount = row.channelCount;
+            track.sampleRate = row.sampleRate;
+            track.title = std::string(strings.view(row.title));
+            track.artist = std::string(strings.view(row.artist));
+            track.album = std::string(strings.view(row.album));
+            track.genre = std::string(strings.view(row.genre));
+            track.year = row.year;
+            track.trackNumber = row.trackNumber;
+            insert(track, id);
+            return;
+        }
+        nextId = std::max(nextId, id + 1);
+        rowsById.resize(std::max<std::size_t>(rowsById.size(), id + std::size_t(1)), noRow);
+        rowsById[id] = static_cast<std::uint32_t>(ids.size());
+        ids.push_back(id);
+        paths.push_back(row.path);
+        titles.push_back(row.title);
+        artists.push_back(row.artist);
+        albums.push_back(row.album);
+        genres.push_back(row.genre);
+        durations.push_back(static_cast<std::uint32_t>(row.duration.asMilliseconds()));
+        sampleRates.push_back(row.sampleRate);
+        channelCounts.push_back(static_cast<std::uint16_t>(row.channelCount));
+        years.push_back(static_cast<std::uint16_t>(std::min(row.year, 65535u)));
+        trackNumbers.push_back(static_cast<std::uint16_t>(std::min(row.trackNumber, 65535u)));
+    }
+
+    // Adds a track that is new to the library, giving it the next free id
+    std::size_t insert(const TrackInfo& track) {
+        return insert(track, nextId);
+    }
+
+    void erase(std::size_t row) {
+        erase(std::vector<std::size_t>{ row });
+    }
+
+    // Erases rows, which must be sorted and distinct, closing the gaps in one pass per column
+    void erase(const std::vector<std::size_t>& rows) {
+        if (rows.empty()) {
+            return;
+        }
+        for (std::size_t row : rows) {
+            rowsById[ids[row]] = noRow;
+        }
+        compact(ids, rows);
+        compact(paths, rows);
+        compact(titles, rows);
+        compact(artists, rows);
+        compact(albums, rows);
+        compact(genres, rows);
+        compact(durations, rows);
+        compact(sampleRates, rows);
+        compact(channelCounts, rows);
+        compact(years, rows);
+        compact(trackNumbers, rows);
+        placeRows(rows.front());
+    }
+
+    // Adds to rows, in ascending order, the row of path and those of every track under it if it's
+    // a folder; paths sort together by prefix, so each is one binary search and a contiguous run
+    void findUnder(std::string_view path, std::vector<std::size_t>& rows) const {
+        std::size_t row = find(path);
+        if (row != npos) {
+            rows.push_back(row);
+        }
+        std::string folder(path);
+        for (char separator : { '/', '\\' }) {
+            folder.resize(path.size());
+            folder += separator;
+            for (row = lowerBound(folder); row < getCount() && getPath(row).substr(0, folder.size()) == folder; ++row) {
+                rows.push_back(row);
+            }
+        }
+    }
+
+    // Row of path, or npos
+    std::size_t find(std::string_view path) const {
+        std::size_t row = lowerBound(path);
+        return (row < getCount() && getPath(row) == path) ? row : npos;
+    }
+
+    // Row of the track with id, or npos if it isn't in the catalog
+    std::size_t findId(std::uint32_t id) const {
+        return (id < rowsById.size() && rowsById[id] != noRow) ? rowsById[id] : npos;
+    }
+
+    // Ids below this have been handed out, so a new track never reuses a removed one's
+    void setNextId(std::uint32_t id) {
+        nextId = std::max(nextId, id);
+    }
+
+    // Getters
+    std::size_t getCount() const {
+        return ids.size();
+    }
+
+    std::uint32_t getId(std::size_t row) const {
+        return ids[row];
+    }
+
+    std::uint32_t getNextId() const {
+        return nextId;
+    }
+
+    // Views into the string pool, valid until the next insert()
+    std::string_view getPath(std::size_t row) const {
+        return strings.view(paths[row]);
+    }
+
+    // The tagged title, or the file name without its extension when there is none
+    std::string_view getTitle(std::size_t row) const {
+        return (titles[row] != 0) ? strings.view(titles[row]) : stem(getPath(row));
+    }
+
+    std::string_view getArtist(std::size_t row) const {
+        return strings.view(artists[row]);
+    }
+
+    std::string_view getAlbum(std::size_t row) const {
+        return strings.view(albums[row]);
+    }
+
+    std::string_view getGenre(std::size_t row) const {
+        return strings.view(genres[row]);
+    }
+
+    // 0 when untagged
+    unsigned int getYear(std::size_t row) const {
+        return years[row];
+    }
+
+    unsigned int getTrackNumber(std::size_t row) const {
+        return trackNumbers[row];
+    }
+
+    sf::Time getDuration(std::size_t row) const {
+        return sf::milliseconds(static_cast<sf::Int32>(durations[row]));
+    }
+
+    unsigned int getSampleRate(std::size_t row) const {
+        return sampleRates[row];
+    }
+
+    unsigned int getChannelCount(std::size_t row) const {
+        return channelCounts[row];
+    }
+
+    const StringPool& getStrings() const {
+        return strings;
+    }
+
+private:
+    static std::string_view stem(std::string_view path) {
+        std::size_t slash = path.find_last_of("/\\");
+        std::string_view name = (slash == std::string_view::npos) ? path : path.substr(slash + 1);
+        std::size_t dot = name.find_last_of('.');
+        return (dot == std::string_view::npos || dot == 0) ? name : name.substr(0, dot);
+    }
+
+    std::size_t lowerBound(std::string_view path) const {
+        if (!paths.empty() && getPath(getCount() - 1) < path) {
+            return getCount();  // The common case while loading
+        }
+        std::size_t low = 0;
+        std::size_t high = getCount();
+        while (low < high) {
+            std::size_t middle = low + (high - low) / 2;
+            if (getPath(middle) < path) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // Drops the entries at rows (sorted, distinct) from column, moving each survivor once
+    template <typename T>
+    static void compact(std::vector<T>& column, const std::vector<std::size_t>& rows) {
+        std::size_t kept = rows.front();
+        std::size_t next = 0;
+        for (std::size_t r = rows.front(); r < column.size(); ++r) {
+            if (next < rows.size() && rows[next] == r) {
+                ++next;
+                continue;
+            }
+            column[kept++] = std::move(column[r]);
+        }
+        column.resize(kept);
+    }
+
+    // Renumbers the rows from row on after an insert or erase there
+    void placeRows(std::size_t row) {
+        for (std::size_t r = row; r < ids.size(); ++r) {
+            rowsById[ids[r]] = static_cast<std::uint32_t>(r);
+        }
+    }
+
+    void setFormat(std::size_t row, const TrackInfo& track) {
+        durations[row] = static_cast<std::uint32_t>(track.duration.asMilliseconds());
+        sampleRates[row] = track.sampleRate;
+        channelCounts[row] = static_cast<std::uint16_t>(track.channelCount);
+    }
+
+    void setTags(std::size_t row, const TrackInfo& track) {
+        titles[row] = strings.intern(track.title);  // 0 (empty) for the file name, see getTitle()
+        artists[row] = strings.intern(track.artist);
+        albums[row] = strings.intern(track.album);
+        genres[row] = strings.intern(track.genre);
+        years[row] = static_cast<std::uint16_t>(std::min(track.year, 65535u));
+        trackNumbers[row] = static_cast<std::uint16_t>(std::min(track.trackNumber, 65535u));
+    }
+
+    static constexpr std::uint32_t noRow = 0xFFFFFFFFu;
+
+    StringPool strings;
+    std::uint32_t nextId;
+    std::vector<std::uint32_t> rowsById;   // Row of each id handed out, noRow once it's gone
+    // Columns, one entry per row
+    std::vector<std::uint32_t> ids;
+    std::vector<std::uint32_t> paths;      // String ids
+    std::vector<std::uint32_t> titles;
+    std::vector<std::uint32_t> artists;
+    std::vector<std::uint32_t> albums;
+    std::vector<std::uint32_t> genres;
+    std::vector<std::uint32_t> durations;  // Milliseconds
+    std::vector<std::uint32_t> sampleRates;
+    std::vector<std::uint16_t> channelCounts;
+    std::vector<std::uint16_t> years;
+    std::vector<std::uint16_t> trackNumbers;
+};
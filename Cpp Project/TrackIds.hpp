@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+// Which path every track id (see TrackCatalog::getId()) was handed out to, as an append-only log
+// kept apart from the library index. Playlists and play stats hold nothing but ids, so an id must
+// never pass to another track; the index is only rewritten on a clean exit and can be lost, but an
+// id is logged here as soon as it's handed out, and a path that comes back gets its old id again.
+//
+// The log is the magic, then records of the id (uint32), the path's length (uint32) and the path,
+// in host byte order. It's read on first use, not at startup; a record cut short by a crash is
+// dropped and the file trimmed back to the last whole one.
+class TrackIds {
+public:
+    static const std::uint32_t npos = 0xFFFFFFFFu;
+
+    explicit TrackIds(const std::string& logPath) : logPath(logPath), nextId(0), loaded(false), started(false) {}
+
+    TrackIds(const TrackIds&) = delete;
+    TrackIds& operator=(const TrackIds&) = delete;
+
+    // Whether there's a log yet, without reading it
+    bool exists() const {
+        std::error_code error;
+        return std::filesystem::exists(logPath, error);
+    }
+
+    // Id path was given, or npos if it never had one
+    std::uint32_t find(std::string_view path) {
+        load();
+        auto it = byPath.find(std::string(path));
+        return (it != byPath.end()) ? it->second : npos;
+    }
+
+    // Records that path was given id; the log is written by flush()
+    void add(std::string_view path, std::uint32_t id) {
+        load();
+        if (!byPath.emplace(std::string(path), id).second) {
+            return;
+        }
+        nextId = std::max(nextId, id + 1);
+        std::uint32_t length = static_cast<std::uint32_t>(path.size());
+        unwritten.append(reinterpret_cast<const char*>(&id), sizeof(id));
+        unwritten.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        unwritten.append(path.begin(), path.end());
+    }
+
+    // Appends what add() recorded since the last call
+    bool flush() {
+        load();
+        if (unwritten.empty()) {
+            return true;
+        }
+        std::ofstream file(logPath, std::ios::binary | (started ? std::ios::app : std::ios::trunc));
+        if (!started) {
+            file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        }
+        file.write(unwritten.data(), static_cast<std::streamsize>(unwritten.size()));
+        if (!file) {
+            return false;
+        }
+        started = true;
+        unwritten.clear();
+        return true;
+    }
+
+    // Getters
+    // First id above every one in the log
+    std::uint32_t getNextId() {
+        load();
+        return nextId;
+    }
+
+private:
+    static constexpr std::uint32_t magic = 0x31444954;  // "TID1"
+    static constexpr std::size_t recordHeader = 2 * sizeof(std::uint32_t);
+
+    void load() {
+        if (loaded) {
+            return;
+        }
+        loaded = true;
+        std::ifstream file(logPath, std::ios::binary);
+        std::vector<char> data;
+        if (file) {
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        file.close();
+        started = data.size() >= sizeof(magic) && std::memcmp(data.data(), &magic, sizeof(magic)) == 0;
+        if (!started) {
+            return;  // None yet, or not ours: the first flush() starts it over
+        }
+
+        std::size_t offset = sizeof(magic);
+        while (data.size() - offset >= recordHeader) {
+            std::uint32_t id;
+            std::uint32_t length;
+            std::memcpy(&id, data.data() + offset, sizeof(id));
+            std::memcpy(&length, data.data() + offset + sizeof(id), sizeof(length));
+            if (data.size() - offset - recordHeader < length) {
+                break;  // Cut short
+            }
+            byPath[std::string(data.data() + offset + recordHeader, length)] = id;
+            nextId = std::max(nextId, id + 1);
+            offset += recordHeader + length;
+        }
+        if (offset != data.size()) {
+            std::error_code error;
+            std::filesystem::resize_file(logPath, offset, error);
+        }
+    }
+
+    std::string logPath;
+    std::unordered_map<std::string, std::uint32_t> byPath;
+    std::string unwritten;  // Records added since the last flush()
+    std::uint32_t nextId;
+    bool loaded;
+    bool started;           // The file exists with our magic, so flush() appends to it
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Opens tracks on a background thread so the UI loop never waits on disk I/O.
+// Track is anything with openFromFile(path), e.g. sf::Music or TrackSource.
+// Each slot only cares about its most recent request: older ones are dropped once superseded.
+template <typename Track>
+class TrackLoader {
+public:
+    enum Slot {
+        Current,   // Needed right now, always opened first
+        Upcoming,  // Preloaded in the background for what plays next
+        SlotCount
+    };
+
+    TrackLoader() : running(true) {
+        worker = std::thread(&TrackLoader::run, this);
+    }
+
+    ~TrackLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    TrackLoader(const TrackLoader&) = delete;
+    TrackLoader& operator=(const TrackLoader&) = delete;
+
+    // Queue a file to be opened, superseding any request still in flight for that slot
+    void request(const std::string& path, Slot slot = Current) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Request& request = requests[slot];
+        request.path = path;
+        request.pending = true;
+        ++request.latestTicket;
+        request.ready.reset();
+        wake.notify_one();
+    }
+
+    // Non-blocking. Returns true once the latest request for the slot has finished;
+    // track is left empty if the file could not be opened.
+    bool poll(std::unique_ptr<Track>& track, Slot slot = Current) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Request& request = requests[slot];
+        if (request.finishedTicket != request.latestTicket) {
+            return false;
+        }
+        track = std::move(request.ready);
+        return true;
+    }
+
+    // Sound streams join their streaming thread when stopped or destroyed,
+    // so outgoing ones are torn down here rather than on the UI thread
+    void retire(std::unique_ptr<sf::SoundStream> stream) {
+        if (!stream) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.push_back(std::move(stream));
+        wake.notify_one();
+    }
+
+private:
+    struct Request {
+        Request() : latestTicket(0), finishedTicket(0), pending(false) {}
+
+        std::string path;
+        std::unique_ptr<Track> ready;
+        unsigned latestTicket;
+        unsigned finishedTicket;
+        bool pending;
+    };
+
+    bool hasWork() const {
+        for (int i = 0; i < SlotCount; ++i) {
+            if (requests[i].pending) {
+                return true;
+            }
+        }
+        return !retired.empty();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return !running || hasWork(); });
+            if (!running) {
+                break;
+            }
+
+            std::vector<std::unique_ptr<sf::SoundStream>> outgoing;
+            outgoing.swap(retired);
+
+            int slot = 0;
+            while (slot < SlotCount && !requests[slot].pending) {
+                ++slot;
+            }
+            bool open = slot < SlotCount;
+            std::string path;
+            unsigned ticket = 0;
+            if (open) {
+                path = requests[slot].path;
+                ticket = requests[slot].latestTicket;
+                requests[slot].pending = false;
+            }
+            lock.unlock();
+
+            outgoing.clear();
+
+            std::unique_ptr<Track> track;
+            if (open) {
+                track.reset(new Track);
+                if (!track->openFromFile(path)) {
+                    std::cerr << "Error loading " << path << std::endl;
+                    track.reset();
+                }
+            }
+
+            lock.lock();
+            if (open && ticket == requests[slot].latestTicket) {
+                requests[slot].ready = std::move(track);
+                requests[slot].finishedTicket = ticket;
+            }
+            else if (track) {
+                // Superseded while opening; it was never played so this is cheap
+                lock.unlock();
+                track.reset();
+                lock.lock();
+            }
+        }
+        retired.clear();
+    }
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    Request requests[SlotCount];
+    std::vector<std::unique_ptr<sf::SoundStream>> retired;
+    bool running;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MappedSoundFile.hpp"
+#include "Resampler.hpp"
+#include "SampleKernels.hpp"
+
+// Decoder for a single track. Opening only maps the file and parses the header,
+// samples are pulled on demand by whichever PlaybackStream the source is handed to.
+// Uncompressed WAV and AIFF are read as float straight from the mapping, so 24-bit and
+// float files keep their full resolution; other formats go through SFML's 16-bit readers.
+// After resampleTo() the source delivers samples at that rate instead of its own.
+class TrackSource {
+public:
+    TrackSource() : direct(false), drained(false), gain(1.0f) {}
+
+    bool openFromFile(const std::string& filename) {
+        path = filename;
+        if (stream.open(filename)) {
+            direct = pcm.open(stream);
+            return file.openFromStream(stream);
+        }
+        direct = false;
+        return file.openFromFile(filename);
+    }
+
+    // Deliver samples at rate from now on; the native rate turns resampling off
+    void resampleTo(unsigned int rate, Resampler::Quality quality = Resampler::Standard) {
+        if (rate == getNativeSampleRate()) {
+            resampler.reset();
+        }
+        else if (!resampler || resampler->getOutputRate() != rate) {
+            resampler.reset(new Resampler(getNativeSampleRate(), rate, getChannelCount(), quality));
+        }
+        drained = false;
+    }
+
+    // Scale every sample read from now on, e.g. by the track's loudness normalization
+    void setGain(float linearGain) {
+        gain = linearGain;
+    }
+
+    // Reads up to count interleaved samples in [-1, 1), returns how many were read.
+    // Fewer than count means the track is over.
+    std::size_t read(float* samples, std::size_t count) {
+        std::size_t read = resampler ? resample(samples, count) : decode(samples, count);
+        if (gain != 1.0f) {
+            SampleKernels::get().applyGain(samples, read, gain);
+        }
+        return read;
+    }
+
+    void seek(sf::Time offset) {
+        restart();
+        if (direct) {
+            sf::Uint64 frame = static_cast<sf::Uint64>(offset.asMicroseconds()) * getNativeSampleRate() / 1000000;
+            pcm.seek(frame * getChannelCount());
+        }
+        else {
+            file.seek(offset);
+        }
+    }
+
+    void rewind() {
+        restart();
+        if (direct) {
+            pcm.seek(0);
+        }
+        else {
+            file.seek(0);
+        }
+    }
+
+    // Interleaved samples left before the end of the track, at the rate they are delivered
+    sf::Uint64 getRemainingSamples() const {
+        sf::Uint64 remaining = direct ? pcm.getSampleCount() - pcm.getSampleOffset() : file.getSampleCount() - file.getSampleOffset();
+        if (!resampler) {
+            return remaining;
+        }
+        sf::Uint64 frames = remaining / getChannelCount() * resampler->getOutputRate() / resampler->getInputRate();
+        return (frames + resampler->getAvailableFrames()) * getChannelCount();
+    }
+
+    // True if this source can follow other without reinitializing the output
+    bool sameFormat(const TrackSource& other) const {
+        return getChannelCount() == other.getChannelCount() && getSampleRate() == other.getSampleRate();
+    }
+
+    // Getters
+    unsigned int getChannelCount() const {
+        return file.getChannelCount();
+    }
+
+    // Rate of the samples read() delivers
+    unsigned int getSampleRate() const {
+        return resampler ? resampler->getOutputRate() : file.getSampleRate();
+    }
+
+    unsigned int getNativeSampleRate() const {
+        return file.getSampleRate();
+    }
+
+    sf::Time getDuration() const {
+        return file.getDuration();
+    }
+
+    const std::string& getPath() const {
+        return path;
+    }
+
+private:
+    // Reads at the native rate
+    std::size_t decode(float* samples, std::size_t count) {
+        if (direct) {
+            return pcm.read(samples, count);
+        }
+        scratch.resize(count);
+        std::size_t read = static_cast<std::size_t>(file.read(scratch.data(), count));
+        SampleKernels::get().int16ToFloat(scratch.data(), samples, read);
+        return read;
+    }
+
+    // Reads at the output rate through the resampler, feeding it as needed
+    std::size_t resample(float* samples, std::size_t count) {
+        std::size_t frames = count / getChannelCount();
+        std::size_t produced = 0;
+        while (true) {
+            produced += resampler->read(samples + produced * getChannelCount(), frames - produced);
+            if (produced == frames || drained) {
+                break;
+            }
+            // Refill in blocks of about 20 ms at the source rate
+            std::size_t block = (getNativeSampleRate() / 50 + 1) * getChannelCount();
+            decoded.resize(block);
+            std::size_t read = decode(decoded.data(), block);
+            if (read == 0) {
+                resampler->finish();
+                drained = true;
+            }
+            resampler->write(decoded.data(), read / getChannelCount());
+        }
+        return produced * getChannelCount();
+    }
+
+    void restart() {
+        if (resampler) {
+            resampler->reset();
+        }
+        drained = false;
+    }
+
+    MappedInputStream stream;  // Must outlive file and pcm, which read through it
+    sf::InputSoundFile file;
+    MappedPcmDecoder pcm;      // Used instead of file for uncompressed sources
+    std::unique_ptr<Resampler> resampler;
+    std::vector<sf::Int16> scratch;
+    std::vector<float> decoded;  // Native-rate block waiting to go into the resampler
+    std::string path;
+    bool direct;
+    bool drained;                // Resampler has been given the end of the track
+    float gain;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// How often and when each track was played, and when it joined the library, by track id (see
+// TrackCatalog::getId()). Times are seconds since the Unix epoch, 0 for never/unknown. Kept in
+// memory as one column per field and on disk as those columns back to back, read in one go at
+// startup and rewritten on exit.
+class TrackStats {
+public:
+    explicit TrackStats(const std::string& storePath) : storePath(storePath), changed(false) {}
+
+    // Reads the stored stats, returns false if there were none
+    bool load() {
+        std::ifstream file(storePath, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::uint32_t header[2];
+        if (data.size() < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(header, data.data(), sizeof(header));
+        std::size_t count = header[1];
+        if (header[0] != magic || data.size() != sizeof(header) + count * rowBytes) {
+            return false;
+        }
+        const char* at = data.data() + sizeof(header);
+        playCounts.resize(count);
+        lastPlayed.resize(count);
+        added.resize(count);
+        std::memcpy(playCounts.data(), at, count * sizeof(std::uint32_t));
+        std::memcpy(lastPlayed.data(), at + count * sizeof(std::uint32_t), count * sizeof(std::int64_t));
+        std::memcpy(added.data(), at + count * (sizeof(std::uint32_t) + sizeof(std::int64_t)), count * sizeof(std::int64_t));
+        changed = false;
+        return true;
+    }
+
+    // Writes the stats if they changed since load()
+    bool save() {
+        if (!changed) {
+            return true;
+        }
+        std::string temporary = storePath + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            std::uint32_t header[2] = { magic, static_cast<std::uint32_t>(playCounts.size()) };
+            file.write(reinterpret_cast<const char*>(header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(playCounts.data()), static_cast<std::streamsize>(playCounts.size() * sizeof(std::uint32_t)));
+            file.write(reinterpret_cast<const char*>(lastPlayed.data()), static_cast<std::streamsize>(lastPlayed.size() * sizeof(std::int64_t)));
+            file.write(reinterpret_cast<const char*>(added.data()), static_cast<std::streamsize>(added.size() * sizeof(std::int64_t)));
+            if (!file) {
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, storePath, error);
+        changed = static_cast<bool>(error);
+        return !error;
+    }
+
+    // Records id as joining the library at now, unless it is known already
+    void noteAdded(std::uint32_t id, std::int64_t now) {
+        grow(id);
+        if (added[id] == 0) {
+            added[id] = now;
+            changed = true;
+        }
+    }
+
+    void countPlay(std::uint32_t id, std::int64_t now) {
+        grow(id);
+        ++playCounts[id];
+        lastPlayed[id] = now;
+        changed = true;
+    }
+
+    static std::int64_t now() {
+        return static_cast<std::int64_t>(std::time(nullptr));
+    }
+
+    // Getters
+    unsigned int getPlayCount(std::uint32_t id) const {
+        return (id < playCounts.size()) ? playCounts[id] : 0;
+    }
+
+    std::int64_t getLastPlayed(std::uint32_t id) const {
+        return (id < lastPlayed.size()) ? lastPlayed[id] : 0;
+    }
+
+    std::int64_t getAdded(std::uint32_t id) const {
+        return (id < added.size()) ? added[id] : 0;
+    }
+
+private:
+    static constexpr std::uint32_t magic = 0x31545354;  // "TST1"
+    static constexpr std::size_t rowBytes = sizeof(std::uint32_t) + 2 * sizeof(std::int64_t);
+
+    void grow(std::uint32_t id) {
+        if (id >= playCounts.size()) {
+            playCounts.resize(id + std::size_t(1), 0);
+            lastPlayed.resize(id + std::size_t(1), 0);
+            added.resize(id + std::size_t(1), 0);
+        }
+    }
+
+    std::string storePath;
+    // Columns, by id
+    std::vector<std::uint32_t> playCounts;
+    std::vector<std::int64_t> lastPlayed;
+    std::vector<std::int64_t> added;
+    bool changed;
+};
@@ -4,13 +4,40 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <random>
-#include <ctime>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "DspChain.hpp"
+#include "Equalizer.hpp"
+#include "FacetIndex.hpp"
+#include "FuzzySearcher.hpp"
+#include "LibraryIndex.hpp"
+#include "LibraryScanner.hpp"
+#include "LibraryWatcher.hpp"
+#include "Loudness.hpp"
+#include "MappedSoundFile.hpp"
+#include "PlaybackStream.hpp"
+#include "PlaylistFiles.hpp"
+#include "PlaylistStore.hpp"
+#include "PlayQueue.hpp"
+#include "SearchIndex.hpp"
+#include "SmartPlaylist.hpp"
+#include "ThreadPool.hpp"
+#include "TrackCatalog.hpp"
+#include "TrackIds.hpp"
+#include "TrackLoader.hpp"
+#include "TrackSource.hpp"
+#include "TrackStats.hpp"
+#include "Waveform.hpp"
 
 enum class Page {
     Home,
     MusicLibrary,
-    Playlists
+    Playlists,
+    Queue
 };
 
 class AudioPlayer {
@@ -28,83 +55,312 @@ public:
 
 class MusicPlayer : public AudioPlayer {
 public:
-    MusicPlayer(const std::vector<std::string>& musicFiles)
-        : musicFiles(musicFiles), currentIndex(0), isLooping(false), isShuffled(false) {
-        if (!musicFiles.empty()) {
-            music.openFromFile(musicFiles[currentIndex]);
+    // Plays the music under root, listed from the library index so startup doesn't wait for a scan
+    explicit MusicPlayer(const std::string& root)
+        : isLooping(false), isShuffled(false), isLoading(false), isPreloading(false), playWhenLoaded(false), failedLoads(0), skippedUpcoming(0),
+          volume(1.0f), isMuted(false), loudness("Loudness.txt"), normalization(LoudnessLibrary::Track), waveforms("Waveforms.bin"),
+          stats("Stats.bin"), playingId(noTrack), hearingId(0), isCounted(true), analyzedLate(false), trackIds("TrackIds.log"), libraryVersion(0), searchBuilt(false), isCopyingCatalog(false), isSetUp(false), searchVersion(0), isFiltered(false) {
+        // Output processing, in order; the limiter comes last so nothing before it can clip
+        gainStage = dsp.add(std::unique_ptr<GainStage>(new GainStage));
+        balanceStage = dsp.add(std::unique_ptr<BalanceStage>(new BalanceStage));
+        equalizer = dsp.add(std::unique_ptr<EqualizerStage>(new EqualizerStage));
+        dsp.add(std::unique_ptr<LimiterStage>(new LimiterStage));
+
+        // The first run has no index to show yet and scans up front; later runs show the index and
+        // let the watcher check it against the folder. Without a watcher the index is refreshed here.
+        // Ids are logged as they're handed out, so a lost index doesn't hand them to other tracks
+        bool fresh = !libraryIndex.open(indexFile);
+        if (!fresh && !trackIds.exists()) {
+            for (std::size_t i = 0; i < libraryIndex.getTrackCount(); ++i) {
+                trackIds.add(libraryIndex.getPath(i), libraryIndex.getId(i));  // An index from before the log
+            }
+            trackIds.flush();
+        }
+        if (fresh) {
+            LibraryIndex::refresh(indexFile, root, pool, &trackIds);
+            libraryIndex.open(indexFile);
+        }
+        if (!watcher.start(root, indexFile) && !fresh) {
+            LibraryIndex::refresh(indexFile, root, pool, &trackIds);
+            libraryIndex.open(indexFile);
+        }
+        libraryIndex.fill(catalog);
+        queueLibrary();
+        buildSearch();  // Reads the stats and runs the smart playlist rules first
+
+        if (queue.getCount() > 0) {
+            loader.request(trackAt(queue.getCurrent()));
+            isLoading = true;
+        }
+
+        // Measure tracks that have no stored loudness or waveform yet, on every core, without holding
+        // up playback; each is decoded once for both. Until the stored results are read the gains in
+        // the index stand in
+        analysis = std::thread([this] {
+            std::vector<std::string> files = libraryIndex.getPaths();
+            loudness.load();
+            waveforms.load();
+            loudness.analyze(files, pool, &waveforms);
+            loudness.save();
+            waveforms.save();
+        });
+    }
+
+    // Rewrites the index with the tracks the watcher saw and the gains measured meanwhile
+    ~MusicPlayer() override {
+        loudness.cancel();
+        analysis.join();
+        if (analyzedLate) {
+            pool.wait();  // The cancelled jobs return at their next block
+            loudness.save();
+            waveforms.save();
+        }
+        if (searchBuilder.joinable()) {
+            searchBuilder.join();
+        }
+        watcher.stop();
+        stats.save();
+        std::vector<TrackInfo> tracks;
+        if (watcher.getTracks(tracks)) {
+            LibraryIndex::write(indexFile, tracks, libraryIndex, &loudness, &catalog, &trackIds);
         }
-        std::srand(std::time(nullptr));  // Seed for shuffling
     }
 
     void play() override {
-        if (music.getStatus() != sf::Music::Playing) {
-            music.play();
+        playWhenLoaded = true;
+        if (stream && !isLoading && stream->getStatus() != sf::SoundStream::Playing) {
+            stream->play();
         }
     }
 
     void pause() override {
-        if (music.getStatus() == sf::Music::Playing) {
-            music.pause();
+        playWhenLoaded = false;
+        if (stream && stream->getStatus() == sf::SoundStream::Playing) {
+            stream->pause();
         }
     }
 
     void stop() override {
-        music.stop();
+        playWhenLoaded = false;
+        if (stream) {
+            stream->stop();
+        }
     }
 
     void next() override {
-        if (isShuffled && !shuffleIndices.empty()) {
-            currentIndex = (currentIndex + 1) % shuffleIndices.size();
-            music.openFromFile(musicFiles[shuffleIndices[currentIndex]]);
-        }
-        else {
-            currentIndex = (currentIndex + 1) % musicFiles.size();
-            music.openFromFile(musicFiles[currentIndex]);
+        if (queue.getCount() == 0) {
+            return;
         }
-        play();
+        queue.advance(1);
+        switchTo(queue.getCurrent());
     }
 
     void previous() override {
-        if (isShuffled && !shuffleIndices.empty()) {
-            currentIndex = (currentIndex == 0) ? shuffleIndices.size() - 1 : currentIndex - 1;
-            music.openFromFile(musicFiles[shuffleIndices[currentIndex]]);
+        if (queue.getCount() == 0) {
+            return;
         }
-        else {
-            currentIndex = (currentIndex == 0) ? musicFiles.size() - 1 : currentIndex - 1;
-            music.openFromFile(musicFiles[currentIndex]);
-        }
-        play();
+        queue.advance(-1);
+        switchTo(queue.getCurrent());
     }
 
     void loop(bool loop) override {
         isLooping = loop;
-        music.setLoop(loop);
+        if (stream) {
+            stream->setRepeat(loop);
+        }
     }
 
+    // Shuffles the queue, or puts the whole library back in path order; the current track stays
+    // current either way
     void shuffle(bool shuffle) override {
         isShuffled = shuffle;
+        if (queue.getCount() == 0) {
+            return;
+        }
         if (shuffle) {
-            shuffleIndices = std::vector<int>(musicFiles.size());
-            for (int i = 0; i < musicFiles.size(); ++i) {
-                shuffleIndices[i] = i;
-            }
-            std::random_shuffle(shuffleIndices.begin(), shuffleIndices.end());
-            currentIndex = 0;
+            queue.shuffle();
         }
         else {
-            shuffleIndices.clear();
-            currentIndex = 0;
+            std::uint32_t playing = queue.at(queue.getCurrent());
+            queueLibrary();
+            queue.setCurrent(queue.find(playing));
+        }
+        if (stream) {
+            preloadNext();  // The queued track no longer follows in the new order
         }
     }
 
+    // Plays a catalog row, from wherever it is in the queue (put back at the end if it was taken out)
     void playSong(int index) override {
-        if (index >= 0 && index < musicFiles.size()) {
-            currentIndex = index;
-            music.openFromFile(musicFiles[currentIndex]);
-            play();
+        if (index >= 0 && static_cast<std::size_t>(index) < catalog.getCount()) {
+            std::uint32_t id = catalog.getId(index);
+            if (!queue.contains(id)) {
+                queue.insert(queue.getCount(), id);
+            }
+            queue.setCurrent(queue.find(id));
+            switchTo(queue.getCurrent());
+        }
+    }
+
+    // Plays the queue entry at position
+    void playQueued(std::size_t position) {
+        if (position < queue.getCount()) {
+            queue.setCurrent(position);
+            switchTo(position);
+        }
+    }
+
+    // Queues a catalog row to play after the current track, ahead of what was queued before
+    void playNext(std::size_t row) {
+        queue.playNext(catalog.getId(row));
+        queueChanged();
+    }
+
+    // Queues a catalog row to play after the current track and what was queued before it
+    void enqueue(std::size_t row) {
+        queue.enqueue(catalog.getId(row));
+        queueChanged();
+    }
+
+    // Drags the queue entry at from to position to
+    void moveQueued(std::size_t from, std::size_t to) {
+        queue.move(from, to);
+        queueChanged();
+    }
+
+    // Takes the queue entry at position out; taking out the current one leaves it playing
+    void removeQueued(std::size_t position) {
+        queue.removeAt(position);
+        queueChanged();
+    }
+
+    // Overlap consecutive tracks by this long, between 0 (back to back) and 12 seconds
+    void setCrossfade(sf::Time duration) {
+        crossfade = std::max(sf::Time::Zero, std::min(duration, sf::seconds(12.0f)));
+        if (stream) {
+            stream->setCrossfade(crossfade);
+        }
+    }
+
+    // Volume between 0 (silent) and 1 (unchanged), on a cubic curve so equal steps sound about equally loud
+    void setVolume(float level) {
+        volume = std::max(0.0f, std::min(1.0f, level));
+        applyVolume();
+    }
+
+    void setMuted(bool muted) {
+        isMuted = muted;
+        applyVolume();
+    }
+
+    // From -1 (left only) to 1 (right only)
+    void setBalance(float balance) {
+        balanceStage->setBalance(balance);
+    }
+
+    // Boost or cut one of the equalizer's octave bands (0 = 31 Hz ... 9 = 16 kHz) by up to 24 dB;
+    // other bands are ignored
+    void setEqualizerGain(int band, float gainDb) {
+        if (band >= 0) {
+            equalizer->setGain(static_cast<std::size_t>(band), gainDb);
         }
     }
 
+    // Jump to offset in the track being heard; ignored for the moment between a track's last
+    // samples being decoded and it ending
+    void seek(sf::Time offset) {
+        if (stream && !isLoading) {
+            stream->seekTrack(std::max(sf::Time::Zero, offset));
+        }
+    }
+
+    // Level tracks by their measured loudness, per track or per album; applies from the next track loaded
+    void setNormalization(LoudnessLibrary::Mode mode) {
+        normalization = mode;
+    }
+
+    // Output processing chain, for adding stages before playback starts
+    DspChain& getDsp() {
+        return dsp;
+    }
+
+    // Call once per frame: swaps in tracks the loader has opened and keeps the
+    // following track queued on the stream so it starts without a gap.
+    void update() {
+        sf::Clock clock;
+        std::vector<LibraryWatcher::Change> changes;
+        if (watcher.poll(changes)) {
+            pendingChanges.insert(pendingChanges.end(), changes.begin(), changes.end());
+        }
+        if (!pendingChanges.empty() && !isCopyingCatalog.load()) {
+            applyChanges();
+        }
+        if (searchBuilt.load()) {
+            searchBuilder.join();
+            searchBuilt.store(false);
+            if (searchVersion == libraryVersion) {
+                fuzzySearcher.reset();  // It reads the index being replaced
+                searchIndex = std::move(builtSearch);
+                facets = std::move(builtFacets);
+                fuzzySearcher.reset(new FuzzySearcher(*searchIndex));
+            }
+            else {
+                buildSearch();  // The library changed while it was built
+            }
+        }
+
+        std::unique_ptr<TrackSource> loaded;
+        if (isLoading && loader.poll(loaded)) {
+            isLoading = false;
+            if (loaded) {
+                failedLoads = 0;
+                normalize(*loaded);
+                begin(std::move(loaded));
+            }
+            else {
+                skipUnreadable();
+            }
+        }
+
+        if (stream && !isLoading) {
+            // Follow the stream across gapless transitions
+            int transitions = stream->takeTransitions();
+            if (transitions > 0 && queue.getCount() > 0) {
+                queue.advance(transitions + skippedUpcoming);  // Over the entries that wouldn't preload too
+                markPlaying();
+                preloadNext();
+            }
+
+            if (isPreloading && loader.poll(loaded, TrackLoader<TrackSource>::Upcoming)) {
+                isPreloading = false;
+                if (loaded) {
+                    normalize(*loaded);
+                    stream->setNext(std::move(loaded));
+                }
+                else if (++skippedUpcoming < queue.getCount()) {
+                    requestUpcoming();  // Unreadable; try the one after it instead
+                }
+                else {
+                    skippedUpcoming = 0;  // Nothing else opens, so the queue ends with this track
+                }
+            }
+
+            // The next track couldn't be joined on (different channel count, or it wasn't ready in time)
+            if (!isPreloading && stream->hasEnded() && stream->getStatus() == sf::SoundStream::Stopped) {
+                std::unique_ptr<TrackSource> upcoming = stream->takeNext();
+                if (upcoming && queue.getCount() > 0) {
+                    queue.advance(1 + skippedUpcoming);
+                    startStream(std::move(upcoming));
+                }
+            }
+            countPlay();
+        }
+        if (isSetUp.load()) {
+            smartPlaylists.tick(catalog, stats, TrackStats::now());
+        }
+        recordStall(clock.getElapsedTime());
+    }
+
     // Getters
     bool getIsLooping() const {
         return isLooping;
@@ -114,37 +370,537 @@ public:
         return isShuffled;
     }
 
-    sf::Music::Status getStatus() const {
-        return music.getStatus();
+    sf::SoundStream::Status getStatus() const {
+        return stream ? stream->getStatus() : sf::SoundStream::Stopped;
+    }
+
+    sf::Time getCrossfade() const {
+        return crossfade;
+    }
+
+    float getVolume() const {
+        return volume;
+    }
+
+    bool getIsMuted() const {
+        return isMuted;
+    }
+
+    float getBalance() const {
+        return balanceStage->getBalance();
+    }
+
+    float getEqualizerGain(int band) const {
+        return (band >= 0) ? equalizer->getGain(static_cast<std::size_t>(band)) : 0.0f;
+    }
+
+    LoudnessLibrary::Mode getNormalization() const {
+        return normalization;
+    }
+
+    // The library as it is now, in path order; playSong() takes its rows
+    const TrackCatalog& getCatalog() const {
+        return catalog;
+    }
+
+    // The play order, as track ids; playQueued() and the other queue edits take its positions
+    const PlayQueue& getQueue() const {
+        return queue;
+    }
+
+    // Fills rows with the catalog rows matching query (see SearchIndex), in catalog order, and
+    // starts a typo-tolerant search for it in the background (see pollSearch()). Facets in the
+    // query (see FacetIndex) narrow both down. Returns false while the search index is still
+    // being built after startup.
+    bool search(std::string_view query, std::vector<std::uint32_t>& rows) {
+        if (!searchIndex) {
+            return false;
+        }
+        isFiltered = facets->filter(query, queryText, facetFilter);
+        bool hasWords = false;
+        SearchIndex::forEachWord(queryText, [&hasWords](std::string_view) { hasWords = true; });
+        if (isFiltered && !hasWords) {
+            facetFilter.toVector(filteredIds);  // Facets alone, no need to look at every row
+            searchIndex->toRows(filteredIds, nullptr, catalog, rows);
+        }
+        else {
+            searchIndex->search(queryText, catalog, rows);
+            if (isFiltered) {
+                rows.erase(std::remove_if(rows.begin(), rows.end(), [this](std::uint32_t row) { return !facetFilter.contains(catalog.getId(row)); }),
+                           rows.end());
+            }
+        }
+        fuzzySearcher->submit(queryText);
+        return true;
+    }
+
+    // Once the typo-tolerant search for the last query is done, fills rows with what it found,
+    // closest matches first. Exact matches are among them, so they replace what search() gave.
+    bool pollSearch(std::vector<std::uint32_t>& rows) {
+        if (!fuzzySearcher || !fuzzySearcher->poll(fuzzyIds, fuzzyScores)) {
+            return false;
+        }
+        if (isFiltered) {
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < fuzzyIds.size(); ++i) {
+                fuzzyIds[kept] = fuzzyIds[i];
+                fuzzyScores[kept] = fuzzyScores[i];
+                kept += facetFilter.contains(fuzzyIds[i]) ? 1 : 0;
+            }
+            fuzzyIds.resize(kept);
+            fuzzyScores.resize(kept);
+        }
+        searchIndex->toRows(fuzzyIds, fuzzyScores.data(), catalog, rows);
+        return true;
+    }
+
+    // Makes playlist a smart playlist following rule (see SmartRule); false if rule doesn't parse.
+    // Until the library is set up the rule waits its turn there.
+    bool defineSmartPlaylist(std::uint32_t playlist, std::string_view rule) {
+        {
+            std::lock_guard<std::mutex> lock(setUpMutex);
+            if (!isSetUp.load()) {
+                SmartRule parsed;
+                if (!parsed.parse(rule)) {
+                    return false;
+                }
+                pendingRules.emplace_back(playlist, std::string(rule));
+                return true;
+            }
+        }
+        return smartPlaylists.define(playlist, rule, catalog, stats, TrackStats::now());
+    }
+
+    void forgetSmartPlaylist(std::uint32_t playlist) {
+        {
+            std::lock_guard<std::mutex> lock(setUpMutex);
+            if (!isSetUp.load()) {
+                pendingRules.emplace_back(playlist, std::string());
+                return;
+            }
+        }
+        smartPlaylists.forget(playlist);
+    }
+
+    // Track ids in a smart playlist now (none until the library is set up), or nullptr if playlist isn't one
+    const std::vector<std::uint32_t>* getSmartTracks(std::uint32_t playlist) {
+        return isSetUp.load() ? smartPlaylists.getTracks(playlist) : &noTracks;
+    }
+
+    // Path of the current track, empty if the library is empty
+    std::string getCurrentPath() const {
+        std::size_t row = playingRow();
+        return (row != TrackCatalog::npos) ? std::string(catalog.getPath(row)) : std::string();
+    }
+
+    sf::Time getCurrentDuration() const {
+        std::size_t row = playingRow();
+        return (row != TrackCatalog::npos) ? catalog.getDuration(row) : sf::Time::Zero;
+    }
+
+    // Position within the current track
+    sf::Time getPlayingOffset() const {
+        return (stream && !isLoading) ? stream->getTrackOffset() : sf::Time::Zero;
+    }
+
+    const WaveformLibrary& getWaveforms() const {
+        return waveforms;
+    }
+
+    // Changes whenever the watcher adds or removes songs, so the UI knows its rows moved
+    int getLibraryVersion() const {
+        return libraryVersion;
+    }
+
+    // Longest time a track change has held up the caller (the event loop)
+    sf::Time getMaxStall() const {
+        return maxStall;
     }
 
 private:
-    sf::Music music;
-    std::vector<std::string> musicFiles;
-    std::vector<int> shuffleIndices;
-    int currentIndex;
+    // Catalog row of the queue entry at position
+    std::size_t rowAt(std::size_t position) const {
+        return catalog.findId(queue.at(position));
+    }
+
+    std::string trackAt(std::size_t position) const {
+        return std::string(catalog.getPath(rowAt(position)));
+    }
+
+    // Fills the queue with the whole library in path order
+    void queueLibrary() {
+        std::vector<std::uint32_t> ids(catalog.getCount());
+        for (std::size_t row = 0; row < ids.size(); ++row) {
+            ids[row] = catalog.getId(row);
+        }
+        queue.assign(ids);
+    }
+
+    void queueChanged() {
+        if (stream && queue.getCount() > 0) {
+            preloadNext();  // The following track may be another one now
+        }
+    }
+
+    // Start the track at position, straight from the preloaded one when it matches
+    void switchTo(std::size_t position) {
+        sf::Clock clock;
+        playWhenLoaded = true;
+        std::unique_ptr<TrackSource> preloaded;
+        if (stream && !isLoading) {
+            preloaded = stream->takeNext();
+        }
+        if (preloaded && preloaded->getPath() == trackAt(position)) {
+            begin(std::move(preloaded));
+        }
+        else {
+            loader.request(trackAt(position));
+            isLoading = true;
+        }
+        recordStall(clock.getElapsedTime());
+    }
+
+    // Crossfades into source when possible, otherwise starts it on a fresh stream
+    void begin(std::unique_ptr<TrackSource> source) {
+        if (stream && crossfade > sf::Time::Zero && stream->getStatus() == sf::SoundStream::Playing && stream->accepts(*source)) {
+            stream->crossfadeTo(std::move(source));
+            markPlaying();
+            preloadNext();
+        }
+        else {
+            startStream(std::move(source));
+        }
+    }
+
+    void startStream(std::unique_ptr<TrackSource> source) {
+        if (stream) {
+            stream->pause();
+            stream->setDsp(nullptr);
+            loader.retire(std::move(stream));
+        }
+        source->resampleTo(source->getNativeSampleRate());  // It may have been queued on the old stream at its rate
+        stream.reset(new PlaybackStream(std::move(source)));
+        dsp.prepare(stream->getSampleRate(), stream->getChannelCount());
+        stream->setDsp(&dsp);
+        stream->setRepeat(isLooping);
+        stream->setCrossfade(crossfade);
+        if (playWhenLoaded) {
+            stream->play();
+        }
+        markPlaying();
+        preloadNext();
+    }
+
+    // The stream has moved on to the queue's current track; remember which one that is, since
+    // taking it out of the queue moves the current position but not what's heard
+    void markPlaying() {
+        playingId = (queue.getCount() > 0) ? queue.at(queue.getCurrent()) : noTrack;
+    }
+
+    // Catalog row of the track being heard (until a stream starts, the current one being loaded),
+    // or npos if it has left the library
+    std::size_t playingRow() const {
+        if (!stream) {
+            return (queue.getCount() > 0) ? rowAt(queue.getCurrent()) : TrackCatalog::npos;
+        }
+        return catalog.findId(playingId);
+    }
+
+    // A track counts as played once heard past half way or four minutes in, once per time it starts
+    void countPlay() {
+        std::size_t row = playingRow();
+        if (row == TrackCatalog::npos || !isSetUp.load()) {
+            return;
+        }
+        std::uint32_t id = catalog.getId(row);
+        sf::Time offset = stream->getTrackOffset();
+        if (id != hearingId || offset < sf::seconds(1.0f)) {
+            hearingId = id;
+            isCounted = false;  // A new track, or the same one from the top
+        }
+        sf::Time duration = catalog.getDuration(row);
+        if (!isCounted && duration > sf::Time::Zero && offset >= std::min(duration / 2.0f, sf::seconds(240.0f))) {
+            isCounted = true;
+            std::int64_t now = TrackStats::now();
+            stats.countPlay(id, now);
+            smartPlaylists.playCounted(catalog, row, stats, now);
+        }
+    }
+
+    // The queue's current track wouldn't open (the loader said why); moves on to the next one, and
+    // gives up and stops once every entry has failed in a row
+    void skipUnreadable() {
+        if (queue.getCount() > 0 && ++failedLoads < queue.getCount()) {
+            queue.advance(1);
+            switchTo(queue.getCurrent());
+            return;
+        }
+        std::cerr << "Nothing in the queue could be opened" << std::endl;
+        failedLoads = 0;
+        playWhenLoaded = false;
+        if (stream) {
+            stream->stop();
+        }
+    }
+
+    void preloadNext() {
+        skippedUpcoming = 0;
+        requestUpcoming();
+    }
+
+    // Preloads the entry after the current one and the unreadable ones skipped since preloadNext()
+    void requestUpcoming() {
+        if (queue.getCount() == 0) {
+            return;
+        }
+        loader.request(trackAt((queue.getCurrent() + 1 + skippedUpcoming) % queue.getCount()), TrackLoader<TrackSource>::Upcoming);
+        isPreloading = true;
+    }
+
+    // Indexes a copy of the catalog on its own thread, so startup doesn't wait for it; the copy is
+    // made there too, and the catalog is left alone (changes wait in pendingChanges) until it is.
+    // The first build sets up the library before that.
+    void buildSearch() {
+        searchVersion = libraryVersion;
+        isCopyingCatalog.store(true);
+        searchBuilder = std::thread([this] {
+            if (!isSetUp.load()) {
+                setUpLibrary();
+            }
+            TrackCatalog snapshot = catalog;
+            isCopyingCatalog.store(false);
+            builtSearch.reset(new SearchIndex);
+            builtSearch->rebuild(snapshot);
+            builtFacets.reset(new FacetIndex);
+            builtFacets->rebuild(snapshot);
+            searchBuilt.store(true);
+        });
+    }
+
+    // Reads the play stats, counts tracks without any as added now and runs the smart playlist rules
+    // over the library, on the search builder's thread. The UI thread keeps off stats and
+    // smartPlaylists until isSetUp, and the catalog holds still meanwhile.
+    void setUpLibrary() {
+        stats.load();
+        std::int64_t now = TrackStats::now();
+        for (std::size_t row = 0; row < catalog.getCount(); ++row) {
+            stats.noteAdded(catalog.getId(row), now);
+        }
+        while (true) {
+            std::vector<std::pair<std::uint32_t, std::string>> rules;
+            {
+                std::lock_guard<std::mutex> lock(setUpMutex);
+                if (pendingRules.empty()) {
+                    isSetUp.store(true);
+                    return;
+                }
+                rules.swap(pendingRules);
+            }
+            for (const auto& rule : rules) {
+                if (rule.second.empty()) {
+                    smartPlaylists.forget(rule.first);
+                }
+                else {
+                    smartPlaylists.define(rule.first, rule.second, catalog, stats, TrackStats::now());
+                }
+            }
+        }
+    }
+
+    // Applies up to changesPerFrame of the pending changes, in order, so a folder of thousands
+    // arriving at once is spread over a few frames. Removals in a row are gathered and taken out of
+    // the catalog together; an addition first flushes them, since it moves rows
+    void applyChanges() {
+        std::size_t count = std::min(pendingChanges.size(), changesPerFrame);
+        bool changed = false;
+        std::vector<std::size_t> rows;
+        for (std::size_t i = 0; i < count; ++i) {
+            const LibraryWatcher::Change& change = pendingChanges[i];
+            if (change.kind == LibraryWatcher::Change::Added) {
+                changed |= removeTracks(rows);
+                changed |= addTrack(change.track);
+            }
+            else {
+                catalog.findUnder(change.track.path, rows);
+            }
+        }
+        changed |= removeTracks(rows);
+        pendingChanges.erase(pendingChanges.begin(), pendingChanges.begin() + count);
+        if (changed) {
+            ++libraryVersion;
+            if (stream) {
+                preloadNext();  // The following track may have come or gone
+            }
+        }
+    }
+
+    // Inserts path in sorted order; the queue gets it after the track before it in path order,
+    // or at the end when shuffled
+    bool addTrack(const TrackInfo& track) {
+        std::size_t count = catalog.getCount();
+        std::uint32_t id = TrackIds::npos;
+        if (catalog.find(track.path) == TrackCatalog::npos) {
+            // A path seen before gets its old id back; a new id is logged before anything stores it
+            id = trackIds.find(track.path);
+            if (id == TrackIds::npos) {
+                id = std::max(catalog.getNextId(), trackIds.getNextId());
+                trackIds.add(track.path, id);
+                trackIds.flush();
+            }
+        }
+        int index = static_cast<int>(catalog.insert(track, id));
+        std::int64_t now = TrackStats::now();
+        stats.noteAdded(catalog.getId(index), now);
+        smartPlaylists.trackChanged(catalog, index, stats, now);
+        if (searchIndex) {
+            searchIndex->remove(catalog.getId(index));  // Its tags may have changed
+            searchIndex->add(catalog, index);
+            facets->remove(catalog.getId(index));
+            facets->add(catalog, index);
+        }
+        loudness.reanalyze(track.path, pool, &waveforms);  // New or rewritten, so its results are missing or stale
+        analyzedLate = true;
+        if (catalog.getCount() == count) {
+            return false;  // Rewritten in place
+        }
+        std::size_t before = (index > 0) ? queue.find(catalog.getId(index - 1)) : PlayQueue::npos;
+        std::size_t position = (!isShuffled && index == 0) ? 0 : (!isShuffled && before != PlayQueue::npos) ? before + 1 : queue.getCount();
+        queue.insert(position, catalog.getId(index));
+        return true;
+    }
+
+    // Removes the tracks at rows (found with TrackCatalog::findUnder(), possibly overlapping) and
+    // empties rows; the catalog closes the gaps in one pass
+    bool removeTracks(std::vector<std::size_t>& rows) {
+        if (rows.empty()) {
+            return false;
+        }
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+        for (std::size_t index : rows) {
+            std::uint32_t id = catalog.getId(index);
+            // Removing the current track leaves it playing; the one before it becomes current so next() follows on
+            queue.remove(id);
+            if (searchIndex) {
+                searchIndex->remove(id);
+                facets->remove(id);
+            }
+            smartPlaylists.trackRemoved(id);
+        }
+        catalog.erase(rows);
+        rows.clear();
+        return true;
+    }
+
+    void normalize(TrackSource& source) {
+        const std::string& path = source.getPath();
+        if (loudness.has(path) || normalization == LoudnessLibrary::Off) {
+            source.setGain(loudness.getGain(path, normalization));
+            return;
+        }
+        int stored = libraryIndex.find(path);
+        float gainDb = (stored < 0) ? NAN : (normalization == LoudnessLibrary::Album) ? libraryIndex.getAlbumGain(stored) : libraryIndex.getTrackGain(stored);
+        source.setGain(std::isnan(gainDb) ? 1.0f : std::pow(10.0f, gainDb / 20.0f));
+    }
+
+    void applyVolume() {
+        gainStage->setGain(isMuted ? 0.0f : volume * volume * volume);
+    }
+
+    void recordStall(sf::Time elapsed) {
+        if (elapsed > maxStall) {
+            maxStall = elapsed;
+        }
+    }
+
+    DspChain dsp;  // Declared before stream so it outlives it
+    GainStage* gainStage;
+    BalanceStage* balanceStage;
+    EqualizerStage* equalizer;
+    TrackLoader<TrackSource> loader;
+    std::unique_ptr<PlaybackStream> stream;
+    TrackCatalog catalog;
+    PlayQueue queue;
     bool isLooping;
     bool isShuffled;
+    bool isLoading;
+    bool isPreloading;
+    bool playWhenLoaded;
+    std::size_t failedLoads;      // Queue entries skipped in a row because they wouldn't open
+    std::size_t skippedUpcoming;  // Entries after the current one passed over because they wouldn't preload
+    sf::Time crossfade;
+    float volume;
+    bool isMuted;
+    ThreadPool pool;
+    LoudnessLibrary loudness;
+    LoudnessLibrary::Mode normalization;
+    WaveformLibrary waveforms;
+    TrackStats stats;
+    SmartPlaylists smartPlaylists;
+    static constexpr std::uint32_t noTrack = 0xFFFFFFFFu;
+    std::uint32_t playingId;  // Track the stream is playing, or noTrack
+    std::uint32_t hearingId;  // Track countPlay() last saw playing
+    bool isCounted;           // Whether that play has been counted
+    std::thread analysis;  // Runs loudness.analyze() over the library, summarizing waveforms as it goes
+    bool analyzedLate;     // Whether addTrack() queued tracks after it, so they're saved on exit
+    const std::string indexFile = "Library.idx";
+    TrackIds trackIds;  // Every id handed out, by path; outlives a lost or stale index
+    LibraryIndex libraryIndex;  // As of startup; the watcher reports what changed since
+    LibraryWatcher watcher;
+    std::deque<LibraryWatcher::Change> pendingChanges;  // Polled but not yet applied
+    const std::size_t changesPerFrame = 256;
+    int libraryVersion;
+    std::unique_ptr<SearchIndex> searchIndex;  // Null until the first build is done
+    std::unique_ptr<SearchIndex> builtSearch;  // Handed over from searchBuilder
+    std::unique_ptr<FacetIndex> facets;        // Built and handed over with searchIndex
+    std::unique_ptr<FacetIndex> builtFacets;
+    std::thread searchBuilder;
+    std::atomic<bool> searchBuilt;
+    std::atomic<bool> isCopyingCatalog;        // The builder is still copying the catalog
+    std::atomic<bool> isSetUp;                 // Stats read and smart playlists defined (see setUpLibrary())
+    std::mutex setUpMutex;                     // Guards pendingRules and the moment isSetUp turns true
+    std::vector<std::pair<std::uint32_t, std::string>> pendingRules;  // Smart playlist rules (empty to forget) for setUpLibrary()
+    const std::vector<std::uint32_t> noTracks;
+    int searchVersion;                         // libraryVersion the build started from
+    std::unique_ptr<FuzzySearcher> fuzzySearcher;  // Reads searchIndex, so declared after it
+    std::vector<std::uint32_t> fuzzyIds;
+    std::vector<std::uint8_t> fuzzyScores;
+    std::string queryText;     // Last query without its facets
+    Bitmap facetFilter;        // Ids passing the last query's facets, if isFiltered
+    bool isFiltered;
+    std::vector<std::uint32_t> filteredIds;
+    sf::Time maxStall;
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Read uncompressed tracks straight out of memory-mapped files (must precede any file open)
+    sf::SoundFileFactory::registerReader<MappedPcmReader>();
+
     // Create the main window
     sf::RenderWindow window(sf::VideoMode(1000, 600), "SFML Music Player");
 
     // Create the music player
-    std::vector<std::string> musicFiles = {
-        "Songs/Aparibhasit.wav",
-        "Songs/High Hopes.wav",
-        "Songs/Otherside.wav"
-    };
-    MusicPlayer player(musicFiles);
+    sf::Clock startup;
+    MusicPlayer player(argc > 1 ? argv[1] : "Songs");
+    std::cout << "Library of " << player.getCatalog().getCount() << " tracks ready in "
+              << startup.getElapsedTime().asMilliseconds() << " ms" << std::endl;
 
-    // Initialize playlists
-    std::vector<std::string> playlists = {
-        "Favorites",
-        "Chill Vibes",
-        "Workout Mix"
-    };
+    // Playlists, logged to disk edit by edit (see PlaylistStore); the first run starts with a few
+    // empty ones and a few smart ones, which the player keeps up to date (see SmartPlaylists)
+    PlaylistStore playlists("Playlists.log");
+    if (!playlists.open()) {
+        for (const char* name : { "Favorites", "Chill Vibes", "Workout Mix" }) {
+            playlists.create(name);
+        }
+        for (const char* rule : { "played > 10 times", "added last 30 days", "genre = rock and duration < 5 min" }) {
+            playlists.setRule(playlists.create(rule), rule);
+        }
+    }
+    for (const Playlist& playlist : playlists.getPlaylists()) {
+        if (!playlist.rule.empty()) {
+            player.defineSmartPlaylist(playlist.id, playlist.rule);
+        }
+    }
 
     // Load button images
     sf::Texture playTexture, pauseTexture, nextTexture, prevTexture, shuffleTexture, loopTexture, volumeTexture, settingsTexture;
@@ -190,9 +946,10 @@ int main() {
     contentArea.setPosition(200.0f, 0.0f);
     contentArea.setFillColor(sf::Color(40, 40, 40));
 
-    // Media control bar
-    sf::RectangleShape controlBar(sf::Vector2f(window.getSize().x, 60.0f));
-    controlBar.setPosition(0.0f, window.getSize().y - 60.0f);
+    // Media control bar, with the waveform seek bar above the buttons
+    const float controlBarHeight = 90.0f;
+    sf::RectangleShape controlBar(sf::Vector2f(window.getSize().x, controlBarHeight));
+    controlBar.setPosition(0.0f, window.getSize().y - controlBarHeight);
     controlBar.setFillColor(sf::Color(20, 20, 20));
 
     // Set button positions
@@ -220,7 +977,25 @@ int main() {
         return -1;
     }
 
-    std::vector<std::string> sidebarOptions = { "Home", "Playlists" };
+    // Crossfade length, cycled by the settings button
+    const float crossfadeChoices[] = { 0.0f, 3.0f, 6.0f, 12.0f };
+    int crossfadeChoice = 0;
+    sf::Text crossfadeText;
+    crossfadeText.setFont(font);
+    crossfadeText.setString("Crossfade off");
+    crossfadeText.setCharacterSize(14);
+    crossfadeText.setFillColor(sf::Color(180, 180, 180));
+    crossfadeText.setPosition(windowWidth - 210, yPosition + 12);
+
+    // Volume, changed with the mouse wheel over the volume button; clicking it mutes
+    sf::Text volumeText;
+    volumeText.setFont(font);
+    volumeText.setString("Volume 100%");
+    volumeText.setCharacterSize(14);
+    volumeText.setFillColor(sf::Color(180, 180, 180));
+    volumeText.setPosition(windowWidth - 310, yPosition + 12);
+
+    std::vector<std::string> sidebarOptions = { "Home", "Playlists", "Queue" };
     std::vector<sf::Text> sidebarTexts;
 
     for (size_t i = 0; i < sidebarOptions.size(); ++i) {
@@ -233,17 +1008,142 @@ int main() {
         sidebarTexts.push_back(text);
     }
 
-    // Song buttons
-    std::vector<sf::Text> songButtons;
-    for (size_t i = 0; i < musicFiles.size(); ++i) {
-        sf::Text songButton;
-        songButton.setFont(font);
-        songButton.setString(musicFiles[i]);
-        songButton.setCharacterSize(20);
-        songButton.setFillColor(sf::Color::White);
-        songButton.setPosition(220.0f, 60.0f + i * 40.0f);
-        songButtons.push_back(songButton);
-    }
+    // Search bar: click to type, Escape clears. Every keystroke filters the song list right away;
+    // a moment later the typo-tolerant matches, best first, take the exact ones' place. Facets
+    // such as artist:muse year:2000-2009 length:-4 narrow the list (see FacetIndex).
+    std::string searchQuery;  // UTF-8
+    bool searchFocused = false;
+    bool searchPending = false;  // Query typed before the search index was ready
+    std::vector<std::uint32_t> foundRows;
+    sf::Text searchText;
+    searchText.setFont(font);
+    searchText.setCharacterSize(16);
+    searchText.setPosition(16.0f, 15.0f);
+    auto showSearchText = [&] {
+        if (searchQuery.empty() && !searchFocused) {
+            searchText.setString("Search");
+            searchText.setFillColor(sf::Color(130, 130, 130));
+        }
+        else {
+            searchText.setString(sf::String::fromUtf8(searchQuery.begin(), searchQuery.end()) + (searchFocused ? "|" : ""));
+            searchText.setFillColor(sf::Color::White);
+        }
+    };
+    showSearchText();
+
+    // Song list: only the rows in view are drawn, all with one text object, so the list costs
+    // the same for any library size. The mouse wheel over it scrolls. With a search typed it
+    // lists the catalog rows found, otherwise the whole catalog.
+    const float songRowHeight = 40.0f;
+    const float songListTop = 60.0f;
+    const std::size_t visibleSongRows = static_cast<std::size_t>((windowHeight - controlBarHeight - songListTop) / songRowHeight);
+    std::size_t firstSongRow = 0;
+    int libraryVersion = player.getLibraryVersion();
+    sf::Text songRow;
+    songRow.setFont(font);
+    songRow.setCharacterSize(20);
+    songRow.setFillColor(sf::Color::White);
+    auto listedSongs = [&] {
+        return searchQuery.empty() ? player.getCatalog().getCount() : foundRows.size();
+    };
+    auto listedRow = [&](std::size_t i) {
+        return searchQuery.empty() ? i : static_cast<std::size_t>(foundRows[i]);
+    };
+    auto scrollSongs = [&](long rows) {
+        std::size_t count = listedSongs();
+        std::size_t last = (count > visibleSongRows) ? count - visibleSongRows : 0;
+        long first = static_cast<long>(firstSongRow) + rows;
+        firstSongRow = std::min(static_cast<std::size_t>(std::max(0L, first)), last);
+    };
+    auto runSearch = [&] {
+        if (searchQuery.empty()) {
+            foundRows.clear();
+            searchPending = false;
+        }
+        else {
+            searchPending = !player.search(searchQuery, foundRows);
+            if (searchPending) {
+                foundRows.clear();
+            }
+        }
+        scrollSongs(0);
+    };
+
+    // Playlists page: names down the left (smart ones in italics), clicking one shows its entries
+    // beside them the way the song list does. Clicking an entry plays it, right clicking takes it
+    // out of a plain playlist; right clicking a name deletes the playlist. A smart playlist is
+    // made from the rule typed in the search bar, and playlists are imported from and exported to
+    // M3U/PLS files named there (see PlaylistFiles). On the Home page Ctrl+click adds a song to
+    // the plain playlist shown last, Ctrl+Shift+click every song listed; Shift+click queues a
+    // song to play next, Alt+click after what's queued already.
+    const float playlistRowHeight = 32.0f;
+    const float entryListLeft = 440.0f;
+    std::uint32_t shownPlaylist = playlists.getPlaylists().empty() ? 0 : playlists.getPlaylists().front().id;
+    std::size_t firstEntryRow = 0;
+    sf::Text playlistName;
+    playlistName.setFont(font);
+    playlistName.setCharacterSize(18);
+    auto shownTracks = [&]() -> const std::vector<std::uint32_t>* {
+        const Playlist* playlist = playlists.find(shownPlaylist);
+        if (!playlist) {
+            return nullptr;
+        }
+        return playlist->rule.empty() ? &playlist->tracks : player.getSmartTracks(shownPlaylist);
+    };
+    auto shownEntries = [&] {
+        const std::vector<std::uint32_t>* tracks = shownTracks();
+        return tracks ? tracks->size() : 0;
+    };
+    auto scrollEntries = [&](long rows) {
+        std::size_t count = shownEntries();
+        std::size_t last = (count > visibleSongRows) ? count - visibleSongRows : 0;
+        long first = static_cast<long>(firstEntryRow) + rows;
+        firstEntryRow = std::min(static_cast<std::size_t>(std::max(0L, first)), last);
+    };
+
+    // Queue page: the play order from the current track on (see PlayQueue), tracks queued to play
+    // next in green. Clicking an entry plays it, dragging it moves it, right clicking takes it out.
+    std::size_t firstQueueRow = 0;
+    std::size_t dragFrom = PlayQueue::npos;
+    auto scrollQueue = [&](long rows) {
+        std::size_t count = player.getQueue().getCount();
+        std::size_t last = (count > visibleSongRows) ? count - visibleSongRows : 0;
+        long first = static_cast<long>(firstQueueRow) + rows;
+        firstQueueRow = std::min(static_cast<std::size_t>(std::max(0L, first)), last);
+    };
+    auto queueRowAt = [&](int x, int y) {
+        if (x < 220 || y < songListTop || y >= songListTop + visibleSongRows * songRowHeight) {
+            return PlayQueue::npos;
+        }
+        std::size_t row = firstQueueRow + static_cast<std::size_t>((y - songListTop) / songRowHeight);
+        return (row < player.getQueue().getCount()) ? row : PlayQueue::npos;
+    };
+
+    // Waveform seek bar: one vertical line per pixel column from the cached peaks, so a new track
+    // shows at once. Rebuilt only when the track changes (or its summary turns up), recolored per
+    // frame to show how much has played. Clicking it seeks.
+    const sf::FloatRect seekArea(20.0f, windowHeight - controlBarHeight + 6.0f, windowWidth - 40.0f, 24.0f);
+    const std::size_t seekColumns = static_cast<std::size_t>(seekArea.width);
+    sf::VertexArray waveform(sf::Lines);
+    std::vector<WaveformPeak> peaks;
+    std::string waveformPath;
+    bool hasWaveform = false;
+    auto buildWaveform = [&] {
+        waveform.clear();
+        if (!player.getWaveforms().get(waveformPath, seekColumns, peaks)) {
+            return false;
+        }
+        float middle = seekArea.top + seekArea.height / 2.0f;
+        float scale = seekArea.height / 2.0f / 127.0f;
+        for (std::size_t x = 0; x < seekColumns; ++x) {
+            const WaveformPeak& peak = peaks[x * peaks.size() / seekColumns];
+            float top = middle - peak.high * scale;
+            float bottom = std::max(middle - peak.low * scale, top + 1.0f);  // Silence still shows a line
+            waveform.append(sf::Vertex(sf::Vector2f(seekArea.left + x + 0.5f, top)));
+            waveform.append(sf::Vertex(sf::Vector2f(seekArea.left + x + 0.5f, bottom)));
+        }
+        return true;
+    };
 
     // Main loop
     Page currentPage = Page::Home;
@@ -256,10 +1156,75 @@ int main() {
                 window.close();
             }
 
+            // Typing into the search bar
+            if (event.type == sf::Event::TextEntered && searchFocused) {
+                sf::Uint32 c = event.text.unicode;
+                if (c == 8) {  // Backspace, removes a whole UTF-8 character
+                    while (!searchQuery.empty() && (static_cast<unsigned char>(searchQuery.back()) & 0xC0) == 0x80) {
+                        searchQuery.pop_back();
+                    }
+                    if (!searchQuery.empty()) {
+                        searchQuery.pop_back();
+                    }
+                }
+                else if (c == 27) {  // Escape
+                    searchQuery.clear();
+                    searchFocused = false;
+                }
+                else if (c >= 32 && c != 127) {
+                    std::basic_string<sf::Uint8> utf8 = sf::String(c).toUtf8();
+                    searchQuery.append(utf8.begin(), utf8.end());
+                }
+                firstSongRow = 0;
+                runSearch();
+                showSearchText();
+            }
+
+            // Volume wheel
+            if (event.type == sf::Event::MouseWheelScrolled &&
+                volumeButton.getGlobalBounds().contains(event.mouseWheelScroll.x, event.mouseWheelScroll.y)) {
+                player.setVolume(player.getVolume() + 0.05f * event.mouseWheelScroll.delta);
+                player.setMuted(false);
+                volumeText.setString("Volume " + std::to_string(static_cast<int>(player.getVolume() * 100.0f + 0.5f)) + "%");
+            }
+
+            // Song list wheel
+            if (event.type == sf::Event::MouseWheelScrolled && currentPage == Page::Home &&
+                contentArea.getGlobalBounds().contains(event.mouseWheelScroll.x, event.mouseWheelScroll.y)) {
+                scrollSongs(static_cast<long>(-3.0f * event.mouseWheelScroll.delta));
+            }
+            if (event.type == sf::Event::MouseWheelScrolled && currentPage == Page::Playlists &&
+                contentArea.getGlobalBounds().contains(event.mouseWheelScroll.x, event.mouseWheelScroll.y)) {
+                scrollEntries(static_cast<long>(-3.0f * event.mouseWheelScroll.delta));
+            }
+            if (event.type == sf::Event::MouseWheelScrolled && currentPage == Page::Queue &&
+                contentArea.getGlobalBounds().contains(event.mouseWheelScroll.x, event.mouseWheelScroll.y)) {
+                scrollQueue(static_cast<long>(-3.0f * event.mouseWheelScroll.delta));
+            }
+
+            // Dropping a queue entry dragged from another row moves it there, dropping it where it
+            // was plays it
+            if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left && dragFrom != PlayQueue::npos) {
+                std::size_t to = queueRowAt(event.mouseButton.x, event.mouseButton.y);
+                if (to == dragFrom) {
+                    player.playQueued(to);
+                    isPlaying = true;
+                    playPauseButton.setTexture(pauseTexture);
+                }
+                else if (to != PlayQueue::npos) {
+                    player.moveQueued(dragFrom, to);
+                }
+                dragFrom = PlayQueue::npos;
+            }
+
             // Handle button clicks
             if (event.type == sf::Event::MouseButtonPressed) {
                 sf::Vector2i mousePos = sf::Mouse::getPosition(window);
 
+                // Search bar takes the keyboard while it has been clicked last
+                searchFocused = searchBar.getGlobalBounds().contains(mousePos.x, mousePos.y);
+                showSearchText();
+
                 // Next button
                 if (nextButton.getGlobalBounds().contains(mousePos.x, mousePos.y)) {
                     player.next();
@@ -280,6 +1245,21 @@ int main() {
                     player.loop(!player.getIsLooping());
                 }
 
+                // Volume button
+                if (volumeButton.getGlobalBounds().contains(mousePos.x, mousePos.y)) {
+                    player.setMuted(!player.getIsMuted());
+                    volumeText.setString(player.getIsMuted() ? "Muted"
+                                                             : "Volume " + std::to_string(static_cast<int>(player.getVolume() * 100.0f + 0.5f)) + "%");
+                }
+
+                // Settings button
+                if (settingsButton.getGlobalBounds().contains(mousePos.x, mousePos.y)) {
+                    crossfadeChoice = (crossfadeChoice + 1) % 4;
+                    player.setCrossfade(sf::seconds(crossfadeChoices[crossfadeChoice]));
+                    crossfadeText.setString(crossfadeChoice == 0 ? "Crossfade off"
+                                                                 : "Crossfade " + std::to_string(static_cast<int>(crossfadeChoices[crossfadeChoice])) + "s");
+                }
+
                 // Play/pause button
                 if (playPauseButton.getGlobalBounds().contains(mousePos.x, mousePos.y)) {
                     if (isPlaying) {
@@ -303,17 +1283,137 @@ int main() {
                         case 1:
                             currentPage = Page::Playlists;
                             break;
+                        case 2:
+                            currentPage = Page::Queue;
+                            firstQueueRow = 0;
+                            scrollQueue(static_cast<long>(player.getQueue().getCurrent()));  // Current track at the top
+                            break;
                         default:
                             break;
                         }
                     }
                 }
 
-                // Song buttons
-                if (currentPage == Page::Home) {
-                    for (size_t i = 0; i < songButtons.size(); ++i) {
-                        if (songButtons[i].getGlobalBounds().contains(mousePos.x, mousePos.y)) {
-                            player.playSong(i);
+                // Seek bar
+                if (seekArea.contains(static_cast<float>(mousePos.x), static_cast<float>(mousePos.y))) {
+                    float fraction = (mousePos.x - seekArea.left) / seekArea.width;
+                    player.seek(player.getCurrentDuration() * fraction);
+                }
+
+                // Song rows
+                if (currentPage == Page::Home && mousePos.x >= 220.0f && mousePos.y >= songListTop &&
+                    mousePos.y < songListTop + visibleSongRows * songRowHeight) {
+                    std::size_t row = firstSongRow + static_cast<std::size_t>((mousePos.y - songListTop) / songRowHeight);
+                    bool control = sf::Keyboard::isKeyPressed(sf::Keyboard::LControl) || sf::Keyboard::isKeyPressed(sf::Keyboard::RControl);
+                    bool shift = sf::Keyboard::isKeyPressed(sf::Keyboard::LShift) || sf::Keyboard::isKeyPressed(sf::Keyboard::RShift);
+                    bool alt = sf::Keyboard::isKeyPressed(sf::Keyboard::LAlt) || sf::Keyboard::isKeyPressed(sf::Keyboard::RAlt);
+                    const Playlist* target = playlists.find(shownPlaylist);
+                    if (row < listedSongs() && !control && (shift || alt)) {
+                        if (shift) {
+                            player.playNext(listedRow(row));
+                        }
+                        else {
+                            player.enqueue(listedRow(row));
+                        }
+                    }
+                    else if (row < listedSongs() && control && target && target->rule.empty()) {
+                        std::vector<std::uint32_t> ids;
+                        for (std::size_t i = shift ? 0 : row; i < (shift ? listedSongs() : row + 1); ++i) {
+                            ids.push_back(player.getCatalog().getId(listedRow(i)));
+                        }
+                        playlists.append(shownPlaylist, ids.data(), ids.size());
+                    }
+                    else if (row < listedSongs() && event.mouseButton.button == sf::Mouse::Right) {
+                        // Right click narrows the list to the row's artist, on top of what is typed
+                        std::string_view artist = player.getCatalog().getArtist(listedRow(row));
+                        if (!artist.empty()) {
+                            searchQuery += (searchQuery.empty() ? "" : " ") + std::string("artist:") + FacetIndex::quote(artist);
+                            firstSongRow = 0;
+                            runSearch();
+                            showSearchText();
+                        }
+                    }
+                    else if (row < listedSongs()) {
+                        player.playSong(static_cast<int>(listedRow(row)));
+                        isPlaying = true;
+                        playPauseButton.setTexture(pauseTexture);
+                    }
+                }
+
+                // Queue entries
+                std::size_t entry = queueRowAt(mousePos.x, mousePos.y);
+                if (currentPage == Page::Queue && entry != PlayQueue::npos) {
+                    if (event.mouseButton.button == sf::Mouse::Right) {
+                        player.removeQueued(entry);
+                        scrollQueue(0);
+                    }
+                    else if (event.mouseButton.button == sf::Mouse::Left) {
+                        dragFrom = entry;
+                    }
+                }
+
+                // Playlist names and entries
+                if (currentPage == Page::Playlists && mousePos.x >= 220.0f && mousePos.y >= songListTop &&
+                    mousePos.y < songListTop + visibleSongRows * songRowHeight) {
+                    bool right = event.mouseButton.button == sf::Mouse::Right;
+                    const std::vector<Playlist>& lists = playlists.getPlaylists();
+                    if (mousePos.x < entryListLeft) {
+                        std::size_t index = static_cast<std::size_t>((mousePos.y - songListTop) / playlistRowHeight);
+                        if (index < lists.size() && right) {
+                            player.forgetSmartPlaylist(lists[index].id);
+                            playlists.remove(lists[index].id);
+                            if (!playlists.find(shownPlaylist)) {
+                                shownPlaylist = lists.empty() ? 0 : lists.front().id;
+                                firstEntryRow = 0;
+                            }
+                        }
+                        else if (index < lists.size()) {
+                            shownPlaylist = lists[index].id;
+                            firstEntryRow = 0;
+                        }
+                        else if (index == lists.size()) {  // "New playlist"
+                            shownPlaylist = playlists.create("Playlist " + std::to_string(lists.size() + 1));
+                            firstEntryRow = 0;
+                        }
+                        else if (index == lists.size() + 1 && player.defineSmartPlaylist(playlists.getNextId(), searchQuery)) {
+                            std::uint32_t playlist = playlists.create(searchQuery);
+                            playlists.setRule(playlist, searchQuery);
+                            shownPlaylist = playlist;
+                            firstEntryRow = 0;
+                        }
+                        else if (index == lists.size() + 1) {
+                            std::cerr << "Not a smart playlist rule: " << searchQuery << std::endl;
+                        }
+                        else if (index == lists.size() + 2) {  // "Import"
+                            PlaylistFiles::Imported imported;
+                            if (PlaylistFiles::read(searchQuery, player.getCatalog(), imported)) {
+                                shownPlaylist = playlists.create(imported.name);
+                                playlists.append(shownPlaylist, imported.tracks.data(), imported.tracks.size());
+                                firstEntryRow = 0;
+                                if (imported.missing > 0) {
+                                    std::cerr << imported.missing << " entries of " << searchQuery << " aren't in the library" << std::endl;
+                                }
+                            }
+                            else {
+                                std::cerr << "Error reading playlist " << searchQuery << std::endl;
+                            }
+                        }
+                        else if (index == lists.size() + 3 && shownTracks()) {  // "Export", to the name typed or one made up
+                            std::string file = searchQuery.empty() ? PlaylistFiles::fileNameFor(playlists.find(shownPlaylist)->name) : searchQuery;
+                            if (!PlaylistFiles::write(file, *shownTracks(), player.getCatalog())) {
+                                std::cerr << "Error writing playlist " << file << std::endl;
+                            }
+                        }
+                    }
+                    else if (const std::vector<std::uint32_t>* tracks = shownTracks()) {
+                        std::size_t entry = firstEntryRow + static_cast<std::size_t>((mousePos.y - songListTop) / songRowHeight);
+                        std::size_t row = (entry < tracks->size()) ? player.getCatalog().findId((*tracks)[entry]) : TrackCatalog::npos;
+                        if (entry < tracks->size() && right && tracks == &playlists.find(shownPlaylist)->tracks) {
+                            playlists.erase(shownPlaylist, entry, 1);
+                            scrollEntries(0);
+                        }
+                        else if (row != TrackCatalog::npos) {
+                            player.playSong(static_cast<int>(row));
                             isPlaying = true;
                             playPauseButton.setTexture(pauseTexture);
                         }
@@ -322,6 +1422,24 @@ int main() {
             }
         }
 
+        // Swap in any track the loader has finished opening
+        player.update();
+        if (player.getLibraryVersion() != libraryVersion) {
+            libraryVersion = player.getLibraryVersion();
+            runSearch();  // Rows moved; also keeps the view inside a shorter list
+        }
+        else if (searchPending) {
+            runSearch();
+        }
+        if (!searchQuery.empty() && player.pollSearch(foundRows)) {
+            scrollSongs(0);  // Typo-tolerant results replace the exact ones
+        }
+        std::string currentPath = player.getCurrentPath();
+        if (currentPath != waveformPath || !hasWaveform) {
+            waveformPath = currentPath;
+            hasWaveform = buildWaveform();
+        }
+
         // Clear screen
         window.clear();
 
@@ -333,6 +1451,8 @@ int main() {
         for (const auto& text : sidebarTexts) {
             window.draw(text);
         }
+        window.draw(searchBar);
+        window.draw(searchText);
 
         // Draw media control bar and buttons
         window.draw(controlBar);
@@ -343,18 +1463,98 @@ int main() {
         window.draw(loopButton);
         window.draw(volumeButton);
         window.draw(settingsButton);
+        window.draw(crossfadeText);
+        window.draw(volumeText);
+        if (hasWaveform) {
+            sf::Time duration = player.getCurrentDuration();
+            float played = (duration > sf::Time::Zero) ? player.getPlayingOffset() / duration * seekArea.width : 0.0f;
+            for (std::size_t i = 0; i < waveform.getVertexCount(); ++i) {
+                waveform[i].color = (i / 2 < played) ? sf::Color(30, 215, 96) : sf::Color(110, 110, 110);
+            }
+            window.draw(waveform);
+        }
 
         // Draw content based on the current page
         if (currentPage == Page::Home) {
-            // Draw song buttons
-            for (const auto& button : songButtons) {
-                window.draw(button);
+            // Draw the song rows in view
+            const TrackCatalog& catalog = player.getCatalog();
+            std::size_t end = std::min(listedSongs(), firstSongRow + visibleSongRows);
+            for (std::size_t i = firstSongRow; i < end; ++i) {
+                std::size_t row = listedRow(i);
+                std::string_view title = catalog.getTitle(row);
+                std::string_view artist = catalog.getArtist(row);
+                sf::String label = sf::String::fromUtf8(title.begin(), title.end());
+                if (!artist.empty()) {
+                    label += " - " + sf::String::fromUtf8(artist.begin(), artist.end());
+                }
+                songRow.setString(label);
+                songRow.setPosition(220.0f, songListTop + (i - firstSongRow) * songRowHeight);
+                window.draw(songRow);
             }
         }
+        else if (currentPage == Page::Playlists) {
+            // Draw the playlist names, then the shown playlist's entries in view
+            const std::vector<Playlist>& lists = playlists.getPlaylists();
+            const char* const actions[] = { "+ New playlist", "+ Smart playlist (rule in search bar)", "+ Import playlist (file in search bar)",
+                                            "+ Export shown playlist (to file in search bar)" };
+            for (std::size_t i = 0; i < lists.size() + 4; ++i) {
+                bool shown = i < lists.size() && lists[i].id == shownPlaylist;
+                playlistName.setString(i < lists.size() ? sf::String::fromUtf8(lists[i].name.begin(), lists[i].name.end()) : sf::String(actions[i - lists.size()]));
+                playlistName.setFillColor(shown ? sf::Color(30, 215, 96) : (i < lists.size()) ? sf::Color::White : sf::Color(130, 130, 130));
+                playlistName.setStyle((i < lists.size() && !lists[i].rule.empty()) ? sf::Text::Italic : sf::Text::Regular);
+                playlistName.setPosition(220.0f, songListTop + i * playlistRowHeight);
+                window.draw(playlistName);
+            }
+            if (const std::vector<std::uint32_t>* tracks = shownTracks()) {
+                const TrackCatalog& catalog = player.getCatalog();
+                std::size_t end = std::min(tracks->size(), firstEntryRow + visibleSongRows);
+                for (std::size_t i = firstEntryRow; i < end; ++i) {
+                    std::size_t row = catalog.findId((*tracks)[i]);
+                    sf::String label = "Missing track";  // Gone from the library since it was added
+                    if (row != TrackCatalog::npos) {
+                        std::string_view title = catalog.getTitle(row);
+                        std::string_view artist = catalog.getArtist(row);
+                        label = sf::String::fromUtf8(title.begin(), title.end());
+                        if (!artist.empty()) {
+                            label += " - " + sf::String::fromUtf8(artist.begin(), artist.end());
+                        }
+                    }
+                    songRow.setFillColor((row != TrackCatalog::npos) ? sf::Color::White : sf::Color(130, 130, 130));
+                    songRow.setString(label);
+                    songRow.setPosition(entryListLeft, songListTop + (i - firstEntryRow) * songRowHeight);
+                    window.draw(songRow);
+                }
+                songRow.setFillColor(sf::Color::White);
+            }
+        }
+        else if (currentPage == Page::Queue) {
+            // Draw the queue entries in view, the current one marked
+            const TrackCatalog& catalog = player.getCatalog();
+            const PlayQueue& queue = player.getQueue();
+            std::size_t end = std::min(queue.getCount(), firstQueueRow + visibleSongRows);
+            for (std::size_t i = firstQueueRow; i < end; ++i) {
+                std::size_t row = catalog.findId(queue.at(i));
+                std::string_view title = catalog.getTitle(row);
+                std::string_view artist = catalog.getArtist(row);
+                sf::String label = sf::String::fromUtf8(title.begin(), title.end());
+                if (!artist.empty()) {
+                    label += " - " + sf::String::fromUtf8(artist.begin(), artist.end());
+                }
+                bool upNext = i > queue.getCurrent() && i <= queue.getCurrent() + queue.getUpNext();
+                songRow.setString((i == queue.getCurrent() ? sf::String("> ") : sf::String("   ")) + label);
+                songRow.setFillColor(upNext ? sf::Color(30, 215, 96) : (i == dragFrom) ? sf::Color(130, 130, 130) : sf::Color::White);
+                songRow.setPosition(220.0f, songListTop + (i - firstQueueRow) * songRowHeight);
+                window.draw(songRow);
+            }
+            songRow.setFillColor(sf::Color::White);
+        }
 
         // Update the window
         window.display();
     }
 
+    std::cout << "Longest event-loop stall during track changes: "
+              << player.getMaxStall().asMicroseconds() / 1000.0f << " ms" << std::endl;
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "LibraryScanner.hpp"
+#include "MappedFile.hpp"
+
+// Lowest and highest sample over a stretch of a track, across all channels, scaled to [-127, 127]
+struct WaveformPeak {
+    std::int8_t low;
+    std::int8_t high;
+};
+
+// Min/max summary of one signal at several zoom levels: the track is split into 1024 equal
+// buckets, and each coarser level merges 4 buckets of the one before (1024, 256, 64).
+class WaveformBuilder {
+public:
+    static constexpr std::size_t baseBuckets = 1024;
+    static constexpr std::size_t levelFactor = 4;
+    static constexpr std::size_t peakCount = baseBuckets + baseBuckets / 4 + baseBuckets / 16;  // All levels together
+
+    // frameCount is the track length; frames past it land in the last bucket
+    WaveformBuilder(sf::Uint64 frameCount, unsigned int channelCount)
+        : frameCount(std::max<sf::Uint64>(frameCount, 1)), channels(channelCount), position(0), bucket(0),
+          low(baseBuckets, 0.0f), high(baseBuckets, 0.0f) {
+        bucketEnd = bucketBoundary(1);
+    }
+
+    // Feeds interleaved frames
+    void add(const float* samples, std::size_t frames) {
+        for (std::size_t i = 0; i < frames; ++i) {
+            while (position >= bucketEnd && bucket + 1 < baseBuckets) {
+                ++bucket;
+                bucketEnd = bucketBoundary(bucket + 1);
+            }
+            for (unsigned int c = 0; c < channels; ++c) {
+                float sample = samples[i * channels + c];
+                low[bucket] = std::min(low[bucket], sample);
+                high[bucket] = std::max(high[bucket], sample);
+            }
+            ++position;
+        }
+    }
+
+    // Every level, finest first
+    std::vector<WaveformPeak> finish() const {
+        std::vector<WaveformPeak> peaks(baseBuckets);
+        for (std::size_t i = 0; i < baseBuckets; ++i) {
+            peaks[i] = WaveformPeak{ quantize(low[i]), quantize(high[i]) };
+        }
+        std::size_t level = 0;
+        for (std::size_t count = baseBuckets / levelFactor; peaks.size() < peakCount; count /= levelFactor) {
+            for (std::size_t i = 0; i < count; ++i) {
+                WaveformPeak merged = peaks[level + i * levelFactor];
+                for (std::size_t j = 1; j < levelFactor; ++j) {
+                    merged.low = std::min(merged.low, peaks[level + i * levelFactor + j].low);
+                    merged.high = std::max(merged.high, peaks[level + i * levelFactor + j].high);
+                }
+                peaks.push_back(merged);
+            }
+            level = peaks.size() - count;
+        }
+        return peaks;
+    }
+
+private:
+    sf::Uint64 bucketBoundary(std::size_t index) const {
+        return frameCount * index / baseBuckets;
+    }
+
+    static std::int8_t quantize(float sample) {
+        return static_cast<std::int8_t>(std::lround(std::max(-1.0f, std::min(1.0f, sample)) * 127.0f));
+    }
+
+    sf::Uint64 frameCount;
+    unsigned int channels;
+    sf::Uint64 position;   // Frames added so far
+    std::size_t bucket;
+    sf::Uint64 bucketEnd;  // First frame of the next bucket
+    std::vector<float> low;
+    std::vector<float> high;
+};
+
+// Waveform summaries of every track in the library, kept in a binary file (2.7 KB a track) so
+// each track is only decoded once. LoudnessLibrary's analysis jobs build them from the blocks
+// they decode anyway, and build one again when its file's fingerprint changes. The file is memory-mapped and only its paths are indexed on load,
+// so a summary's peaks are paged in when it's first drawn; reading one back never decodes.
+class WaveformLibrary {
+public:
+    explicit WaveformLibrary(const std::string& storePath) : storePath(storePath) {}
+
+    // Maps the stored summaries, returns false if there were none
+    bool load() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index();
+    }
+
+    // Writes the stored and new summaries beside the file and swaps it in, if any were added since load()
+    bool save() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fresh.empty()) {
+            return true;
+        }
+        std::string temporary = storePath + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                return false;
+            }
+            put(file, magic);
+            for (const auto& entry : fresh) {
+                putRecord(file, entry.first, entry.second.fingerprint, entry.second.peaks.data());
+            }
+            for (const auto& entry : stored) {
+                if (fresh.count(std::string(entry.first)) == 0) {
+                    putRecord(file, entry.first, entry.second.fingerprint, peaksAt(entry.second.offset));
+                }
+            }
+            if (!file) {
+                return false;
+            }
+        }
+        stored.clear();  // Its keys point into the mapping
+        mapping.close();  // Windows won't replace a mapped file
+        std::error_code error;
+        std::filesystem::rename(temporary, storePath, error);
+        if (!error) {
+            fresh.clear();
+        }
+        index();
+        return !error;
+    }
+
+    // Whether path has a summary of its file as fingerprint describes it
+    bool isCurrent(const std::string& path, const FileFingerprint& fingerprint) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = fresh.find(path);
+        if (it != fresh.end()) {
+            return it->second.fingerprint == fingerprint;
+        }
+        auto old = stored.find(path);
+        return old != stored.end() && old->second.fingerprint == fingerprint;
+    }
+
+    // Keeps peaks (from WaveformBuilder::finish()) as path's summary, written by the next save()
+    void store(const std::string& path, const FileFingerprint& fingerprint, std::vector<WaveformPeak> peaks) {
+        Entry entry;
+        entry.fingerprint = fingerprint;
+        entry.peaks = std::move(peaks);
+        std::lock_guard<std::mutex> lock(mutex);
+        fresh[path] = std::move(entry);
+    }
+
+    bool has(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return find(path) != nullptr;
+    }
+
+    // Copies the coarsest level of path's summary that still has at least width buckets (the
+    // finest if none has), returns false if the track hasn't been summarized yet
+    bool get(const std::string& path, std::size_t width, std::vector<WaveformPeak>& peaks) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        const WaveformPeak* levels = find(path);
+        if (!levels) {
+            return false;
+        }
+        std::size_t start = 0;
+        std::size_t count = WaveformBuilder::baseBuckets;
+        while (count / WaveformBuilder::levelFactor >= width && start + count < WaveformBuilder::peakCount) {
+            start += count;
+            count /= WaveformBuilder::levelFactor;
+        }
+        peaks.assign(levels + start, levels + start + count);
+        return true;
+    }
+
+private:
+    // A summary computed since load()
+    struct Entry {
+        FileFingerprint fingerprint;
+        std::vector<WaveformPeak> peaks;  // Every level, finest first
+    };
+
+    // A summary in the mapped file
+    struct Stored {
+        FileFingerprint fingerprint;
+        std::size_t offset;  // Of its peaks
+    };
+
+    static constexpr std::uint32_t magic = 0x31465657;  // "WVF1"
+    static constexpr std::size_t fingerprintBytes = sizeof(std::uint64_t) + sizeof(std::int64_t) + sizeof(std::uint64_t);
+    static constexpr std::size_t peakBytes = WaveformBuilder::peakCount * sizeof(WaveformPeak);
+
+    // Maps the file and indexes its records by path, leaving the peaks where they are
+    bool index() {
+        if (!mapping.open(storePath)) {
+            return false;
+        }
+        const char* data = mapping.getData();
+        std::size_t size = mapping.getSize();
+        std::size_t offset = 0;
+        std::uint32_t fileMagic = 0;
+        if (!take(data, size, offset, fileMagic) || fileMagic != magic) {
+            mapping.close();
+            return false;
+        }
+
+        // A record is the path, the fingerprint it was computed for, then every level's peaks
+        std::uint32_t pathLength;
+        while (take(data, size, offset, pathLength) && size - offset >= pathLength + fingerprintBytes + peakBytes) {
+            std::string_view path(data + offset, pathLength);
+            offset += pathLength;
+            Stored entry;
+            take(data, size, offset, entry.fingerprint.size);
+            take(data, size, offset, entry.fingerprint.modified);
+            take(data, size, offset, entry.fingerprint.inode);
+            entry.offset = offset;
+            offset += peakBytes;
+            stored[path] = entry;
+        }
+        return true;
+    }
+
+    // Every level of path's summary, or null; the caller holds mutex
+    const WaveformPeak* find(const std::string& path) const {
+        auto it = fresh.find(path);
+        if (it != fresh.end()) {
+            return it->second.peaks.data();
+        }
+        auto old = stored.find(path);
+        return (old != stored.end()) ? peaksAt(old->second.offset) : nullptr;
+    }
+
+    const WaveformPeak* peaksAt(std::size_t offset) const {
+        return reinterpret_cast<const WaveformPeak*>(mapping.getData() + offset);
+    }
+
+    template <typename T>
+    static bool take(const char* data, std::size_t size, std::size_t& offset, T& value) {
+        if (size - offset < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    static void put(std::ofstream& file, const T& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static void putRecord(std::ofstream& file, std::string_view path, const FileFingerprint& fingerprint, const WaveformPeak* peaks) {
+        put(file, static_cast<std::uint32_t>(path.size()));
+        file.write(path.data(), static_cast<std::streamsize>(path.size()));
+        put(file, fingerprint.size);
+        put(file, fingerprint.modified);
+        put(file, fingerprint.inode);
+        file.write(reinterpret_cast<const char*>(peaks), peakBytes);
+    }
+
+    std::string storePath;
+    mutable std::mutex mutex;  // Guards the mapping, stored and fresh; analysis jobs store() from the pool's threads
+    MappedFile mapping;
+    std::unordered_map<std::string_view, Stored> stored;  // Keys point into the mapping
+    std::unordered_map<std::string, Entry> fresh;         // Replace stored summaries of the same path
+};